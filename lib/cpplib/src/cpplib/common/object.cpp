@@ -7,12 +7,24 @@ Object::Object() {
 Object::~Object() {
 }
 
+// a new reference can only come from an existing one, so nothing needs
+// ordering against it
 int Object::retain() {
+#ifdef CPPLIB_SINGLE_THREADED
     return ++refcount;
+#else
+    return __atomic_add_fetch(&refcount, 1, __ATOMIC_RELAXED);
+#endif
 }
 
+// the release orders this thread's writes before the delete; the acquire
+// makes every other thread's writes visible to it
 int Object::release() {
+#ifdef CPPLIB_SINGLE_THREADED
     int count = --refcount;
+#else
+    int count = __atomic_sub_fetch(&refcount, 1, __ATOMIC_ACQ_REL);
+#endif
 
     if(!count) {
         delete this;
@@ -21,3 +33,11 @@ int Object::release() {
 
     return count;
 }
+
+int Object::getRefCount() {
+#ifdef CPPLIB_SINGLE_THREADED
+    return refcount;
+#else
+    return __atomic_load_n(&refcount, __ATOMIC_RELAXED);
+#endif
+}
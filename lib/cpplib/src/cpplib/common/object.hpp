@@ -1,6 +1,13 @@
 #ifndef _OBJECT_HPP
 #define _OBJECT_HPP
 
+/**
+ * Reference counted base class. Objects start with a count of 1 and
+ * delete themselves when released to 0.
+ *
+ * The count is atomic, so objects may be shared between threads. Define
+ * CPPLIB_SINGLE_THREADED to build with a plain count instead.
+ */
 class Object {
     int refcount;
     public:
@@ -9,6 +16,7 @@ class Object {
     virtual ~Object();
     int retain();
     int release();
+    int getRefCount();
 };
 
 #endif
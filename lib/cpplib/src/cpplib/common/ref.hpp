@@ -0,0 +1,67 @@
+#ifndef _REF_HPP
+#define _REF_HPP
+
+#include <stddef.h>
+
+/**
+ * Owning pointer to an Object.
+ *
+ * Constructing from a raw pointer adopts the reference it already holds,
+ * so Ref<T>(new T) leaves the count at 1. Use share() to take a new
+ * reference to an object owned elsewhere. Copies retain, moves and swaps
+ * don't touch the count at all.
+ *
+ * Borrow by passing get() or a const Ref&; neither changes the count.
+ */
+template<typename T>
+class Ref {
+    T *ptr;
+
+    public:
+    Ref() : ptr(NULL) {}
+    explicit Ref(T *p) : ptr(p) {}
+    Ref(const Ref &o) : ptr(o.ptr) { if(ptr) ptr->retain(); }
+    Ref(Ref &&o) noexcept : ptr(o.ptr) { o.ptr = NULL; }
+    template<typename U> Ref(const Ref<U> &o) : ptr(o.get()) { if(ptr) ptr->retain(); }
+    template<typename U> Ref(Ref<U> &&o) : ptr(o.leak()) {}
+    ~Ref() { if(ptr) ptr->release(); }
+
+    // takes its argument by value, so assigning an rvalue is a move
+    Ref &operator=(Ref o) { swap(o); return *this; }
+
+    static Ref share(T *p) {
+        if(p) p->retain();
+        return Ref(p);
+    }
+
+    T *get() const { return ptr; }
+    T *operator->() const { return ptr; }
+    T &operator*() const { return *ptr; }
+    explicit operator bool() const { return ptr != NULL; }
+
+    void swap(Ref &o) noexcept {
+        T *p = ptr;
+        ptr = o.ptr;
+        o.ptr = p;
+    }
+
+    // releases the current object, and adopts p
+    void reset(T *p = NULL) {
+        Ref(p).swap(*this);
+    }
+
+    // gives up ownership without releasing; the caller now owns the reference
+    T *leak() {
+        T *p = ptr;
+        ptr = NULL;
+        return p;
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const Ref<T> &a, const Ref<U> &b) { return a.get() == b.get(); }
+
+template<typename T, typename U>
+bool operator!=(const Ref<T> &a, const Ref<U> &b) { return a.get() != b.get(); }
+
+#endif
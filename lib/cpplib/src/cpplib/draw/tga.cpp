@@ -108,3 +108,41 @@ Image *loadTga(Input &file) {
 
     return image;
 }
+
+/**
+ * writes an uncompressed 32 bit tga, top row first.
+ * returns false if the file could not be written.
+ */
+bool saveTga(const Image &image, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if(!file) return false;
+
+    int w = image.getWidth();
+    int h = image.getHeight();
+    uint8_t header[18] = {0};
+    header[2] = 2; // uncompressed true color
+    header[12] = w & 0xFF;
+    header[13] = (w >> 8) & 0xFF;
+    header[14] = h & 0xFF;
+    header[15] = (h >> 8) & 0xFF;
+    header[16] = 32;
+    header[17] = 0x28; // 8 alpha bits, top left origin
+    fwrite(header, sizeof(header), 1, file);
+
+    const Pixel *pixels = image.getPixelPtr();
+    uint8_t *row = new uint8_t[w * 4];
+    for(int j = 0; j < h; j++) {
+        for(int i = 0; i < w; i++) {
+            const Pixel &p = pixels[j * w + i];
+            row[i * 4 + 0] = p.b;
+            row[i * 4 + 1] = p.g;
+            row[i * 4 + 2] = p.r;
+            row[i * 4 + 3] = p.a;
+        }
+        fwrite(row, w * 4, 1, file);
+    }
+    delete[] row;
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
@@ -6,5 +6,6 @@
 #include "cpplib/common/input.hpp"
 
 Image *loadTga(Input &file);
+bool saveTga(const Image &image, const char *filename);
 
 #endif
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+#include <utility>
+#include <vector>
+
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/ref.hpp"
+
+class Counted : public Object {
+    public:
+    static int live;
+    Counted() { live++; }
+    virtual ~Counted() { live--; }
+};
+
+int Counted::live = 0;
+
+TEST(Object, RetainRelease) {
+    Counted *o = new Counted;
+    EXPECT_EQ(Counted::live, 1);
+    EXPECT_EQ(o->getRefCount(), 1);
+    EXPECT_EQ(o->retain(), 2);
+    EXPECT_EQ(o->release(), 1);
+    EXPECT_EQ(o->release(), 0);
+    EXPECT_EQ(Counted::live, 0);
+}
+
+#ifndef CPPLIB_SINGLE_THREADED
+static void *churn(void *arg) {
+    Object *o = (Object*) arg;
+    for(int i = 0; i < 100000; i++) {
+        o->retain();
+        o->release();
+    }
+    return NULL;
+}
+
+TEST(Object, Threads) {
+    Counted *o = new Counted;
+    pthread_t threads[4];
+    for(int i = 0; i < 4; i++) pthread_create(&threads[i], NULL, churn, o);
+    for(int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+
+    EXPECT_EQ(o->getRefCount(), 1);
+    o->release();
+    EXPECT_EQ(Counted::live, 0);
+}
+#endif
+
+TEST(Object, Ref) {
+    {
+        Ref<Counted> a(new Counted);
+        EXPECT_EQ(a->getRefCount(), 1);
+
+        Ref<Counted> b = a;
+        EXPECT_EQ(a->getRefCount(), 2);
+        EXPECT_TRUE(a == b);
+
+        // moves hand the reference over untouched
+        Ref<Object> c(std::move(b));
+        EXPECT_FALSE(b);
+        EXPECT_EQ(a->getRefCount(), 2);
+
+        Ref<Counted> d = Ref<Counted>::share(a.get());
+        EXPECT_EQ(a->getRefCount(), 3);
+        d.reset();
+        c = Ref<Object>();
+        EXPECT_EQ(a->getRefCount(), 1);
+        EXPECT_EQ(Counted::live, 1);
+    }
+    EXPECT_EQ(Counted::live, 0);
+
+    // growing a vector moves its elements rather than copying them
+    std::vector<Ref<Counted> > refs;
+    for(int i = 0; i < 100; i++) refs.push_back(Ref<Counted>(new Counted));
+    EXPECT_EQ(refs[0]->getRefCount(), 1);
+    refs.clear();
+    EXPECT_EQ(Counted::live, 0);
+}
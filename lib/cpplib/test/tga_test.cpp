@@ -91,3 +91,27 @@ TEST(TGA, OriginTop) {
     EXPECT_EQ(Pixel(0xaa, 0xaa, 0xaa, 0xff), img->getPixel(1,2));
     EXPECT_EQ(Pixel(0x00, 0x00, 0x00, 0xff), img->getPixel(2,2));
 }
+
+TEST(TGA, SaveLoad) {
+    Image img(3, 2);
+    img.setPixel(0, 0, Pixel(0xff, 0x00, 0x00, 0xff));
+    img.setPixel(1, 0, Pixel(0x00, 0xff, 0x00, 0x80));
+    img.setPixel(2, 0, Pixel(0x00, 0x00, 0xff, 0x00));
+    img.setPixel(0, 1, Pixel(0x12, 0x34, 0x56, 0x78));
+    img.setPixel(1, 1, Pixel(0xff, 0xff, 0xff, 0xff));
+    img.setPixel(2, 1, Pixel(0x00, 0x00, 0x00, 0xff));
+    ASSERT_TRUE(saveTga(img, "tga_save_test.tga"));
+
+    File file("tga_save_test.tga");
+    Image *loaded = loadTga(file);
+    ASSERT_NE(loaded, (Image*) NULL);
+    EXPECT_EQ(3, loaded->getWidth());
+    EXPECT_EQ(2, loaded->getHeight());
+    for(int j = 0; j < 2; j++) {
+        for(int i = 0; i < 3; i++) {
+            EXPECT_EQ(img.getPixel(i, j), loaded->getPixel(i, j));
+        }
+    }
+    delete loaded;
+    remove("tga_save_test.tga");
+}
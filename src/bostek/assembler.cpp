@@ -0,0 +1,872 @@
+#include "assembler.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "bcpu.hpp"
+#include "mnemonics.hpp"
+#include "opcodes.hpp"
+#include "preprocessor.hpp"
+#include "cpplib/common/exception.hpp"
+
+using namespace Bostek::Cpu;
+
+// register number named by the token, or -1
+static int register_number(const Token &t) {
+    if(t.type != TOKEN_IDENTIFIER) return -1;
+    const Mnemonic *m = lookupMnemonic(t.text, t.len);
+    return m && m->kind == MNEMONIC_REGISTER ? m->op : -1;
+}
+
+// fits unsigned, or sign extended
+static bool fits(uint8_t type, uint32_t v) {
+    switch(type) {
+        case TYPE_BYTE: return v <= 0xFF || v >= 0xFFFFFF80;
+        case TYPE_WORD: return v <= 0xFFFF || v >= 0xFFFF8000;
+        default: return true;
+    }
+}
+
+static bool fits_rel16(uint32_t rel) {
+    return (int32_t) rel >= -0x8000 && (int32_t) rel <= 0x7FFF;
+}
+
+static int instruction_size(const Instruction &ins) {
+    switch(ins.format) {
+        case FORMAT_JUMP: return opcode_length(ins.is_long ? ins.op | 0x01 : ins.op);
+        case FORMAT_BRANCH: // inverted branch over an LRJMP
+            return opcode_length(ins.op) + (ins.is_long ? opcode_length(LRJMP) : 0);
+        case FORMAT_ORG:
+        case FORMAT_ALIGN: return 0;
+        case FORMAT_DATA: return type_size(ins.type);
+        case FORMAT_RES: return ins.value.addend;
+        default: return opcode_length(ins.op, ins.type << 4);
+    }
+}
+
+Assembler::Assembler(bool _relocatable) : tokens(NULL), line(0), file(0), finished(false), end_addr(ASM_ORIGIN),
+        relocatable(_relocatable), optimize(false) {
+    Section s = { !relocatable, relocatable ? 0u : (uint32_t) ASM_ORIGIN, 0, 0, 1 };
+    sections.push_back(s);
+}
+
+Assembler::~Assembler() {
+}
+
+// runs the peephole pass when finishing
+void Assembler::setOptimize(bool on) {
+    optimize = on;
+}
+
+void Assembler::error(const char *msg) {
+    throw Exception(String(files[file]) + ":" + String::fromInt(line) + ": " + String(msg));
+}
+
+void Assembler::error(const Instruction &ins, const char *msg) {
+    throw Exception(String(files[ins.file]) + ":" + String::fromInt(ins.line) + ": " + String(msg));
+}
+
+/**
+ * index of the named symbol; unknown names are entered as undefined, so
+ * labels can be used before they are defined
+ */
+int Assembler::symbol(const Token &t) {
+    int i = names.intern(t.text, t.len);
+    if(i < symbols.size()) return i;
+
+    Symbol s;
+    s.kind = SYMBOL_UNDEFINED;
+    s.value = 0;
+    s.section = -1;
+    s.line = t.line;
+    s.file = file;
+    symbols.push_back(s);
+    return i;
+}
+
+// labels the next instruction
+void Assembler::define(const Token &t) {
+    if(register_number(t) >= 0) error((String("register ") + t.toString() + " used as a label").c_str());
+    Symbol &s = symbols[symbol(t)];
+    if(s.kind != SYMBOL_UNDEFINED) {
+        error((String("symbol ") + t.toString() + " already defined").c_str());
+    }
+    s.kind = SYMBOL_LABEL;
+    s.value = program.size();
+    s.section = sections.size() - 1;
+    s.line = t.line;
+    s.file = file;
+}
+
+uint8_t Assembler::read_register() {
+    Token t = tokens->next();
+    int reg = register_number(t);
+    if(reg >= 0) return reg;
+    error((String("expected register, not ") + t.toString()).c_str());
+    return 0;
+}
+
+/**
+ * a register, or an expression of at most one label plus or minus
+ * constants. With offset, an address may end in +register. Returns true
+ * for a register.
+ */
+bool Assembler::read_operand(Expr *e, uint8_t *reg, uint8_t *offset) {
+    int r = register_number(tokens->peek());
+    if(r >= 0) {
+        tokens->next();
+        *reg = r;
+        return true;
+    }
+
+    *e = Expr();
+    if(offset) *offset = REG_ZE;
+    for(;;) {
+        Token t = tokens->next();
+        bool minus = false;
+        if(t.is('-')) {
+            minus = true;
+            t = tokens->next();
+        }
+
+        if(t.type == TOKEN_NUMBER) {
+            e->addend += minus ? -t.value : t.value;
+        } else if((r = register_number(t)) >= 0) {
+            if(!offset || minus || *offset != REG_ZE) error("register in expression");
+            *offset = r;
+        } else if(t.type == TOKEN_IDENTIFIER) {
+            if(minus || e->symbol >= 0) error("expression too complex");
+            e->symbol = symbol(t);
+        } else {
+            error((String("expected value, not ") + t.toString()).c_str());
+        }
+
+        const Token &n = tokens->peek();
+        if(!n.is('+') && !n.is('-')) break;
+        if(n.is('+')) tokens->next();
+    }
+    return false;
+}
+
+Expr Assembler::read_expr() {
+    Expr e;
+    uint8_t reg;
+    if(read_operand(&e, &reg)) error("expected value, not register");
+    return e;
+}
+
+void Assembler::expect_end() {
+    Token t = tokens->next();
+    if(t.type != TOKEN_NEWLINE && t.type != TOKEN_EOF) {
+        error((String("unexpected ") + t.toString()).c_str());
+    }
+}
+
+void Assembler::add(Instruction &ins) {
+    ins.line = line;
+    ins.file = file;
+    ins.section = sections.size() - 1;
+    ins.addr = 0;
+    ins.size = instruction_size(ins);
+    program.push_back(ins);
+}
+
+void Assembler::parse_special() {
+    Token id = tokens->next();
+    Instruction ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.value = Expr();
+
+    if(id.equals("ORG")) {
+        ins.format = FORMAT_ORG;
+        ins.value = read_expr();
+        if(ins.value.symbol >= 0) error(".ORG expects a constant");
+        Section s = { true, ins.value.addend, (int) program.size(), 0, 1 };
+        sections.push_back(s);
+        add(ins);
+    } else if(id.equals("DB") || id.equals("DW") || id.equals("DL") || id.equals("DF")) {
+        ins.format = FORMAT_DATA;
+        ins.type = id.text[1] == 'B' ? TYPE_BYTE : id.text[1] == 'W' ? TYPE_WORD :
+            id.text[1] == 'L' ? TYPE_LONG : TYPE_FLOAT;
+        parse_data(ins);
+    } else if(id.equals("ALIGN")) {
+        ins.format = FORMAT_ALIGN;
+        ins.value = read_expr();
+        uint32_t align = ins.value.addend;
+        if(ins.value.symbol >= 0 || !align || align > 0x10000 || (align & (align - 1))) {
+            error(".ALIGN expects a power of two, up to $10000");
+        }
+        if(align > sections.back().align) sections.back().align = align;
+        add(ins);
+    } else if(id.equals("RES")) {
+        ins.format = FORMAT_RES;
+        ins.value = read_expr();
+        if(ins.value.symbol >= 0) error(".RES expects a constant");
+        add(ins);
+    } else {
+        error((String("unknown directive .") + id.toString()).c_str());
+    }
+}
+
+// decimal, with an optional fraction
+float Assembler::read_float() {
+    Token t = tokens->next();
+    bool minus = t.is('-');
+    if(minus) t = tokens->next();
+    if(t.type != TOKEN_NUMBER) error((String("expected number, not ") + t.toString()).c_str());
+
+    double v = t.value;
+    if(tokens->peek().is('.')) {
+        tokens->next();
+        Token f = tokens->next();
+        if(f.type != TOKEN_NUMBER || f.text[0] < '0' || f.text[0] > '9') error("invalid fraction");
+        v += f.value / pow(10, f.len);
+    }
+    return minus ? -v : v;
+}
+
+/**
+ * a list of values, optionally separated by commas, each its own
+ * instruction. Strings give one value per character.
+ */
+void Assembler::parse_data(Instruction &ins) {
+    for(;;) {
+        const Token &n = tokens->peek();
+        if(n.type == TOKEN_STRING && ins.type != TYPE_FLOAT) {
+            Token str = tokens->next();
+            for(int i = 0; i < str.len; i++) {
+                ins.value = Expr();
+                ins.value.addend = (uint8_t) str.text[i];
+                add(ins);
+            }
+        } else if(ins.type == TYPE_FLOAT) {
+            float f = read_float();
+            ins.value = Expr();
+            memcpy(&ins.value.addend, &f, 4);
+            add(ins);
+        } else {
+            ins.value = read_expr();
+            add(ins);
+        }
+
+        if(tokens->peek().is(',')) tokens->next();
+        const Token &e = tokens->peek();
+        if(e.type == TOKEN_NEWLINE || e.type == TOKEN_EOF) break;
+    }
+}
+
+void Assembler::parse_op() {
+    Token t = tokens->next();
+    if(tokens->peek().is(':')) {
+        tokens->next();
+        define(t);
+        const Token &n = tokens->peek();
+        if(n.type == TOKEN_NEWLINE || n.type == TOKEN_EOF) return;
+        if(n.type == TOKEN_DIRECTIVE) {
+            parse_special();
+            return;
+        }
+        t = tokens->next();
+        if(t.type != TOKEN_IDENTIFIER) error("expected mnemonic");
+    }
+
+    const Mnemonic *m = lookupMnemonic(t.text, t.len);
+    if(!m || m->kind == MNEMONIC_REGISTER) error((String("unknown mnemonic ") + t.toString()).c_str());
+
+    Instruction ins;
+    memset(&ins, 0, sizeof(ins));
+    ins.value = Expr();
+    ins.reg2 = REG_ZE;
+    ins.op = m->op;
+    ins.type = m->type;
+
+    uint8_t reg;
+    switch(m->kind) {
+        case MNEMONIC_NULARY:
+            ins.format = FORMAT_NONE;
+            break;
+        case MNEMONIC_CPU:
+            ins.format = FORMAT_R;
+            ins.reg1 = read_register();
+            break;
+        case MNEMONIC_STATUS:
+            if(read_operand(&ins.value, &ins.reg1)) {
+                ins.format = FORMAT_R;
+            } else {
+                ins.format = FORMAT_K8;
+                ins.op += ANSB_K - ANSB_R;
+            }
+            break;
+        case MNEMONIC_JUMP:
+            ins.format = FORMAT_JUMP;
+            ins.relax = true;
+            ins.value = read_expr();
+            break;
+        case MNEMONIC_JUMP_FIXED:
+            ins.format = FORMAT_JUMP;
+            ins.is_long = ins.op & 0x01;
+            ins.value = read_expr();
+            break;
+        case MNEMONIC_BRANCH:
+            ins.format = FORMAT_BRANCH;
+            ins.relax = true;
+            ins.value = read_expr();
+            break;
+        case MNEMONIC_LOAD:
+            ins.format = FORMAT_MEM;
+            ins.reg1 = read_register();
+            if(read_operand(&ins.value, &reg, &ins.reg2)) error("load address must be constant");
+            break;
+        case MNEMONIC_STORE:
+            ins.format = FORMAT_MEM;
+            if(read_operand(&ins.value, &reg, &ins.reg2)) error("store address must be constant");
+            ins.reg1 = read_register();
+            break;
+        case MNEMONIC_MOVE:
+        case MNEMONIC_BINARY:
+            // the constant forms follow the register ones
+            ins.reg1 = read_register();
+            if(read_operand(&ins.value, &ins.reg2)) {
+                ins.format = FORMAT_RR;
+            } else {
+                ins.format = FORMAT_RK;
+                ins.op += m->kind == MNEMONIC_MOVE ? MOVB_RK - MOVB_RR : ADDB_RK - ADDB_RR;
+            }
+            break;
+        case MNEMONIC_SWAP:
+            ins.format = FORMAT_RR;
+            ins.reg1 = read_register();
+            ins.reg2 = read_register();
+            break;
+        case MNEMONIC_PUSH:
+            if(read_operand(&ins.value, &ins.reg1)) {
+                ins.format = FORMAT_TR;
+            } else {
+                ins.format = FORMAT_TK;
+                ins.op = PSHX_K;
+            }
+            break;
+        case MNEMONIC_POP: {
+            ins.format = FORMAT_TR;
+            const Token &n = tokens->peek();
+            if(n.type == TOKEN_NEWLINE || n.type == TOKEN_EOF) {
+                ins.op = POPX_X; // discard
+            } else {
+                ins.reg1 = read_register();
+            }
+            break;
+        }
+        case MNEMONIC_UNARY:
+            ins.format = FORMAT_TR;
+            ins.reg1 = read_register();
+            break;
+    }
+
+    add(ins);
+}
+
+/**
+ * parses a source, and anything it includes, into the program. Later
+ * sources continue from where the previous one ended, and share its
+ * labels, but not its macros or constants. The includes are recorded
+ * even if it fails.
+ */
+void Assembler::assemble(SourceBuffer *source) {
+    if(finished) throw Exception("assembler already finished");
+
+    Preprocessor pp(source, files);
+    tokens = &pp;
+    try {
+        for(;;) {
+            const Token &t = tokens->peek();
+            line = t.line;
+            file = t.file;
+            if(t.type == TOKEN_EOF) break;
+
+            if(t.type == TOKEN_DIRECTIVE) {
+                parse_special();
+            } else if(t.type == TOKEN_IDENTIFIER) {
+                parse_op();
+            } else if(t.type != TOKEN_NEWLINE) {
+                error((String("unexpected ") + t.toString()).c_str());
+            }
+            expect_end();
+        }
+    } catch(...) {
+        // what was read so far is kept, so a watcher knows where the error may be fixed
+        tokens = NULL;
+        add_includes(pp);
+        throw;
+    }
+    tokens = NULL;
+    add_includes(pp);
+}
+
+void Assembler::add_includes(const Preprocessor &pp) {
+    const std::vector<String> &read = pp.getIncludes();
+    for(int i = 0; i < read.size(); i++) {
+        if(std::find(includes.begin(), includes.end(), read[i]) == includes.end()) {
+            includes.push_back(read[i]);
+            include_hashes.push_back(pp.getIncludeHashes()[i]);
+        }
+    }
+}
+
+uint32_t Assembler::base(int section) {
+    return sections[section].absolute ? sections[section].origin : 0;
+}
+
+/**
+ * address of the label; one at the end of a section is the end of that
+ * section, even if an .ORG follows
+ */
+uint32_t Assembler::address(const Symbol &s) {
+    if(s.value < program.size() && program[s.value].section == s.section) return program[s.value].addr;
+    return base(s.section) + sections[s.section].size;
+}
+
+// as far as it is known; section relative for labels in relocatable sections
+uint32_t Assembler::value(const Expr &e) {
+    if(e.symbol < 0) return e.addend;
+    return address(symbols[e.symbol]) + e.addend;
+}
+
+bool Assembler::absolute_known(const Expr &e) {
+    if(e.symbol < 0) return true;
+    const Symbol &s = symbols[e.symbol];
+    return s.kind == SYMBOL_LABEL && sections[s.section].absolute;
+}
+
+// true if the distance from the instruction to the address is fixed
+bool Assembler::distance_known(const Instruction &ins, const Expr &e) {
+    if(e.symbol < 0) return sections[ins.section].absolute;
+    const Symbol &s = symbols[e.symbol];
+    if(s.kind != SYMBOL_LABEL) return false;
+    return s.section == ins.section || (sections[s.section].absolute && sections[ins.section].absolute);
+}
+
+// a move or a swap between registers
+static bool is_transfer(const Instruction &ins) {
+    uint8_t unit = opcode_table.op[ins.op].unit;
+    return ins.format == FORMAT_RR && (unit == UNIT_MOVE || unit == UNIT_SWAP);
+}
+
+// holds all the bits of the type; the high registers have no long or float
+static bool whole_register(uint8_t reg, uint8_t type) {
+    return reg < (type == TYPE_BYTE || type == TYPE_WORD ? 8 : 4);
+}
+
+// moves or swaps a register with itself
+static bool no_effect(const Instruction &ins) {
+    return is_transfer(ins) && ins.reg1 == ins.reg2 && ins.reg1 < 8;
+}
+
+// b swaps back what a swapped
+static bool undoes(const Instruction &a, const Instruction &b) {
+    if(!is_transfer(a) || a.op != b.op || opcode_table.op[a.op].unit != UNIT_SWAP) return false;
+    bool same = (a.reg1 == b.reg1 && a.reg2 == b.reg2) || (a.reg1 == b.reg2 && a.reg2 == b.reg1);
+    return same && whole_register(a.reg1, a.type) && whole_register(a.reg2, a.type);
+}
+
+// b moves nothing new after a
+static bool repeats(const Instruction &a, const Instruction &b) {
+    if(!is_transfer(a) || a.op != b.op || opcode_table.op[a.op].unit != UNIT_MOVE) return false;
+    if(a.reg1 >= 8 || a.reg2 >= 8) return false; // pc, sp and the status change by themselves
+    if(a.reg1 == b.reg1 && a.reg2 == b.reg2) return true;
+    return a.reg1 == b.reg2 && a.reg2 == b.reg1 && whole_register(a.reg1, a.type) && whole_register(a.reg2, a.type);
+}
+
+/**
+ * one sweep of the peephole rules over the program, which is then
+ * compacted, moving labels on to the instruction after any removed.
+ * Nothing is merged into an instruction a label or section starts at.
+ * Returns true if anything changed.
+ */
+bool Assembler::peephole() {
+    std::vector<bool> target(program.size() + 1, false);
+    for(int i = 0; i < symbols.size(); i++) {
+        if(symbols[i].kind == SYMBOL_LABEL) target[symbols[i].value] = true;
+    }
+    for(int k = 0; k < sections.size(); k++) target[sections[k].first] = true;
+
+    // a jump or branch to the instruction at index, which it can reach in the short form
+    struct {
+        std::vector<Symbol> &symbols;
+        bool operator()(const Instruction &ins, int index) {
+            if(ins.format != FORMAT_BRANCH && (ins.format != FORMAT_JUMP || (ins.op & 0x02))) return false;
+            if(ins.value.symbol < 0 || ins.value.addend) return false;
+            const Symbol &s = symbols[ins.value.symbol];
+            return s.kind == SYMBOL_LABEL && s.section == ins.section && s.value == index;
+        }
+    } jumps_to = { symbols };
+
+    std::vector<bool> keep(program.size(), true);
+    bool changed = false;
+    for(int i = 0; i < program.size(); i++) {
+        Instruction &ins = program[i];
+        Instruction *next = i + 1 < program.size() && !target[i + 1] ? &program[i + 1] : NULL;
+
+        // zero from the ZE register, not a constant; floats are left, as ADDF_RK and the like are not done yet
+        if((ins.format == FORMAT_RK || ins.format == FORMAT_TK) && ins.value.symbol < 0 && !ins.value.addend &&
+                ins.type != TYPE_FLOAT) {
+            if(ins.format == FORMAT_RK) {
+                ins.format = FORMAT_RR;
+                ins.op -= MOVB_RK - MOVB_RR;
+            } else {
+                ins.format = FORMAT_TR;
+                ins.op = PSHX_R;
+                ins.reg1 = REG_ZE;
+            }
+            ins.reg2 = REG_ZE;
+            ins.size = instruction_size(ins);
+            changed = true;
+        }
+
+        // long jumps as written become relaxed relative ones, which are never longer
+        if(ins.format == FORMAT_JUMP && !ins.relax && ins.is_long) {
+            ins.op = ins.op & 0x02 ? RJSR : RJMP;
+            ins.relax = true;
+            ins.is_long = false;
+            ins.size = instruction_size(ins);
+            changed = true;
+        }
+
+        if(no_effect(ins) || jumps_to(ins, i + 1)) {
+            keep[i] = false;
+            changed = true;
+        } else if(next && undoes(ins, *next)) {
+            keep[i] = keep[i + 1] = false;
+            changed = true;
+            i++;
+        } else if(next && repeats(ins, *next)) {
+            keep[i + 1] = false;
+            changed = true;
+            i++;
+        } else if(next && ins.format == FORMAT_BRANCH && jumps_to(ins, i + 2) && next->format == FORMAT_JUMP &&
+                !(next->op & 0x02)) {
+            ins.op ^= 0x08; // branches the other way, straight to where the jump went
+            ins.value = next->value;
+            keep[i + 1] = false;
+            changed = true;
+            i++;
+        }
+    }
+    if(!changed) return false;
+
+    std::vector<int> remap(program.size() + 1);
+    int n = 0;
+    for(int i = 0; i < program.size(); i++) {
+        remap[i] = n;
+        if(keep[i]) program[n++] = program[i];
+    }
+    remap[program.size()] = n;
+    program.resize(n);
+
+    for(int i = 0; i < symbols.size(); i++) {
+        if(symbols[i].kind == SYMBOL_LABEL) symbols[i].value = remap[symbols[i].value];
+    }
+    for(int k = 0; k < sections.size(); k++) {
+        sections[k].first = remap[sections[k].first];
+    }
+    return true;
+}
+
+void Assembler::layout() {
+    for(int k = 0; k < sections.size(); k++) {
+        int last = k + 1 < sections.size() ? sections[k + 1].first : program.size();
+        uint64_t pc = base(k);
+        for(int i = sections[k].first; i < last; i++) {
+            Instruction &ins = program[i];
+            ins.addr = pc;
+            if(ins.format == FORMAT_ALIGN) ins.size = (uint32_t) -pc & (ins.value.addend - 1);
+            pc += ins.size;
+            if(pc > 0x100000000ULL) error(ins, "past the end of the address space");
+        }
+        sections[k].size = pc - base(k);
+    }
+    end_addr = base(sections.size() - 1) + sections.back().size;
+}
+
+/**
+ * switches jumps whose target is out of reach of the short form to the
+ * long one. Returns true if anything grew.
+ */
+bool Assembler::relax() {
+    bool grew = false;
+    for(int i = 0; i < program.size(); i++) {
+        Instruction &ins = program[i];
+        if(!ins.relax || ins.is_long) continue;
+
+        uint32_t rel = value(ins.value) - (ins.addr + 3);
+        if(!distance_known(ins, ins.value) || !fits_rel16(rel)) {
+            ins.is_long = true;
+            ins.size = instruction_size(ins);
+            grew = true;
+        }
+    }
+    return grew;
+}
+
+/**
+ * makes short absolute jumps relative where the target is in reach. The
+ * size is the same, so nothing moves.
+ */
+void Assembler::prefer_relative() {
+    for(int i = 0; i < program.size(); i++) {
+        Instruction &ins = program[i];
+        if(ins.format != FORMAT_JUMP || ins.relax || ins.is_long || (ins.op & 0x04)) continue;
+        if(distance_known(ins, ins.value) && fits_rel16(value(ins.value) - (ins.addr + 3))) ins.op |= 0x04;
+    }
+}
+
+/**
+ * resolves labels and picks the jump forms, after the peephole pass if
+ * there is one
+ */
+void Assembler::finish() {
+    if(finished) return;
+
+    for(int i = 0; i < symbols.size() && !relocatable; i++) {
+        if(symbols[i].kind == SYMBOL_UNDEFINED) {
+            throw Exception(String(files[symbols[i].file]) + ":" + String::fromInt(symbols[i].line) +
+                    ": unknown symbol " + String(names.name(i)));
+        }
+    }
+
+    if(optimize) while(peephole());
+    layout();
+    while(relax()) layout();
+    if(optimize) prefer_relative();
+    finished = true;
+}
+
+static void write_constant(uint8_t *out, int size, uint32_t v) {
+    for(int i = 0; i < size; i++) {
+        out[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+// leaves the field for the linker
+void Assembler::relocate(const Instruction &ins, int field, RelocationKind kind) {
+    Relocation r;
+    r.section = ins.section;
+    r.offset = ins.addr - base(ins.section) + field;
+    r.kind = kind;
+    r.symbol = ins.value.symbol;
+    r.addend = ins.value.addend;
+    r.file = ins.file;
+    r.line = ins.line;
+    object->relocations.push_back(r);
+}
+
+void Assembler::encode(const Instruction &ins, uint8_t *out) {
+    static const RelocationKind absolute[] = { RELOC_ABS8, RELOC_ABS8, RELOC_ABS16, RELOC_ABS32, RELOC_ABS32 };
+    uint32_t v = value(ins.value);
+    bool known = absolute_known(ins.value);
+    uint32_t rel;
+
+    // no opcode; the space is already zero
+    if(ins.format == FORMAT_DATA) {
+        if(!known) relocate(ins, 0, absolute[ins.size]);
+        else if(!fits(ins.type, v)) error(ins, "constant too large");
+        else write_constant(out, ins.size, v);
+        return;
+    }
+    if(ins.format == FORMAT_ALIGN || ins.format == FORMAT_RES) return;
+
+    out[0] = ins.op;
+    switch(ins.format) {
+        default:
+            break;
+        case FORMAT_R:
+            out[1] = ins.reg1;
+            break;
+        case FORMAT_K8:
+            if(!known) relocate(ins, 1, RELOC_ABS8);
+            else if(!fits(TYPE_BYTE, v)) error(ins, "constant too large");
+            else out[1] = v;
+            break;
+        case FORMAT_RR:
+            out[1] = (ins.reg2 << 4) | ins.reg1;
+            break;
+        case FORMAT_RK:
+            out[1] = ins.reg1;
+            if(!known) relocate(ins, 2, absolute[type_size(ins.type)]);
+            else if(!fits(ins.type, v)) error(ins, "constant too large");
+            else write_constant(out + 2, type_size(ins.type), v);
+            break;
+        case FORMAT_TR:
+            out[1] = (ins.type << 4) | ins.reg1;
+            break;
+        case FORMAT_TK:
+            out[1] = ins.type << 4;
+            if(!known) relocate(ins, 2, absolute[type_size(ins.type)]);
+            else if(!fits(ins.type, v)) error(ins, "constant too large");
+            else write_constant(out + 2, type_size(ins.type), v);
+            break;
+        case FORMAT_MEM:
+            // absolute if the address fits, else relative to the next instruction
+            out[1] = (ins.reg2 << 4) | ins.reg1;
+            rel = v - (ins.addr + 4);
+            if(!known) {
+                relocate(ins, 2, RELOC_MEM);
+            } else if(v <= 0xFFFF) {
+                out[0] = ins.op + (ALODB_RRK - LODB_RRK);
+                write_constant(out + 2, 2, v);
+            } else if(rel <= 0xFFFF && distance_known(ins, ins.value)) {
+                write_constant(out + 2, 2, rel);
+            } else if(relocatable) {
+                relocate(ins, 2, RELOC_MEM);
+            } else {
+                error(ins, "address out of range");
+            }
+            break;
+        case FORMAT_JUMP: {
+            bool relative = ins.op & 0x04;
+            if(relative) known = distance_known(ins, ins.value);
+            if(ins.is_long) {
+                out[0] = ins.op | 0x01;
+                if(!known) relocate(ins, 1, relative ? RELOC_REL32 : RELOC_ABS32);
+                else write_constant(out + 1, 4, relative ? v - (ins.addr + 5) : v);
+            } else if(!known) {
+                relocate(ins, 1, relative ? RELOC_REL16 : RELOC_ABS16);
+            } else {
+                rel = v - (ins.addr + 3);
+                if(relative ? !fits_rel16(rel) : v > 0xFFFF) error(ins, "jump out of range");
+                write_constant(out + 1, 2, relative ? rel : v);
+            }
+            break;
+        }
+        case FORMAT_BRANCH:
+            if(ins.is_long) {
+                out[0] = ins.op ^ 0x08; // skip the long jump unless the condition holds
+                write_constant(out + 1, 2, 5);
+                out[3] = LRJMP;
+                if(!distance_known(ins, ins.value)) relocate(ins, 4, RELOC_REL32);
+                else write_constant(out + 4, 4, v - (ins.addr + 8));
+            } else {
+                write_constant(out + 1, 2, v - (ins.addr + 3));
+            }
+            break;
+    }
+}
+
+/**
+ * the assembled sections, labels and relocations. The object belongs to
+ * the assembler; retain it to keep it longer.
+ */
+ObjectFile *Assembler::getObject() {
+    if(object) return object.get();
+    finish();
+
+    object.reset(new ObjectFile(files.empty() ? "" : files[0].c_str()));
+    object->files = files;
+    for(int k = 0; k < sections.size(); k++) {
+        ObjectSection s;
+        s.absolute = sections[k].absolute;
+        s.origin = sections[k].origin;
+        s.align = sections[k].align;
+        s.data.assign(sections[k].size, 0);
+        object->sections.push_back(s);
+    }
+
+    for(int i = 0; i < program.size(); i++) {
+        Instruction &ins = program[i];
+        if(!ins.size) continue;
+        encode(ins, &object->sections[ins.section].data[ins.addr - base(ins.section)]);
+    }
+
+    for(int i = 0; i < symbols.size(); i++) {
+        ObjectSymbol s;
+        s.name = names.name(i);
+        s.section = symbols[i].kind == SYMBOL_LABEL ? symbols[i].section : -1;
+        s.value = s.section < 0 ? 0 : address(symbols[i]) - base(s.section);
+        object->symbols.push_back(s);
+    }
+    return object.get();
+}
+
+/**
+ * encodes the program into the image, which only gets the sections.
+ * Relocatable code has to go through a Linker instead.
+ */
+void Assembler::write(SparseImage *image) {
+    if(relocatable) throw Exception("relocatable code must be linked");
+    getObject();
+    for(int i = 0; i < program.size(); i++) {
+        Instruction &ins = program[i];
+        if(ins.size && ins.addr + (uint64_t) ins.size > 0x100000000ULL) {
+            error(ins, "address past the end of the address space");
+        }
+    }
+    for(int k = 0; k < sections.size(); k++) {
+        const std::vector<uint8_t> &data = object->sections[k].data;
+        if(!data.empty()) image->write(sections[k].origin, &data[0], data.size());
+    }
+}
+
+/**
+ * the same, into a flat image of the address space from 0
+ */
+void Assembler::write(uint8_t *image, uint32_t size) {
+    if(relocatable) throw Exception("relocatable code must be linked");
+    getObject();
+    for(int i = 0; i < program.size(); i++) {
+        Instruction &ins = program[i];
+        if(ins.size && ins.addr + (uint64_t) ins.size > size) error(ins, "address out of range of the image");
+    }
+
+    SparseImage sparse;
+    write(&sparse);
+    sparse.flatten(image, size);
+}
+
+// address of the label; the offset in its section if that is relocatable
+bool Assembler::lookup(const char *name, uint32_t *addr) {
+    int i = names.find(name, strlen(name));
+    if(i < 0 || symbols[i].kind != SYMBOL_LABEL) return false;
+    *addr = address(symbols[i]);
+    return true;
+}
+
+uint32_t Assembler::getEnd() {
+    return end_addr;
+}
+
+// every file the sources included, in the order they were first read
+const std::vector<String> &Assembler::getIncludes() {
+    return includes;
+}
+
+// hashes of the includes, as they were when read
+const std::vector<uint64_t> &Assembler::getIncludeHashes() {
+    return include_hashes;
+}
+
+int Assembler::getInstructionCount() {
+    return program.size();
+}
+
+const Instruction &Assembler::getInstruction(int i) {
+    return program[i];
+}
+
+/**
+ * writes "address name" for every label, in address order. bostek-run
+ * reads these to label coverage reports.
+ */
+void Assembler::writeMap(FILE *f) {
+    finish();
+    std::vector<std::pair<uint32_t, int> > labels;
+    for(int i = 0; i < symbols.size(); i++) {
+        if(symbols[i].kind == SYMBOL_LABEL) {
+            labels.push_back(std::make_pair(address(symbols[i]), i));
+        }
+    }
+    std::stable_sort(labels.begin(), labels.end());
+    for(int i = 0; i < labels.size(); i++) {
+        fprintf(f, "%08x %s\n", labels[i].first, names.name(labels[i].second));
+    }
+}
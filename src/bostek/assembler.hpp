@@ -0,0 +1,174 @@
+#ifndef _BOSTEK_ASSEMBLER_HPP
+#define _BOSTEK_ASSEMBLER_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "lexer.hpp"
+#include "objectFile.hpp"
+#include "sparseImage.hpp"
+#include "symbolTable.hpp"
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/ref.hpp"
+#include "cpplib/common/string.hpp"
+
+class Preprocessor;
+
+#define ASM_ORIGIN 0x1000 // address assembly starts at without a .ORG
+
+// how an instruction's operands are laid out after the opcode
+enum Format {
+    FORMAT_NONE, // op
+    FORMAT_R, // op reg
+    FORMAT_K8, // op imm8
+    FORMAT_RR, // op src<<4|dst
+    FORMAT_RK, // op dst imm
+    FORMAT_TR, // op type<<4|reg
+    FORMAT_TK, // op type<<4 imm
+    FORMAT_MEM, // op offset<<4|reg addr16; absolute or pc relative
+    FORMAT_JUMP, // JMP/JSR; relaxed to the short or long form
+    FORMAT_BRANCH, // conditional; relaxed to a skip over a long jump
+    FORMAT_ORG, // sets the address of what follows
+    FORMAT_DATA, // a type sized value; no opcode
+    FORMAT_ALIGN, // zeros up to a multiple of value
+    FORMAT_RES, // value zeros
+};
+
+enum SymbolKind {
+    SYMBOL_UNDEFINED,
+    SYMBOL_LABEL,
+};
+
+// numbered as in the symbol table
+struct Symbol {
+    SymbolKind kind;
+    uint32_t value; // index of the labelled instruction
+    int section; // the label was defined in
+    int line; // of the definition, or first use while undefined
+    int file;
+};
+
+// symbol + addend; symbol is -1 for a plain constant
+struct Expr {
+    int symbol;
+    uint32_t addend;
+
+    Expr() : symbol(-1), addend(0) {}
+};
+
+struct Instruction {
+    Format format;
+    uint8_t op; // short form for FORMAT_JUMP and FORMAT_BRANCH
+    uint8_t type;
+    uint8_t reg1; // destination, or the register stored
+    uint8_t reg2; // source, or address offset
+    bool relax; // may be switched to a long form
+    bool is_long;
+    Expr value; // immediate or address
+    uint32_t addr; // offset into the section when it is relocatable
+    uint32_t size;
+    int section;
+    int line;
+    int file;
+};
+
+// instructions from first up to the next section's first
+struct Section {
+    bool absolute;
+    uint32_t origin;
+    int first;
+    uint32_t size;
+    uint32_t align; // of the start, when relocatable
+};
+
+/**
+ * Two pass assembler.
+ *
+ * Sources are parsed into a list of instructions with unresolved
+ * operands; labels may be used before they are defined. finish() then
+ * lays the instructions out, starting every jump in its short form and
+ * growing those whose target is out of reach until nothing changes.
+ * Since forms only ever grow, that always terminates.
+ *
+ * Code before the first .ORG starts at ASM_ORIGIN, unless the assembler
+ * is relocatable; then it may go anywhere, and getObject() describes
+ * what the linker has to fill in. Jumps whose distance is not known
+ * until then, including to labels in other objects, use the long form.
+ *
+ * With setOptimize(), a peephole pass rewrites the program before it is
+ * laid out, into instructions that do the same in fewer bytes or clks:
+ * constants of zero come from the ZE register, moves and swaps that
+ * change nothing go, as do jumps to the next instruction, a branch over
+ * a jump becomes the opposite branch, and jumps are made relative and
+ * relaxed wherever that is no longer.
+ *
+ * Errors throw an Exception naming the file and line.
+ */
+class Assembler : public Object {
+    std::vector<Instruction> program;
+    std::vector<Section> sections;
+    std::vector<Symbol> symbols;
+    SymbolTable names;
+    std::vector<String> files;
+    std::vector<String> includes;
+    std::vector<uint64_t> include_hashes;
+    Preprocessor *tokens;
+    int line; // of the statement being parsed
+    int file;
+    bool finished;
+    uint32_t end_addr;
+    bool relocatable;
+    bool optimize;
+    Ref<ObjectFile> object;
+
+    int symbol(const Token &t);
+    void define(const Token &t);
+    uint8_t read_register();
+    bool read_operand(Expr *e, uint8_t *reg, uint8_t *offset=NULL);
+    Expr read_expr();
+    void expect_end();
+    float read_float();
+    void parse_data(Instruction &ins);
+    void parse_special();
+    void add_includes(const Preprocessor &pp);
+    void parse_op();
+    void add(Instruction &ins);
+
+    uint32_t base(int section);
+    uint32_t address(const Symbol &s);
+    uint32_t value(const Expr &e);
+    bool absolute_known(const Expr &e);
+    bool distance_known(const Instruction &ins, const Expr &e);
+    bool peephole();
+    void layout();
+    bool relax();
+    void prefer_relative();
+    void relocate(const Instruction &ins, int field, RelocationKind kind);
+    void encode(const Instruction &ins, uint8_t *out);
+    void error(const char *msg);
+    void error(const Instruction &ins, const char *msg);
+
+    public:
+    Assembler(bool relocatable = false);
+    virtual ~Assembler();
+
+    void setOptimize(bool on);
+
+    void assemble(SourceBuffer *source);
+    void finish();
+
+    bool lookup(const char *name, uint32_t *addr);
+    uint32_t getEnd();
+    const std::vector<String> &getIncludes();
+    const std::vector<uint64_t> &getIncludeHashes();
+    int getInstructionCount();
+    const Instruction &getInstruction(int i);
+
+    ObjectFile *getObject();
+    void write(SparseImage *image);
+    void write(uint8_t *image, uint32_t size);
+    void writeMap(FILE *f);
+};
+
+#endif
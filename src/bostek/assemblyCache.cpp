@@ -0,0 +1,80 @@
+#include "assemblyCache.hpp"
+
+#include "cpplib/common/exception.hpp"
+
+AssemblyCache::AssemblyCache() : hits(0), misses(0) {
+}
+
+AssemblyCache::~AssemblyCache() {
+}
+
+// 64 bit FNV-1a; chain calls by passing the last result as h
+uint64_t AssemblyCache::hash(const char *data, size_t len, uint64_t h) {
+    for(size_t i = 0; i < len; i++) {
+        h ^= (uint8_t) data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// adds the hash of an include to the key
+static uint64_t chain(uint64_t h, uint64_t include_hash) {
+    return AssemblyCache::hash((const char*) &include_hash, sizeof(include_hash), h);
+}
+
+// false if an include can no longer be read
+bool AssemblyCache::hash_includes(const std::vector<String> &includes, uint64_t *h) {
+    for(int i = 0; i < includes.size(); i++) {
+        try {
+            String name = includes[i];
+            SourceBuffer *src = new SourceBuffer(name.c_str());
+            *h = chain(*h, hash(src->begin(), src->getSize()));
+            src->release();
+        } catch(Exception &e) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * the object last stored for the source, if neither it nor anything it
+ * included has changed since; NULL otherwise
+ */
+ObjectFile *AssemblyCache::find(SourceBuffer *source) {
+    std::map<String, Entry>::iterator it = entries.find(source->getName());
+    if(it != entries.end()) {
+        uint64_t h = hash(source->begin(), source->getSize());
+        if(hash_includes(it->second.includes, &h) && h == it->second.hash) {
+            hits++;
+            return it->second.object.get();
+        }
+    }
+    misses++;
+    return NULL;
+}
+
+/**
+ * remembers the object assembled from the source, replacing any older
+ * one; includes are the files it read, in the order it read them, with
+ * the hashes of what was read
+ */
+void AssemblyCache::store(SourceBuffer *source, ObjectFile *obj, const std::vector<String> &includes,
+        const std::vector<uint64_t> &include_hashes) {
+    uint64_t h = hash(source->begin(), source->getSize());
+    for(int i = 0; i < include_hashes.size(); i++) {
+        h = chain(h, include_hashes[i]);
+    }
+
+    Entry &e = entries[source->getName()];
+    e.hash = h;
+    e.includes = includes;
+    e.object = Ref<ObjectFile>::share(obj);
+}
+
+// files the source included when it was last stored
+const std::vector<String> &AssemblyCache::getIncludes(const String &name) {
+    static const std::vector<String> none;
+    std::map<String, Entry>::iterator it = entries.find(name);
+    return it == entries.end() ? none : it->second.includes;
+}
@@ -0,0 +1,54 @@
+#ifndef _BOSTEK_ASSEMBLYCACHE_HPP
+#define _BOSTEK_ASSEMBLYCACHE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <vector>
+
+#include "lexer.hpp"
+#include "objectFile.hpp"
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/ref.hpp"
+#include "cpplib/common/string.hpp"
+
+/**
+ * Objects assembled earlier, so a long running basm only reassembles
+ * the sources that changed.
+ *
+ * Entries are found by source name and are only used if a hash of the
+ * source's contents, and of every file it included, is unchanged; the
+ * modification time is never trusted. The includes are keyed on the
+ * hashes the preprocessor took of the bytes it read, so a file saved
+ * during a build never pairs its new contents with the old object. Each
+ * source keeps only its latest entry.
+ */
+class AssemblyCache : public Object {
+    struct Entry {
+        uint64_t hash; // of the source, then of each include's hash in order
+        std::vector<String> includes;
+        Ref<ObjectFile> object;
+    };
+
+    std::map<String, Entry> entries;
+    int hits;
+    int misses;
+
+    bool hash_includes(const std::vector<String> &includes, uint64_t *h);
+
+    public:
+    AssemblyCache();
+    virtual ~AssemblyCache();
+
+    static uint64_t hash(const char *data, size_t len, uint64_t h = 14695981039346656037ULL);
+
+    ObjectFile *find(SourceBuffer *source);
+    void store(SourceBuffer *source, ObjectFile *obj, const std::vector<String> &includes,
+            const std::vector<uint64_t> &include_hashes);
+    const std::vector<String> &getIncludes(const String &name);
+
+    int getHits() const { return hits; }
+    int getMisses() const { return misses; }
+};
+
+#endif
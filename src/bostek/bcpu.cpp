@@ -1,6 +1,8 @@
 #include "bcpu.hpp"
+#include "opcodes.hpp"
 
 #include <string.h>
+#include <limits.h>
 
 #include <stdio.h>
 
@@ -73,10 +75,12 @@ Delta::Delta(State s) : next(s), wb_type(TYPE_NONE) {
 Delta::Delta(State s, Type ty, uint32_t addr, uint32_t v) : next(s), wb_type(ty), wb_addr(addr), wb_value(v) {
 }
 
-BCpu::BCpu() {
+BCpu::BCpu() : irq_pending(0), waiting(false), halted(false), cond_taken(0), interrupts(0), coverage(NULL), block_start(0), op_wait(0) {
+    memset(opcounts, 0, sizeof(opcounts));
 }
 
-BCpu::BCpu(uint32_t pc, uint32_t sp) {
+BCpu::BCpu(uint32_t pc, uint32_t sp) : irq_pending(0), waiting(false), halted(false), cond_taken(0), interrupts(0), coverage(NULL), block_start(0), op_wait(0) {
+    memset(opcounts, 0, sizeof(opcounts));
     state.pc = pc;
     state.sp = sp;
 }
@@ -237,15 +241,21 @@ Delta BCpu::decode_control(uint8_t op1) {
                 next.pc++;
                 break;
             case HLT:
+                halt(); // pc stays on the HLT
                 break;
             case WFI:
-                //TODO: WFI stuff
-            case RFI:
-                //TODO: RFI stuff
+                next.pc++;
+                if(!irq_pending) wait();
+                break;
             case RET:
                 next.pc = nbr->readl(state.sp);
                 next.sp += 4;
                 break;
+            case RFI:
+                next.pc = nbr->readl(state.sp);
+                next.sp += 4;
+                next.write_flag(FLAG_I, true);
+                break;
             case IRQ:
                 //TODO: IRQ stuff
             case NMI:
@@ -489,20 +499,6 @@ Delta BCpu::decode_push_pop(uint8_t op1) {
     return Delta(next, wb_type, wb_addr, wb_value);
 }
 
-Delta BCpu::decode_transfer(uint8_t op1) {
-    if(op1 <= ALSTOF_RRK) {
-        return decode_load_store(op1);
-    } else if(op1 <= MOVF_RK) {
-        return decode_move(op1);
-    } else if(op1 <= SWPF) {
-        return decode_swap(op1);
-    } else if(op1 <= PSHX_K) {
-        return decode_push_pop(op1);
-    }
-
-    return state; // XXX ERROR
-}
-
 Delta BCpu::decode_jump(uint8_t op1) {
     State next(state);
     Type wb_type = TYPE_NONE; // used for JSR
@@ -541,6 +537,7 @@ Delta BCpu::decode_jump(uint8_t op1) {
         offset = sxt_value(TYPE_WORD, offset);
         if(state.read_flag((Flag) (op1 & 0x07)) == (bool)(op1 & 0x08)){
             next.pc += offset;
+            cond_taken++;
         }
     }
     return Delta(next, wb_type, wb_addr, wb_value);
@@ -772,16 +769,26 @@ Delta BCpu::decode_arithmetic(uint8_t op1) {
 }
 
 Delta BCpu::decode() {
-    uint8_t  op1 = nbr->readb(state.pc);
-
-    if(op1 <= 0x0F) return decode_control(op1);
-    else if(op1 <= 0x5F) return decode_transfer(op1);
-    else if(op1 <= 0x7F) return decode_jump(op1);
-    else return decode_arithmetic(op1);
+    uint8_t  op1 = nbr->fetchb(state.pc);
+    op = op1;
+
+    switch(opcode_table.op[op1].unit) {
+        case UNIT_CONTROL: return decode_control(op1);
+        case UNIT_LOAD:
+        case UNIT_STORE: return decode_load_store(op1);
+        case UNIT_MOVE: return decode_move(op1);
+        case UNIT_SWAP: return decode_swap(op1);
+        case UNIT_PUSH:
+        case UNIT_POP: return decode_push_pop(op1);
+        case UNIT_JUMP:
+        case UNIT_BRANCH: return decode_jump(op1);
+        case UNIT_ARITHMETIC: return decode_arithmetic(op1);
+        default: return state; // XXX ERROR
+    }
 }
 
+// the writeback goes first, so a write fault leaves state at the instruction
 void BCpu::apply(Delta e) {
-    state = e.next;
     switch(e.wb_type) {
         case TYPE_NONE: break;
         case TYPE_BYTE:
@@ -796,13 +803,175 @@ void BCpu::apply(Delta e) {
             break;
 
     }
-    //TODO: memory writeback
+    state = e.next;
 }
 
+/**
+ * decodes and commits the instruction at pc. State is at an instruction
+ * boundary between clks, so it can be inspected or changed from outside.
+ */
 void BCpu::clk() {
     op_wait--;
     if(op_wait <= 0) {
-        apply(next);
+        op_wait = 0; // or it counts down for the whole run, and wraps after 2^31 instructions
+        uint32_t pc = state.pc;
         next = decode();
+        apply(next);
+        opcounts[op]++;
+        if(coverage) cover(pc);
+        if(irq_pending && state.read_flag(FLAG_I)) service_irq();
+    }
+}
+
+uint32_t BCpu::getPc() {
+    return state.pc;
+}
+
+bool BCpu::isWaiting() {
+    return waiting;
+}
+
+/**
+ * sleeps until the next irq. op_wait holds off the following clks, so
+ * clk() needs no extra check; the NorthBridge skips the idle time.
+ */
+void BCpu::wait() {
+    waiting = true;
+    op_wait = INT_MAX;
+    nbr->idle();
+}
+
+/**
+ * stops for good; irqs are ignored and run() returns
+ */
+void BCpu::halt() {
+    halted = true;
+    op_wait = INT_MAX;
+    nbr->stop();
+}
+
+bool BCpu::isHalted() {
+    return halted;
+}
+
+/**
+ * pushes pc, masks interrupts and jumps through the vector table
+ */
+void BCpu::interrupt(uint8_t ivec) {
+    interrupts++;
+    if(coverage) coverage->block(block_start, state.pc - 1);
+    state.sp -= 4;
+    nbr->writel(state.sp, state.pc);
+    state.write_flag(FLAG_I, false);
+    state.pc = nbr->readl(IVT_BASE + 4 * (ivec % IVT_VECTORS));
+    block_start = state.pc;
+}
+
+// lowest vector first
+void BCpu::service_irq() {
+    uint8_t ivec = __builtin_ctz(irq_pending);
+    irq_pending &= ~(1 << ivec);
+    interrupt(ivec);
+}
+
+/**
+ * maskable interrupt. Held pending until FLAG_I is set.
+ * Must be called between clks.
+ */
+void BCpu::irq(uint8_t ivec) {
+    if(halted) return;
+
+    // a masked irq still wakes the cpu from WFI
+    waiting = false;
+    op_wait = 0;
+    irq_pending |= 1 << (ivec % IVT_VECTORS);
+    if(state.read_flag(FLAG_I)) service_irq();
+}
+
+void BCpu::nmi(uint8_t ivec) {
+    if(halted) return;
+    waiting = false;
+    op_wait = 0;
+    interrupt(ivec);
+}
+
+/**
+ * enters IVEC_FAULT with the faulting instruction's pc and the address on
+ * the stack. Decode does not change state, so pc is still the instruction.
+ */
+void BCpu::fault(uint32_t addr) {
+    waiting = false;
+    op_wait = 0;
+    interrupt(IVEC_FAULT);
+    state.sp -= 4;
+    nbr->writel(state.sp, addr);
+}
+
+uint64_t BCpu::sumOps(int first, int last) {
+    uint64_t n = 0;
+    for(int i = first; i <= last; i++) n += opcounts[i];
+    return n;
+}
+
+uint64_t BCpu::getPerfCount(int event) {
+    switch(event) {
+        case PERF_INSTRUCTIONS:
+            return sumOps(0x00, 0xFF);
+        case PERF_BRANCHES_TAKEN:
+            return sumOps(AJMP, LRJSR) + opcounts[RET] + opcounts[RFI] + cond_taken;
+        case PERF_BRANCHES_NOT_TAKEN:
+            return sumOps(JCC, JSS) - cond_taken;
+        case PERF_LOADS:
+            return sumOps(LODB_RRK, LLODF_RRK) + sumOps(ALODB_RRK, ALLODF_RRK) +
+                opcounts[POPX_R] + opcounts[POPX_X];
+        case PERF_STORES:
+            return sumOps(STOB_RRK, LSTOF_RRK) + sumOps(ASTOB_RRK, ALSTOF_RRK) +
+                opcounts[PSHX_R] + opcounts[PSHX_K];
+        case PERF_INTERRUPTS:
+            return interrupts;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * ends the basic block if the instruction just retired at pc transferred
+ * control; anything else extends it for free
+ */
+void BCpu::cover(uint32_t pc) {
+    uint8_t unit = opcode_table.op[op].unit;
+    if(unit == UNIT_BRANCH) {
+        // jumps leave the flags alone, so the condition still holds
+        coverage->branch(pc, state.read_flag((Flag) (op & 0x07)) == (bool) (op & 0x08));
+    } else if(unit != UNIT_JUMP && op != RET && op != RFI && op != HLT) {
+        return;
     }
+
+    coverage->block(block_start, pc + opcode_length(op) - 1);
+    block_start = state.pc;
+}
+
+/**
+ * collects coverage into c from the current pc on; NULL stops collecting
+ */
+void BCpu::setCoverage(Coverage *c) {
+    coverage = c;
+    block_start = state.pc;
+}
+
+/**
+ * records the block in progress, so coverage is complete when a run is
+ * stopped between branches
+ */
+void BCpu::flushCoverage() {
+    if(!coverage) return;
+    coverage->block(block_start, state.pc - 1);
+    block_start = state.pc;
+}
+
+/**
+ * instructions retired with the given opcode
+ */
+uint64_t BCpu::getOpCount(uint8_t op) {
+    return opcounts[op];
 }
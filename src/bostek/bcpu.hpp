@@ -2,9 +2,16 @@
 #define _BOSTEK_BCPU_HPP
 
 #include "cpu.hpp"
+#include "coverage.hpp"
 
 namespace Bostek {
 namespace Cpu {
+
+// interrupt vectors are longs at IVT_BASE + 4 * ivec
+#define IVT_BASE 0x0000
+#define IVT_VECTORS 32
+#define IVEC_FAULT 1 // memory fault; the faulting address is pushed after pc
+
 enum OpCodes {
     NOP=0x00, HLT, WFI, RET, RFI, IRQ, NMI, CPUB, ANSB_R=0x08, ORSB_R, XRSB_R, ANSB_K=0x0C, ORSB_K, XRSB_K,
     LODB_RRK=0x10, LODW_RRK, LODL_RRK, LODF_RRK, LLODB_RRK, LLODW_RRK, LLODL_RRK, LLODF_RRK, STOB_RRK, STOW_RRK, STOL_RRK, STOF_RRK, LSTOB_RRK, LSTOW_RRK, LSTOL_RRK, LSTOF_RRK,
@@ -135,6 +142,27 @@ class BCpu : public ::Cpu {
     uint32_t abs_value(Type ty, uint32_t val);
     uint64_t pow_value(uint32_t v1, uint32_t v2); // assumes unsigned
 
+    uint32_t irq_pending; // one bit per vector; held while FLAG_I is clear
+    bool waiting; // in WFI
+    bool halted; // executed HLT; only a reset restarts it
+
+    // the only per-instruction count is by opcode; the PerfEvent totals are
+    // summed from it when read
+    uint8_t op; // of the instruction being executed
+    uint64_t opcounts[256]; // retired
+    uint64_t cond_taken;
+    uint64_t interrupts;
+    uint64_t sumOps(int first, int last);
+
+    Coverage *coverage; // NULL unless collecting
+    uint32_t block_start; // of the basic block being executed
+    void cover(uint32_t pc);
+
+    void interrupt(uint8_t ivec);
+    void service_irq();
+    void wait();
+    void halt();
+
     public:
     State state;
     Delta next;
@@ -146,7 +174,6 @@ class BCpu : public ::Cpu {
     Delta decode_move(uint8_t op1);
     Delta decode_swap(uint8_t op1);
     Delta decode_push_pop(uint8_t op1);
-    Delta decode_transfer(uint8_t op1);
     Delta decode_jump(uint8_t op1);
     Delta decode_arithmetic(uint8_t op1);
     Delta decode();
@@ -156,6 +183,17 @@ class BCpu : public ::Cpu {
     BCpu();
     BCpu(uint32_t pc, uint32_t sp);
     virtual void clk();
+    virtual uint32_t getPc();
+    virtual bool isWaiting();
+    virtual bool isHalted();
+    virtual void irq(uint8_t ivec);
+    virtual void nmi(uint8_t ivec);
+    virtual void fault(uint32_t addr);
+    virtual uint64_t getPerfCount(int event);
+    uint64_t getOpCount(uint8_t op);
+
+    void setCoverage(Coverage *c);
+    void flushCoverage();
 
     friend class BCpuTest;
 };
@@ -0,0 +1,141 @@
+#include "disassembler.hpp"
+
+// TODO: not availible on windows
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+
+#include "assembler.hpp"
+#include "sparseImage.hpp"
+#include "cpplib/common/exception.hpp"
+#include "cpplib/common/string.hpp"
+
+struct Params {
+    String image;
+    String map; // "address name" per label, from basm -m or blink -m
+    uint32_t load; // address a raw image goes at
+    uint32_t first;
+    uint32_t last;
+    bool trace; // symbolize addresses read from stdin
+};
+
+void error(const char *msg) {
+    printf("bdis: %s\n", msg);
+    exit(-1);
+}
+
+void usage() {
+    printf("usage: bdis [options] image\n"
+           "  -m file.map   label addresses from a symbol map\n"
+           "  -l addr       address a raw image is loaded at (default 0)\n"
+           "  -s addr       first address to list (default 0x1000)\n"
+           "  -e addr       address to stop listing at (default: end of image)\n"
+           "  -t            symbolize a trace: one address per line on stdin\n");
+    exit(-1);
+}
+
+uint32_t parse_number(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 0);
+    if(end == s || *end || v > 0xFFFFFFFFULL) error("invalid address");
+    return v;
+}
+
+Params parse_params(int argc, char **argv) {
+    Params params;
+    params.load = 0;
+    params.first = ASM_ORIGIN;
+    params.last = 0xFFFFFFFF;
+    params.trace = false;
+    while(optind < argc) {
+        char c = getopt(argc, argv, "-m:l:s:e:th");
+        switch(c) {
+            case 'm':
+                params.map = optarg;
+                break;
+            case 'l':
+                params.load = parse_number(optarg);
+                break;
+            case 's':
+                params.first = parse_number(optarg);
+                break;
+            case 'e':
+                params.last = parse_number(optarg);
+                break;
+            case 't':
+                params.trace = true;
+                break;
+            case 'h':
+                usage();
+                break;
+            case '?':
+                std::cout << "missing argument for -" << (char) optopt << std::endl;
+                exit(-1);
+                break;
+            default:
+                if(!params.image.empty()) error("expect one image");
+                params.image = optarg;
+                break;
+        }
+    }
+    if(params.image.empty()) usage();
+    return params;
+}
+
+/**
+ * prints "address symbol instruction" for each address of the trace
+ */
+void trace(Disassembler *dis, SparseImage *image) {
+    char line[256];
+    char where[DISASM_TEXT_MAX];
+    char text[DISASM_TEXT_MAX];
+    while(fgets(line, sizeof(line), stdin)) {
+        char *p = line;
+        if(*p == '$') p++;
+        char *end;
+        uint32_t addr = strtoul(p, &end, 16);
+        if(end == p) continue;
+
+        dis->symbolize(addr, where, sizeof(where));
+        text[0] = '\0';
+        for(int i = 0; i < image->getSegmentCount(); i++) {
+            const ImageSegment &s = image->getSegment(i);
+            if(addr >= s.addr && addr - s.addr < s.data.size()) {
+                dis->decode(&s.data[addr - s.addr], s.data.size() - (addr - s.addr), addr, text, sizeof(text));
+            }
+        }
+        printf("%08X  %-24s  %s\n", addr, where, text);
+    }
+}
+
+/**
+ * disassembles an image from basm or blink, segment by segment
+ */
+int main(int argc, char **argv) {
+    Params p = parse_params(argc, argv);
+
+    SparseImage *image;
+    try {
+        image = SparseImage::load(p.image.c_str(), p.load);
+    } catch(Exception &e) {
+        printf("%s\n", e.getMessage().c_str());
+        exit(-1);
+    }
+
+    Disassembler *dis = new Disassembler;
+    if(!p.map.empty() && !dis->loadSymbols(p.map.c_str())) error("unable to read symbol map");
+
+    if(p.trace) {
+        trace(dis, image);
+    } else {
+        for(int i = 0; i < image->getSegmentCount(); i++) {
+            const ImageSegment &s = image->getSegment(i);
+            dis->list(stdout, &s.data[0], s.addr, s.data.size(), p.first, p.last);
+        }
+    }
+
+    image->release();
+    dis->release();
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "linker.hpp"
+
+// TODO: not availible on windows
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <iostream>
+
+#include "cpplib/common/string.hpp"
+#include "cpplib/common/exception.hpp"
+
+struct Params {
+    std::vector<String> input;
+    String output;
+    String map; // "address name" per label, for bostek-run -S
+    bool raw; // -r; a flat dump from address 0, instead of only the segments
+};
+
+void error(const char *msg) {
+    printf("blink: %s\n", msg);
+    exit(-1);
+}
+
+Params parse_params(int argc, char **argv) {
+    Params params;
+    params.raw = false;
+    while(optind < argc) {
+        char c = getopt(argc, argv, "-o:m:r");
+        switch(c) {
+            case 'o':
+                params.output = optarg;
+                break;
+            case 'm':
+                params.map = optarg;
+                break;
+            case 'r':
+                params.raw = true;
+                break;
+            case '?':
+                std::cout << "missing argument for -" << (char) optopt << std::endl;
+                exit(-1);
+                break;
+            default:
+                params.input.push_back(optarg);
+                break;
+        }
+    }
+    if(params.output.empty()) {
+        error("expect output file");
+    }
+    return params;
+}
+
+/**
+ * links basm -c objects into an image, in the order given
+ */
+int main(int argc, char **argv) {
+    Params p = parse_params(argc, argv);
+
+    Linker *linker = new Linker;
+    SparseImage *image = new SparseImage;
+    try {
+        for(int i = 0; i < p.input.size(); i++) {
+            ObjectFile *obj = ObjectFile::load(p.input[i].c_str());
+            linker->add(obj);
+            obj->release();
+        }
+        linker->write(image);
+        if(p.raw) image->saveRaw(p.output.c_str());
+        else image->save(p.output.c_str());
+    } catch(Exception &e) {
+        printf("%s\n", e.getMessage().c_str());
+        exit(-1);
+    }
+
+    if(!p.map.empty()) {
+        FILE *map = fopen(p.map.c_str(), "w");
+        if(!map) error("unable to open map file");
+        linker->writeMap(map);
+        fclose(map);
+    }
+
+    image->release();
+    linker->release();
+
+    return 0;
+}
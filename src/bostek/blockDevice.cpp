@@ -0,0 +1,173 @@
+#include "blockDevice.hpp"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "memory.hpp"
+#include "cpplib/common/exception.hpp"
+
+BlockDevice::BlockDevice(const char *filename, bool _readonly) : readonly(_readonly),
+        quit(false), pending(false), done(false), failed(false), cmd(0), offset(0), len(0),
+        buf(NULL), bufsize(0) {
+    memset(regs, 0, sizeof(regs));
+
+    fd = open(filename, readonly ? O_RDONLY : O_RDWR);
+    if(fd < 0) throw Exception(String("block device: unable to open ") + String(filename));
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw Exception(String("block device: unable to stat ") + String(filename));
+    }
+    sectors = st.st_size / BLOCK_SECTOR_SIZE;
+
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+    if(pthread_create(&thread, NULL, threadMain, this) != 0) {
+        close(fd);
+        throw Exception("block device: unable to start io thread");
+    }
+}
+
+BlockDevice::~BlockDevice() {
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+    close(fd);
+    free(buf);
+}
+
+uint32_t BlockDevice::reg(int r) {
+    return (regs[r+3] << 24) | (regs[r+2] << 16) | (regs[r+1] << 8) | regs[r];
+}
+
+uint64_t BlockDevice::getSectors() {
+    return sectors;
+}
+
+void *BlockDevice::threadMain(void *self) {
+    ((BlockDevice*) self)->work();
+    return NULL;
+}
+
+/**
+ * io thread. Takes one command at a time; only touches buf and the file.
+ */
+void BlockDevice::work() {
+    pthread_mutex_lock(&lock);
+    while(true) {
+        while(!pending && !quit) pthread_cond_wait(&cond, &lock);
+        if(quit) break;
+        pthread_mutex_unlock(&lock);
+
+        bool ok = true;
+        uint32_t n = 0;
+        if(cmd == BLOCK_CMD_FLUSH) {
+            ok = fsync(fd) == 0;
+        }
+        while(ok && n < len) {
+            ssize_t r;
+            if(cmd == BLOCK_CMD_READ) {
+                r = pread(fd, buf + n, len - n, offset + n);
+            } else {
+                r = pwrite(fd, buf + n, len - n, offset + n);
+            }
+            ok = r > 0;
+            if(ok) n += r;
+        }
+
+        pthread_mutex_lock(&lock);
+        failed = !ok;
+        pending = false;
+        done = true;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * latches the registers and hands the command to the io thread
+ */
+void BlockDevice::start(uint8_t _cmd) {
+    uint32_t sector = reg(BLOCK_SECTOR);
+    uint32_t count = (regs[BLOCK_COUNT+1] << 8) | regs[BLOCK_COUNT];
+    bool bad = _cmd < BLOCK_CMD_READ || _cmd > BLOCK_CMD_FLUSH ||
+        (_cmd == BLOCK_CMD_WRITE && readonly) ||
+        (_cmd != BLOCK_CMD_FLUSH && (uint64_t) sector + count > sectors);
+
+    cmd = _cmd;
+    offset = (uint64_t) sector * BLOCK_SECTOR_SIZE;
+    len = cmd == BLOCK_CMD_FLUSH ? 0 : count * BLOCK_SECTOR_SIZE;
+    if(len > bufsize) {
+        buf = (uint8_t*) realloc(buf, len);
+        bufsize = len;
+    }
+
+    if(!bad && cmd == BLOCK_CMD_WRITE) {
+        Memory *mem = nbr->getMemory();
+        size_t n = mem ? mem->dump(reg(BLOCK_ADDR), len, buf) : 0;
+        memset(buf + n, 0, len - n);
+    }
+
+    pthread_mutex_lock(&lock);
+    done = bad;
+    failed = bad;
+    pending = !bad;
+    if(pending) pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    regs[BLOCK_STATUS] = BLOCK_STATUS_BUSY;
+    nbr->schedule(BLOCK_SETUP_CLKS + (uint64_t) (bad ? 0 : count) * BLOCK_SECTOR_CLKS, this, 0);
+}
+
+uint32_t BlockDevice::getSize() {
+    return BLOCK_SIZE;
+}
+
+uint8_t BlockDevice::readb(uint32_t offset) {
+    if(offset >= BLOCK_CAPACITY && offset < BLOCK_SIZE) {
+        uint64_t cap = sectors > 0xFFFFFFFF ? 0xFFFFFFFF : sectors;
+        return cap >> (8 * (offset - BLOCK_CAPACITY));
+    }
+    if(offset >= BLOCK_SIZE) return 0x00;
+    return regs[offset];
+}
+
+void BlockDevice::writeb(uint32_t offset, uint8_t v) {
+    if(offset >= BLOCK_CAPACITY) return;
+    if(offset == BLOCK_STATUS) {
+        regs[BLOCK_STATUS] &= ~(v & (BLOCK_STATUS_DONE | BLOCK_STATUS_ERROR));
+        return;
+    }
+
+    // the command registers are latched at start; hold them while busy
+    if(regs[BLOCK_STATUS] & BLOCK_STATUS_BUSY) return;
+    regs[offset] = v;
+    if(offset == BLOCK_CMD) start(v);
+}
+
+void BlockDevice::event(int id) {
+    pthread_mutex_lock(&lock);
+    bool finished = done;
+    pthread_mutex_unlock(&lock);
+
+    if(!finished) {
+        nbr->schedule(BLOCK_POLL_CLKS, this, 0); // the host is behind; check again later
+        return;
+    }
+
+    if(cmd == BLOCK_CMD_READ && !failed) {
+        Memory *mem = nbr->getMemory();
+        if(mem) mem->fill(reg(BLOCK_ADDR), len, buf);
+    }
+
+    regs[BLOCK_STATUS] = BLOCK_STATUS_DONE | (failed ? BLOCK_STATUS_ERROR : 0);
+    if(regs[BLOCK_CTRL] & BLOCK_CTRL_IRQ) nbr->raiseIrq(regs[BLOCK_IVEC]);
+}
@@ -0,0 +1,88 @@
+#ifndef _BOSTEK_BLOCK_DEVICE_HPP
+#define _BOSTEK_BLOCK_DEVICE_HPP
+
+#include <pthread.h>
+
+#include "device.hpp"
+
+enum BlockRegister {
+    BLOCK_SECTOR=0x00, // long; first sector
+    BLOCK_ADDR=0x04, // long; ram address
+    BLOCK_COUNT=0x08, // word; sectors
+    BLOCK_CMD=0x0A, // writing starts the command
+    BLOCK_CTRL=0x0B,
+    BLOCK_STATUS=0x0C,
+    BLOCK_IVEC=0x0D,
+    BLOCK_CAPACITY=0x10, // long; sectors, read only
+    BLOCK_SIZE=0x14,
+};
+
+enum BlockCmd {
+    BLOCK_CMD_READ=0x01,
+    BLOCK_CMD_WRITE=0x02,
+    BLOCK_CMD_FLUSH=0x03,
+};
+
+enum BlockCtrl {
+    BLOCK_CTRL_IRQ=0x01, // raise BLOCK_IVEC when a command completes
+};
+
+enum BlockStatus {
+    BLOCK_STATUS_BUSY=0x01,
+    BLOCK_STATUS_DONE=0x02, // write 1 to clear
+    BLOCK_STATUS_ERROR=0x04, // write 1 to clear
+};
+
+#define BLOCK_SECTOR_SIZE 512
+#define BLOCK_SETUP_CLKS 64
+#define BLOCK_SECTOR_CLKS 128
+#define BLOCK_POLL_CLKS 1024
+
+/**
+ * Disk backed by a host file
+ *
+ * Commands go to a host thread, so the cpu never waits on the disk. Writes
+ * copy their sectors out of ram when issued and reads land in ram when the
+ * command completes, so the thread never touches guest memory.
+ *
+ * Completion is an event BLOCK_SETUP_CLKS plus BLOCK_SECTOR_CLKS per sector
+ * after the command. If the host is slower than that, the event polls again
+ * every BLOCK_POLL_CLKS instead of blocking.
+ */
+class BlockDevice : public Device {
+    uint8_t regs[BLOCK_SIZE];
+    int fd;
+    bool readonly;
+    uint64_t sectors;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool quit;
+    bool pending; // a command is queued for the thread
+    bool done; // the thread finished it
+    bool failed;
+    uint8_t cmd;
+    uint64_t offset;
+    uint32_t len;
+    uint8_t *buf;
+    uint32_t bufsize;
+
+    uint32_t reg(int r);
+    void start(uint8_t cmd);
+    void work();
+    static void *threadMain(void *self);
+
+    public:
+    BlockDevice(const char *filename, bool readonly=false);
+    virtual ~BlockDevice();
+
+    uint64_t getSectors();
+
+    virtual uint32_t getSize();
+    virtual uint8_t readb(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+    virtual void event(int id);
+};
+
+#endif
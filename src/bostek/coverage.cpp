@@ -0,0 +1,274 @@
+#include "coverage.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define COVERAGE_MAGIC 0x564F4342 // "BCOV"
+#define COVERAGE_VERSION 1
+
+SparseBitmap::SparseBitmap() {
+    // untouched pages of the directory cost nothing
+    pages = (uint64_t**) calloc(MEMORY_MAP_PAGES, sizeof(uint64_t*));
+}
+
+SparseBitmap::~SparseBitmap() {
+    clear();
+    free(pages);
+}
+
+uint64_t *SparseBitmap::page(uint32_t p) {
+    if(!pages[p]) pages[p] = (uint64_t*) calloc(COVERAGE_PAGE_WORDS, sizeof(uint64_t));
+    return pages[p];
+}
+
+void SparseBitmap::set(uint32_t addr) {
+    uint32_t bit = addr & (MEMORY_PAGE_SIZE - 1);
+    page(addr >> MEMORY_PAGE_SHIFT)[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+/**
+ * sets first to last inclusive, a word at a time
+ */
+void SparseBitmap::setRange(uint32_t first, uint32_t last) {
+    uint64_t addr = first;
+    while(addr <= last) {
+        uint64_t *words = page(addr >> MEMORY_PAGE_SHIFT);
+        uint32_t bit = addr & (MEMORY_PAGE_SIZE - 1);
+        uint32_t n = 64 - (bit & 63); // bits to the end of the word
+        if(addr + n - 1 > last) n = last - addr + 1;
+        uint64_t mask = n == 64 ? ~0ULL : ((1ULL << n) - 1) << (bit & 63);
+        words[bit >> 6] |= mask;
+        addr += n;
+    }
+}
+
+bool SparseBitmap::test(uint32_t addr) const {
+    uint64_t *words = pages[addr >> MEMORY_PAGE_SHIFT];
+    if(!words) return false;
+    uint32_t bit = addr & (MEMORY_PAGE_SIZE - 1);
+    return words[bit >> 6] & (1ULL << (bit & 63));
+}
+
+/**
+ * first address from from on whose bit is value, or 2^32 if there is none
+ */
+uint64_t SparseBitmap::next(uint64_t from, bool value) const {
+    while(from < 0x100000000ULL) {
+        uint64_t *words = pages[from >> MEMORY_PAGE_SHIFT];
+        if(!words) {
+            if(!value) return from;
+            from = ((from >> MEMORY_PAGE_SHIFT) + 1) << MEMORY_PAGE_SHIFT;
+            continue;
+        }
+
+        uint32_t bit = from & (MEMORY_PAGE_SIZE - 1);
+        uint64_t w = value ? words[bit >> 6] : ~words[bit >> 6];
+        w &= ~0ULL << (bit & 63);
+        if(w) return (from & ~63ULL) + __builtin_ctzll(w);
+        from = (from | 63) + 1;
+    }
+    return 0x100000000ULL;
+}
+
+uint64_t SparseBitmap::count() const {
+    uint64_t n = 0;
+    for(uint32_t p = 0; p < MEMORY_MAP_PAGES; p++) {
+        if(!pages[p]) continue;
+        for(int i = 0; i < COVERAGE_PAGE_WORDS; i++) n += __builtin_popcountll(pages[p][i]);
+    }
+    return n;
+}
+
+void SparseBitmap::merge(const SparseBitmap &o) {
+    for(uint32_t p = 0; p < MEMORY_MAP_PAGES; p++) {
+        if(!o.pages[p]) continue;
+        uint64_t *words = page(p);
+        for(int i = 0; i < COVERAGE_PAGE_WORDS; i++) words[i] |= o.pages[p][i];
+    }
+}
+
+void SparseBitmap::clear() {
+    for(uint32_t p = 0; p < MEMORY_MAP_PAGES; p++) {
+        free(pages[p]);
+        pages[p] = NULL;
+    }
+}
+
+// page count, then the index and words of each allocated page
+bool SparseBitmap::write(FILE *f) const {
+    uint32_t n = 0;
+    for(uint32_t p = 0; p < MEMORY_MAP_PAGES; p++) {
+        if(pages[p]) n++;
+    }
+    if(fwrite(&n, sizeof(n), 1, f) != 1) return false;
+
+    for(uint32_t p = 0; p < MEMORY_MAP_PAGES; p++) {
+        if(!pages[p]) continue;
+        if(fwrite(&p, sizeof(p), 1, f) != 1) return false;
+        if(fwrite(pages[p], sizeof(uint64_t), COVERAGE_PAGE_WORDS, f) != COVERAGE_PAGE_WORDS) return false;
+    }
+    return true;
+}
+
+bool SparseBitmap::read(FILE *f) {
+    uint32_t n;
+    if(fread(&n, sizeof(n), 1, f) != 1) return false;
+
+    uint64_t words[COVERAGE_PAGE_WORDS];
+    for(uint32_t i = 0; i < n; i++) {
+        uint32_t p;
+        if(fread(&p, sizeof(p), 1, f) != 1 || p >= MEMORY_MAP_PAGES) return false;
+        if(fread(words, sizeof(uint64_t), COVERAGE_PAGE_WORDS, f) != COVERAGE_PAGE_WORDS) return false;
+        uint64_t *dst = page(p);
+        for(int j = 0; j < COVERAGE_PAGE_WORDS; j++) dst[j] |= words[j];
+    }
+    return true;
+}
+
+Coverage::Coverage() {
+}
+
+Coverage::~Coverage() {
+}
+
+/**
+ * marks the bytes of a basic block as executed
+ */
+void Coverage::block(uint32_t first, uint32_t last) {
+    if(last < first) return; // empty, or the pc wrapped
+    executed.setRange(first, last);
+}
+
+void Coverage::branch(uint32_t addr, bool was_taken) {
+    if(was_taken) {
+        taken.set(addr);
+    } else {
+        not_taken.set(addr);
+    }
+}
+
+bool Coverage::isExecuted(uint32_t addr) {
+    return executed.test(addr);
+}
+
+bool Coverage::isTaken(uint32_t addr) {
+    return taken.test(addr);
+}
+
+bool Coverage::isNotTaken(uint32_t addr) {
+    return not_taken.test(addr);
+}
+
+uint64_t Coverage::getExecutedCount() {
+    return executed.count();
+}
+
+void Coverage::merge(Coverage *o) {
+    executed.merge(o->executed);
+    taken.merge(o->taken);
+    not_taken.merge(o->not_taken);
+}
+
+void Coverage::clear() {
+    executed.clear();
+    taken.clear();
+    not_taken.clear();
+}
+
+bool Coverage::save(const char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if(!f) return false;
+
+    uint32_t header[2] = {COVERAGE_MAGIC, COVERAGE_VERSION};
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1 &&
+        executed.write(f) && taken.write(f) && not_taken.write(f);
+    return fclose(f) == 0 && ok;
+}
+
+/**
+ * merges a saved file into this coverage. Returns false if it is missing
+ * or not a coverage file.
+ */
+bool Coverage::load(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if(!f) return false;
+
+    uint32_t header[2];
+    bool ok = fread(header, sizeof(header), 1, f) == 1 &&
+        header[0] == COVERAGE_MAGIC && header[1] == COVERAGE_VERSION &&
+        executed.read(f) && taken.read(f) && not_taken.read(f);
+    fclose(f);
+    return ok;
+}
+
+static void print_location(FILE *out, uint32_t addr, const std::map<uint32_t, String> &symbols) {
+    fprintf(out, "%08x", addr);
+
+    std::map<uint32_t, String>::const_iterator it = symbols.upper_bound(addr);
+    if(it == symbols.begin()) return;
+    it--;
+    String name = it->second;
+    if(addr == it->first) {
+        fprintf(out, "  %s", name.c_str());
+    } else {
+        fprintf(out, "  %s+%x", name.c_str(), addr - it->first);
+    }
+}
+
+/**
+ * lists the executed ranges, then each conditional branch and the
+ * directions it went
+ */
+void Coverage::report(FILE *out, const std::map<uint32_t, String> &symbols) {
+    uint64_t addr = executed.next(0, true);
+    while(addr < 0x100000000ULL) {
+        uint64_t first = addr;
+        addr = executed.next(addr, false);
+
+        // a symbol inside the range splits it, so every routine shows up
+        std::map<uint32_t, String>::const_iterator it = symbols.upper_bound(first);
+        if(it != symbols.end() && it->first < addr) addr = it->first;
+
+        fprintf(out, "exec   ");
+        print_location(out, first, symbols);
+        fprintf(out, "  %u bytes\n", (uint32_t) (addr - first));
+        addr = executed.next(addr, true);
+    }
+
+    uint64_t t = taken.next(0, true);
+    uint64_t nt = not_taken.next(0, true);
+    while(t < 0x100000000ULL || nt < 0x100000000ULL) {
+        addr = t < nt ? t : nt;
+        fprintf(out, "branch ");
+        print_location(out, addr, symbols);
+        fprintf(out, "  %s\n", t == nt ? "both" : t < nt ? "taken" : "not taken");
+        if(t == addr) t = taken.next(addr + 1, true);
+        if(nt == addr) nt = not_taken.next(addr + 1, true);
+    }
+}
+
+/**
+ * reads a map of "address name" lines, as written by basm. Addresses are
+ * hex, with an optional $ or 0x. Returns false if the file is missing.
+ */
+bool loadSymbols(const char *filename, std::map<uint32_t, String> *symbols) {
+    FILE *f = fopen(filename, "r");
+    if(!f) return false;
+
+    char line[256];
+    while(fgets(line, sizeof(line), f)) {
+        char *p = line;
+        if(*p == '$') p++;
+        char *end;
+        uint32_t addr = strtoul(p, &end, 16);
+        if(end == p) continue;
+        while(isspace(*end)) end++;
+        char *name = end;
+        while(*end && !isspace(*end)) end++;
+        *end = '\0';
+        if(*name) (*symbols)[addr] = String(name);
+    }
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef _BOSTEK_COVERAGE_HPP
+#define _BOSTEK_COVERAGE_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/string.hpp"
+#include "memory.hpp"
+
+#define COVERAGE_PAGE_WORDS (MEMORY_PAGE_SIZE / 64)
+
+/**
+ * One bit per address of the 32-bit space. Only pages with a bit set
+ * are allocated.
+ */
+class SparseBitmap {
+    uint64_t **pages;
+
+    uint64_t *page(uint32_t p);
+
+    public:
+    SparseBitmap();
+    ~SparseBitmap();
+
+    void set(uint32_t addr);
+    void setRange(uint32_t first, uint32_t last);
+    bool test(uint32_t addr) const;
+    uint64_t next(uint64_t from, bool value) const;
+    uint64_t count() const;
+    void merge(const SparseBitmap &o);
+    void clear();
+
+    bool write(FILE *f) const;
+    bool read(FILE *f); // merges into the bitmap
+};
+
+/**
+ * Guest code coverage: every byte of each instruction executed, and the
+ * directions taken by each conditional branch.
+ *
+ * The cpu reports whole basic blocks as they end, so recording costs
+ * nothing for instructions that do not branch.
+ *
+ * Saved files merge on load, so parallel runs can share one file. Reports
+ * name addresses by the nearest symbol from a map file with one
+ * "address name" pair per line.
+ */
+class Coverage : public Object {
+    SparseBitmap executed;
+    SparseBitmap taken;
+    SparseBitmap not_taken;
+
+    public:
+    Coverage();
+    virtual ~Coverage();
+
+    void block(uint32_t first, uint32_t last);
+    void branch(uint32_t addr, bool was_taken);
+
+    bool isExecuted(uint32_t addr);
+    bool isTaken(uint32_t addr);
+    bool isNotTaken(uint32_t addr);
+    uint64_t getExecutedCount();
+
+    void merge(Coverage *o);
+    void clear();
+    bool save(const char *filename);
+    bool load(const char *filename);
+    void report(FILE *out, const std::map<uint32_t, String> &symbols);
+};
+
+bool loadSymbols(const char *filename, std::map<uint32_t, String> *symbols);
+
+#endif
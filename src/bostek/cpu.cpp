@@ -13,8 +13,33 @@ void Cpu::setNorthBridge(NorthBridge *_nbr) {
 void Cpu::clk() {
 }
 
+uint32_t Cpu::getPc() {
+    return 0;
+}
+
+bool Cpu::isWaiting() {
+    return false;
+}
+
+bool Cpu::isHalted() {
+    return false;
+}
+
 void Cpu::irq(uint8_t ivec) {
 }
 
 void Cpu::nmi(uint8_t ivec) {
 }
+
+/**
+ * called between clks after a memory fault abandoned an instruction
+ */
+void Cpu::fault(uint32_t addr) {
+}
+
+/**
+ * count of a PerfEvent since the cpu was created, or 0 if not counted
+ */
+uint64_t Cpu::getPerfCount(int event) {
+    return 0;
+}
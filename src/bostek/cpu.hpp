@@ -7,6 +7,16 @@
 #include <stdint.h>
 #include <stddef.h>
 
+enum PerfEvent {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_BRANCHES_TAKEN, // jumps, calls, returns and taken conditionals
+    PERF_BRANCHES_NOT_TAKEN,
+    PERF_LOADS,
+    PERF_STORES,
+    PERF_INTERRUPTS, // irqs, nmis and faults entered
+    PERF_EVENTS,
+};
 
 class Cpu : public Object {
     protected:
@@ -17,8 +27,13 @@ class Cpu : public Object {
     virtual ~Cpu();
     void setNorthBridge(NorthBridge *_nbr);
     virtual void clk();
+    virtual uint32_t getPc();
+    virtual bool isWaiting();
+    virtual bool isHalted();
     virtual void irq(uint8_t ivec);
     virtual void nmi(uint8_t ivec);
+    virtual void fault(uint32_t addr);
+    virtual uint64_t getPerfCount(int event);
 };
 
 #endif
@@ -0,0 +1,136 @@
+#include "debugger.hpp"
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "northBridge.hpp"
+
+Debugger::Debugger(NorthBridge *_nbr) : nbr(_nbr), reason(STOP_NONE), stop_addr(0), resuming(false), resume_pc(0) {
+    nbr->attachDebugger(this);
+}
+
+Debugger::~Debugger() {
+    clear();
+    nbr->detachDebugger();
+}
+
+NorthBridge *Debugger::getNorthBridge() {
+    return nbr;
+}
+
+void Debugger::updateTraps() {
+    Memory *mem = nbr->getMemory();
+    if(!mem) return;
+
+    mem->clearTrap(0, 0x100000000ULL, PAGE_TRAP_READ | PAGE_TRAP_WRITE | PAGE_TRAP_EXEC);
+
+    std::set<uint32_t>::iterator it;
+    for(it = breakpoints.begin(); it != breakpoints.end(); it++) {
+        mem->setTrap(*it, 1, PAGE_TRAP_EXEC);
+    }
+
+    for(int i = 0; i < watchpoints.size(); i++) {
+        Watchpoint &w = watchpoints[i];
+        uint8_t bits = 0;
+        if(w.kind & WATCH_READ) bits |= PAGE_TRAP_READ;
+        if(w.kind & WATCH_WRITE) bits |= PAGE_TRAP_WRITE;
+        mem->setTrap(w.addr, w.len, bits);
+    }
+}
+
+void Debugger::addBreakpoint(uint32_t pc) {
+    breakpoints.insert(pc);
+    updateTraps();
+}
+
+void Debugger::removeBreakpoint(uint32_t pc) {
+    breakpoints.erase(pc);
+    updateTraps();
+}
+
+bool Debugger::hasBreakpoint(uint32_t pc) {
+    return breakpoints.count(pc);
+}
+
+void Debugger::addWatchpoint(uint32_t addr, uint32_t len, int kind) {
+    watchpoints.push_back(Watchpoint(addr, len, kind));
+    updateTraps();
+}
+
+void Debugger::removeWatchpoint(uint32_t addr, uint32_t len, int kind) {
+    for(int i = 0; i < watchpoints.size(); i++) {
+        Watchpoint &w = watchpoints[i];
+        if(w.addr == addr && w.len == len && w.kind == kind) {
+            watchpoints.erase(watchpoints.begin() + i);
+            break;
+        }
+    }
+    updateTraps();
+}
+
+void Debugger::clear() {
+    breakpoints.clear();
+    watchpoints.clear();
+    updateTraps();
+}
+
+/**
+ * runs until a breakpoint or watchpoint is hit, or nclks have passed.
+ * If the cpu sits on a breakpoint it is stepped over first.
+ */
+uint64_t Debugger::run(uint64_t nclks) {
+    Cpu *cpu = nbr->getCpu();
+    reason = STOP_NONE;
+    resuming = cpu && breakpoints.count(cpu->getPc());
+    if(resuming) resume_pc = cpu->getPc();
+
+    uint64_t ran = nbr->run(nclks);
+    resuming = false;
+    return ran;
+}
+
+uint64_t Debugger::step() {
+    return run(1);
+}
+
+StopReason Debugger::getStopReason() {
+    return reason;
+}
+
+uint32_t Debugger::getStopAddress() {
+    return stop_addr;
+}
+
+void Debugger::watchHit(uint32_t addr, int kind) {
+    for(int i = 0; i < watchpoints.size(); i++) {
+        Watchpoint &w = watchpoints[i];
+        if((w.kind & kind) && addr - w.addr < w.len) {
+            if(reason == STOP_NONE) {
+                reason = kind == WATCH_READ ? STOP_WATCH_READ : STOP_WATCH_WRITE;
+                stop_addr = addr;
+            }
+            nbr->stop();
+            return;
+        }
+    }
+}
+
+void Debugger::trapRead(uint32_t addr) {
+    watchHit(addr, WATCH_READ);
+}
+
+void Debugger::trapWrite(uint32_t addr) {
+    watchHit(addr, WATCH_WRITE);
+}
+
+void Debugger::trapExec(uint32_t addr) {
+    if(!breakpoints.count(addr)) return;
+
+    if(resuming && addr == resume_pc) {
+        resuming = false;
+        return;
+    }
+
+    reason = STOP_BREAKPOINT;
+    stop_addr = addr;
+    throw StopExecution();
+}
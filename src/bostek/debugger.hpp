@@ -0,0 +1,81 @@
+#ifndef _BOSTEK_DEBUGGER_HPP
+#define _BOSTEK_DEBUGGER_HPP
+
+#include <stdint.h>
+#include <set>
+#include <vector>
+
+#include "cpplib/common/object.hpp"
+
+class NorthBridge;
+
+enum WatchKind {
+    WATCH_READ=0x01,
+    WATCH_WRITE=0x02,
+    WATCH_ACCESS=0x03,
+};
+
+enum StopReason {
+    STOP_NONE=0, // ran out of clks
+    STOP_BREAKPOINT,
+    STOP_WATCH_READ,
+    STOP_WATCH_WRITE,
+};
+
+struct Watchpoint {
+    uint32_t addr;
+    uint32_t len;
+    int kind;
+
+    Watchpoint(uint32_t a, uint32_t l, int k) : addr(a), len(l), kind(k) {}
+};
+
+/**
+ * PC breakpoints and memory watchpoints
+ *
+ * Nothing is checked per instruction. Pages that hold a breakpoint or
+ * watchpoint are flagged in the memory trap map; only accesses to those
+ * pages reach the debugger. The map is rebuilt whenever the set changes.
+ *
+ * A breakpoint stops before its instruction executes. A watchpoint stops
+ * after the instruction that made the access.
+ */
+class Debugger : public Object {
+    NorthBridge *nbr;
+    std::set<uint32_t> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+
+    StopReason reason;
+    uint32_t stop_addr;
+
+    bool resuming; // let the breakpoint at resume_pc through once
+    uint32_t resume_pc;
+
+    void updateTraps();
+    void watchHit(uint32_t addr, int kind);
+
+    public:
+    Debugger(NorthBridge *nbr);
+    ~Debugger();
+
+    NorthBridge *getNorthBridge();
+
+    void addBreakpoint(uint32_t pc);
+    void removeBreakpoint(uint32_t pc);
+    bool hasBreakpoint(uint32_t pc);
+    void addWatchpoint(uint32_t addr, uint32_t len, int kind);
+    void removeWatchpoint(uint32_t addr, uint32_t len, int kind);
+    void clear();
+
+    uint64_t run(uint64_t nclks);
+    uint64_t step();
+
+    StopReason getStopReason();
+    uint32_t getStopAddress();
+
+    void trapRead(uint32_t addr);
+    void trapWrite(uint32_t addr);
+    void trapExec(uint32_t addr);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "device.hpp"
+
+Device::Device() : nbr(NULL) {
+}
+
+Device::~Device() {
+}
+
+void Device::setNorthBridge(NorthBridge *_nbr) {
+    nbr = _nbr;
+}
+
+uint8_t Device::readb(uint32_t offset) {
+    return 0x00;
+}
+
+uint16_t Device::readw(uint32_t offset) {
+    return (readb(offset+1) << 8) | readb(offset);
+}
+
+uint32_t Device::readl(uint32_t offset) {
+    return (readb(offset+3) << 24) | (readb(offset+2) << 16) | (readb(offset+1) << 8) | readb(offset);
+}
+
+void Device::writeb(uint32_t offset, uint8_t v) {
+}
+
+void Device::writew(uint32_t offset, uint16_t v) {
+    writeb(offset, v & 0x000000FF);
+    writeb(offset+1, (v & 0x0000FF00) >> 8);
+}
+
+void Device::writel(uint32_t offset, uint32_t v) {
+    writeb(offset, v & 0x000000FF);
+    writeb(offset+1, (v & 0x0000FF00) >> 8);
+    writeb(offset+2, (v & 0x00FF0000) >> 16);
+    writeb(offset+3, (v & 0xFF000000) >> 24);
+}
+
+/**
+ * called when an event scheduled through the NorthBridge comes due
+ */
+void Device::event(int id) {
+}
+
+/**
+ * called on the first write to a page watched with NorthBridge::watchWrites()
+ */
+void Device::pageWritten(uint32_t addr) {
+}
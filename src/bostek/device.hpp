@@ -0,0 +1,38 @@
+#ifndef _BOSTEK_DEVICE_HPP
+#define _BOSTEK_DEVICE_HPP
+
+#include "cpplib/common/object.hpp"
+#include "northBridge.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Memory mapped peripheral
+ *
+ * Registers are addressed by offset from the base the device is attached
+ * at. Word and long accesses are split into byte accesses unless a device
+ * overrides them.
+ */
+class Device : public Object {
+    protected:
+    NorthBridge *nbr;
+
+    public:
+    Device();
+    virtual ~Device();
+    void setNorthBridge(NorthBridge *_nbr);
+
+    virtual uint32_t getSize() = 0;
+    virtual uint8_t readb(uint32_t offset);
+    virtual uint16_t readw(uint32_t offset);
+    virtual uint32_t readl(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+    virtual void writew(uint32_t offset, uint16_t v);
+    virtual void writel(uint32_t offset, uint32_t v);
+
+    virtual void event(int id);
+    virtual void pageWritten(uint32_t addr);
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "disassembler.hpp"
+
+#include "coverage.hpp"
+#include "opcodes.hpp"
+
+using namespace Bostek::Cpu;
+
+// appends to a fixed buffer, cutting off what does not fit
+struct Text {
+    char *start;
+    char *p;
+    char *end;
+
+    Text(char *out, int n) : start(out), p(out), end(out + n - 1) {}
+
+    void put(char c) {
+        if(p < end) *p++ = c;
+    }
+
+    void put(const char *s) {
+        while(*s) put(*s++);
+    }
+
+    void hex(uint32_t v) {
+        static const char digits[] = "0123456789ABCDEF";
+        int shift = 28;
+        while(shift > 0 && !(v >> shift)) shift -= 4;
+        for(; shift >= 0; shift -= 4) put(digits[(v >> shift) & 0x0F]);
+    }
+
+    void number(uint32_t v) {
+        put('$');
+        hex(v);
+    }
+
+    void reg(int r) {
+        if(register_names[r][0]) {
+            put(register_names[r]);
+        } else {
+            put('R');
+            hex(r);
+        }
+    }
+
+    int finish() {
+        *p = '\0';
+        return p - start;
+    }
+};
+
+// little endian; bytes past the end read as zero
+static uint32_t read(const uint8_t *p, uint32_t avail, int size) {
+    uint32_t v = 0;
+    for(int i = 0; i < size && i < avail; i++) v |= (uint32_t) p[i] << (8 * i);
+    return v;
+}
+
+// the nearest symbol at or below addr, plus the rest, or else the number
+static void put_address(Text &t, const std::map<uint32_t, String> &symbols, uint32_t addr) {
+    std::map<uint32_t, String>::const_iterator it = symbols.upper_bound(addr);
+    if(it == symbols.begin()) {
+        t.number(addr);
+        return;
+    }
+    it--;
+    String name = it->second;
+    t.put(name.c_str());
+    if(addr != it->first) {
+        t.put('+');
+        t.number(addr - it->first);
+    }
+}
+
+Disassembler::Disassembler() {
+}
+
+Disassembler::~Disassembler() {
+}
+
+/**
+ * adds the symbols of a map file with one "address name" pair per line,
+ * as basm -m writes
+ */
+bool Disassembler::loadSymbols(const char *filename) {
+    return ::loadSymbols(filename, &symbols);
+}
+
+void Disassembler::addSymbol(uint32_t addr, const char *name) {
+    symbols[addr] = String(name);
+}
+
+/**
+ * writes addr as "symbol+$offset", or as a number below every symbol.
+ * Returns the length written.
+ */
+int Disassembler::symbolize(uint32_t addr, char *out, int n) {
+    Text t(out, n);
+    put_address(t, symbols, addr);
+    return t.finish();
+}
+
+/**
+ * writes the instruction at addr, whose bytes start at code, as basm
+ * would read it, and returns its length. Bytes that are not a whole
+ * defined instruction come out as .DB, and count as no cycles.
+ */
+int Disassembler::decode(const uint8_t *code, uint32_t avail, uint32_t addr, char *out, int n, int *cycles) {
+    Text t(out, n);
+    if(cycles) *cycles = 0;
+    if(!avail) return t.finish();
+
+    uint8_t op = code[0];
+    uint8_t op2 = avail > 1 ? code[1] : 0;
+    const Opcode &o = opcode_table.op[op];
+    uint32_t len = opcode_length(op, op2);
+
+    if(!o.name[0] || o.unit == UNIT_NONE || len > avail) {
+        if(len > avail) len = avail;
+        t.put(".DB ");
+        for(int i = 0; i < len; i++) {
+            if(i) t.put(", ");
+            t.number(code[i]);
+        }
+        t.finish();
+        return len;
+    }
+
+    if(cycles) *cycles = o.cycles;
+    uint8_t type = o.type != TYPE_NONE ? o.type : (op2 >> 4) & 0x03;
+    t.put(o.name);
+    if(o.layout == LAYOUT_TR || o.layout == LAYOUT_T || o.layout == LAYOUT_TK) t.put(opcode_types[type]);
+
+    uint32_t target;
+    switch(o.layout) {
+        default:
+            break;
+        case LAYOUT_R:
+        case LAYOUT_TR:
+            t.put(' ');
+            t.reg(op2 & 0x0F);
+            break;
+        case LAYOUT_K8:
+            t.put(' ');
+            t.number(op2);
+            break;
+        case LAYOUT_RR:
+            t.put(' ');
+            t.reg(op2 & 0x0F);
+            t.put(' ');
+            t.reg(op2 >> 4);
+            break;
+        case LAYOUT_RK:
+            t.put(' ');
+            t.reg(op2 & 0x0F);
+            t.put(' ');
+            t.number(read(code + 2, avail - 2, type_size(type)));
+            break;
+        case LAYOUT_TK:
+            t.put(' ');
+            t.number(read(code + 2, avail - 2, type_size(type)));
+            break;
+        case LAYOUT_MEM:
+        case LAYOUT_AMEM:
+        case LAYOUT_LMEM:
+        case LAYOUT_ALMEM: {
+            bool far = o.layout == LAYOUT_LMEM || o.layout == LAYOUT_ALMEM;
+            target = read(code + 2, avail - 2, far ? 4 : 2);
+            if(o.layout == LAYOUT_MEM || o.layout == LAYOUT_LMEM) target += addr + len;
+            if(o.unit == UNIT_LOAD) {
+                t.put(' ');
+                t.reg(op2 & 0x0F);
+            }
+            t.put(' ');
+            put_address(t, symbols, target);
+            if((op2 >> 4) != REG_ZE) {
+                t.put('+');
+                t.reg(op2 >> 4);
+            }
+            if(o.unit == UNIT_STORE) {
+                t.put(' ');
+                t.reg(op2 & 0x0F);
+            }
+            break;
+        }
+        case LAYOUT_ABS16:
+        case LAYOUT_ABS32:
+            t.put(' ');
+            put_address(t, symbols, read(code + 1, avail - 1, o.layout == LAYOUT_ABS16 ? 2 : 4));
+            break;
+        case LAYOUT_REL16:
+            t.put(' ');
+            put_address(t, symbols, addr + len + (int16_t) read(code + 1, avail - 1, 2));
+            break;
+        case LAYOUT_REL32:
+            t.put(' ');
+            put_address(t, symbols, addr + len + read(code + 1, avail - 1, 4));
+            break;
+    }
+    t.finish();
+    return len;
+}
+
+static bool ends_block(uint8_t op) {
+    uint8_t unit = opcode_table.op[op].unit;
+    return unit == UNIT_JUMP || unit == UNIT_BRANCH || op == RET || op == RFI || op == HLT;
+}
+
+/**
+ * lists first up to last, from the image of the bytes at base, with the
+ * labels, encodings and cycles of each instruction. Blocks, which end at
+ * labels and transfers of control, are totalled. Runs of zeros are
+ * shortened to a .RES.
+ */
+void Disassembler::list(FILE *out, const uint8_t *image, uint32_t base, uint32_t size, uint32_t first,
+        uint32_t last) {
+    uint64_t addr = first < base ? base : first;
+    uint64_t end = (uint64_t) base + size;
+    if(last < end) end = last;
+
+    std::map<uint32_t, String>::const_iterator sym = symbols.lower_bound(addr);
+    int block = 0;
+    while(addr < end) {
+        const uint8_t *p = image + (addr - base);
+        if(sym != symbols.end() && sym->first == addr) {
+            String name = sym->second;
+            fprintf(out, "%s:\n", name.c_str());
+            block = 0;
+            sym++;
+        }
+
+        // stop short of the next symbol, so labels fall between instructions
+        uint32_t avail = end - addr;
+        if(sym != symbols.end() && sym->first - addr < avail) avail = sym->first - addr;
+
+        uint32_t zeros = 0;
+        while(zeros < avail && !p[zeros]) zeros++;
+        if(zeros >= DISASM_ZERO_RUN) {
+            fprintf(out, "%08X  %-17s  .RES $%X\n", (uint32_t) addr, "", zeros);
+            addr += zeros;
+            block = 0;
+            continue;
+        }
+
+        char text[DISASM_TEXT_MAX];
+        int cycles;
+        int len = decode(p, avail, addr, text, sizeof(text), &cycles);
+
+        char bytes[18];
+        Text b(bytes, sizeof(bytes));
+        for(int i = 0; i < len && i < 6; i++) {
+            static const char digits[] = "0123456789ABCDEF";
+            if(i) b.put(' ');
+            b.put(digits[p[i] >> 4]);
+            b.put(digits[p[i] & 0x0F]);
+        }
+        b.finish();
+
+        if(!cycles) {
+            fprintf(out, "%08X  %-17s  %s\n", (uint32_t) addr, bytes, text);
+        } else if(ends_block(*p)) {
+            fprintf(out, "%08X  %-17s  %-28s ; %d, %d in block\n", (uint32_t) addr, bytes, text, cycles,
+                    block + cycles);
+            block = 0;
+        } else {
+            fprintf(out, "%08X  %-17s  %-28s ; %d\n", (uint32_t) addr, bytes, text, cycles);
+            block += cycles;
+        }
+        addr += len;
+    }
+}
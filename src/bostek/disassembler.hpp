@@ -0,0 +1,37 @@
+#ifndef _BOSTEK_DISASSEMBLER_HPP
+#define _BOSTEK_DISASSEMBLER_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/string.hpp"
+
+#define DISASM_TEXT_MAX 64 // longest instruction text, with its nul
+#define DISASM_ZERO_RUN 16 // zero bytes listed as one .RES
+
+/**
+ * Turns machine code back into basm source with the opcode table the cpu
+ * decodes by. Targets of jumps, branches and memory operands are named
+ * by the nearest symbol, when there are any.
+ *
+ * Decoding allocates nothing, so whole images, or every address of a
+ * long trace, go quickly.
+ */
+class Disassembler : public Object {
+    std::map<uint32_t, String> symbols;
+
+    public:
+    Disassembler();
+    virtual ~Disassembler();
+
+    bool loadSymbols(const char *filename);
+    void addSymbol(uint32_t addr, const char *name);
+
+    int symbolize(uint32_t addr, char *out, int n);
+    int decode(const uint8_t *code, uint32_t avail, uint32_t addr, char *out, int n, int *cycles = NULL);
+    void list(FILE *out, const uint8_t *image, uint32_t base, uint32_t size, uint32_t first, uint32_t last);
+};
+
+#endif
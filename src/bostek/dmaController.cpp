@@ -0,0 +1,60 @@
+#include "dmaController.hpp"
+
+#include <string.h>
+
+#include "memory.hpp"
+
+DmaController::DmaController() {
+    memset(regs, 0, sizeof(regs));
+}
+
+DmaController::~DmaController() {
+}
+
+uint32_t DmaController::reg(int r) {
+    return (regs[r+3] << 24) | (regs[r+2] << 16) | (regs[r+1] << 8) | regs[r];
+}
+
+uint32_t DmaController::getSize() {
+    return DMA_SIZE;
+}
+
+uint8_t DmaController::readb(uint32_t offset) {
+    if(offset >= DMA_SIZE) return 0x00;
+    return regs[offset];
+}
+
+void DmaController::writeb(uint32_t offset, uint8_t v) {
+    switch(offset) {
+        case DMA_CTRL:
+            // the mode and irq are read at completion too, so they are held as well
+            if(regs[DMA_STATUS] & DMA_STATUS_BUSY) break;
+            regs[DMA_CTRL] = v & ~DMA_CTRL_START;
+            if(v & DMA_CTRL_START) {
+                regs[DMA_STATUS] = DMA_STATUS_BUSY;
+                nbr->schedule(DMA_SETUP_CLKS + (reg(DMA_LEN) + DMA_BYTES_PER_CLK - 1) / DMA_BYTES_PER_CLK, this, 0);
+            }
+            break;
+        case DMA_STATUS:
+            regs[DMA_STATUS] &= ~(v & DMA_STATUS_DONE);
+            break;
+        default:
+            // the transfer registers are latched at completion; hold them while busy
+            if(offset < DMA_SIZE && !(regs[DMA_STATUS] & DMA_STATUS_BUSY)) regs[offset] = v;
+            break;
+    }
+}
+
+void DmaController::event(int id) {
+    Memory *mem = nbr->getMemory();
+    if(mem) {
+        if((regs[DMA_CTRL] & DMA_CTRL_MODE) == DMA_MODE_FILL) {
+            mem->set(reg(DMA_DST), regs[DMA_SRC], reg(DMA_LEN));
+        } else {
+            mem->move(reg(DMA_DST), reg(DMA_SRC), reg(DMA_LEN));
+        }
+    }
+
+    regs[DMA_STATUS] = DMA_STATUS_DONE;
+    if(regs[DMA_CTRL] & DMA_CTRL_IRQ) nbr->raiseIrq(regs[DMA_IVEC]);
+}
@@ -0,0 +1,54 @@
+#ifndef _BOSTEK_DMA_CONTROLLER_HPP
+#define _BOSTEK_DMA_CONTROLLER_HPP
+
+#include "device.hpp"
+
+enum DmaRegister {
+    DMA_SRC=0x00, // long; source address, or fill byte in DMA_MODE_FILL
+    DMA_DST=0x04, // long
+    DMA_LEN=0x08, // long; bytes
+    DMA_CTRL=0x0C,
+    DMA_STATUS=0x0D,
+    DMA_IVEC=0x0E,
+    DMA_SIZE=0x10,
+};
+
+enum DmaCtrl {
+    DMA_CTRL_START=0x01,
+    DMA_CTRL_IRQ=0x02, // raise DMA_IVEC when done
+    DMA_CTRL_MODE=0x30,
+    DMA_MODE_COPY=0x00,
+    DMA_MODE_FILL=0x10,
+};
+
+enum DmaStatus {
+    DMA_STATUS_BUSY=0x01,
+    DMA_STATUS_DONE=0x02, // write 1 to clear
+};
+
+#define DMA_SETUP_CLKS 4
+#define DMA_BYTES_PER_CLK 4
+
+/**
+ * Block copy/fill engine
+ *
+ * The transfer takes DMA_SETUP_CLKS plus LEN / DMA_BYTES_PER_CLK clks.
+ * It is done in one memmove on the host when the completion event fires,
+ * and lands directly in ram; it does not go through devices or traps.
+ */
+class DmaController : public Device {
+    uint8_t regs[DMA_SIZE];
+
+    uint32_t reg(int r);
+
+    public:
+    DmaController();
+    virtual ~DmaController();
+
+    virtual uint32_t getSize();
+    virtual uint8_t readb(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+    virtual void event(int id);
+};
+
+#endif
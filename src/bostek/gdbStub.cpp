@@ -0,0 +1,533 @@
+#include "gdbStub.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "bcpu.hpp"
+#include "debugger.hpp"
+#include "memory.hpp"
+#include "northBridge.hpp"
+#include "cpplib/common/exception.hpp"
+
+#define RUN_CHUNK 0x100000 // clks between polls for a break request
+#define NREGS 11
+#define SIGINT_GDB 2
+#define SIGTRAP_GDB 5
+
+using namespace Bostek::Cpu;
+
+static const char *target_xml =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.bostek.bcpu\">"
+    "<reg name=\"a\" bitsize=\"32\" type=\"uint32\"/>"
+    "<reg name=\"b\" bitsize=\"32\" type=\"uint32\"/>"
+    "<reg name=\"c\" bitsize=\"32\" type=\"uint32\"/>"
+    "<reg name=\"d\" bitsize=\"32\" type=\"uint32\"/>"
+    "<reg name=\"fa\" bitsize=\"32\" type=\"ieee_single\"/>"
+    "<reg name=\"fb\" bitsize=\"32\" type=\"ieee_single\"/>"
+    "<reg name=\"fc\" bitsize=\"32\" type=\"ieee_single\"/>"
+    "<reg name=\"fd\" bitsize=\"32\" type=\"ieee_single\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"sb\" bitsize=\"8\" type=\"uint8\"/>"
+    "</feature>"
+    "</target>";
+
+static const char hexchars[] = "0123456789abcdef";
+
+static int hex_digit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void append_hex(std::string &s, const uint8_t *p, int n) {
+    for(int i = 0; i < n; i++) {
+        s += hexchars[p[i] >> 4];
+        s += hexchars[p[i] & 0x0F];
+    }
+}
+
+static bool parse_hex_bytes(const char *hex, uint8_t *dst, int n) {
+    for(int i = 0; i < n; i++) {
+        int hi = hex_digit(hex[i*2]);
+        int lo = hi < 0 ? -1 : hex_digit(hex[i*2+1]);
+        if(lo < 0) return false;
+        dst[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+// reads a hex number, leaving *p after it
+static uint32_t parse_hex(const char **p) {
+    uint32_t v = 0;
+    int d;
+    while((d = hex_digit(**p)) >= 0) {
+        v = (v << 4) | d;
+        (*p)++;
+    }
+    return v;
+}
+
+GdbStub::GdbStub(Debugger *_dbg, BCpu *_cpu) : dbg(_dbg), cpu(_cpu), listenfd(-1), fd(-1), noack(false), killed(false),
+        inpos(0), inlen(0) {
+    mem = dbg->getNorthBridge()->getMemory();
+}
+
+GdbStub::~GdbStub() {
+    disconnect();
+    if(listenfd >= 0) close(listenfd);
+    if(!unixpath.empty()) unlink(unixpath.c_str());
+}
+
+void GdbStub::listenTcp(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int one = 1;
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenfd < 0) throw Exception("gdb stub: unable to create socket");
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(listenfd, (struct sockaddr*) &addr, sizeof(addr)) || listen(listenfd, 1)) {
+        throw Exception(String("gdb stub: unable to listen on port ") + String::fromInt(port));
+    }
+}
+
+void GdbStub::listenUnix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) throw Exception("gdb stub: socket path too long");
+    strcpy(addr.sun_path, path);
+
+    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenfd < 0) throw Exception("gdb stub: unable to create socket");
+    unlink(path);
+    if(bind(listenfd, (struct sockaddr*) &addr, sizeof(addr)) || listen(listenfd, 1)) {
+        throw Exception(String("gdb stub: unable to listen on ") + String(path));
+    }
+    unixpath = path;
+}
+
+void GdbStub::disconnect() {
+    if(fd >= 0) close(fd);
+    fd = -1;
+    noack = false;
+    inpos = inlen = 0;
+}
+
+/**
+ * next byte from the client; -1 if nothing is waiting and block is
+ * false, -2 if the client has gone away.
+ */
+int GdbStub::getc(bool block) {
+    if(inpos == inlen) {
+        if(!block) {
+            struct pollfd p;
+            p.fd = fd;
+            p.events = POLLIN;
+            if(poll(&p, 1, 0) <= 0) return -1;
+        }
+        inlen = recv(fd, inbuf, sizeof(inbuf), 0);
+        inpos = 0;
+        if(inlen <= 0) {
+            inlen = 0;
+            return -2;
+        }
+    }
+    return (uint8_t) inbuf[inpos++];
+}
+
+/**
+ * writes all of data to the client. If it has gone, the socket is shut
+ * down, so every later read sees the detach, and false is returned.
+ */
+bool GdbStub::put(const char *data, size_t len) {
+    while(len) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n < 0) {
+            shutdown(fd, SHUT_RDWR);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool GdbStub::readPacket(std::string &pkt) {
+    int c;
+    for(;;) {
+        // skip acks and anything else outside a packet
+        do {
+            c = getc(true);
+            if(c < 0) return false;
+        } while(c != '$' && c != 0x03);
+
+        if(c == 0x03) {
+            pkt = "\x03";
+            return true;
+        }
+
+        pkt.clear();
+        uint8_t sum = 0;
+        while((c = getc(true)) != '#') {
+            if(c < 0) return false;
+            pkt += (char) c;
+            sum += c;
+        }
+
+        int hi = getc(true);
+        int lo = getc(true);
+        if(lo < 0) return false;
+
+        if(noack) return true;
+        if(hex_digit(hi) >= 0 && hex_digit(lo) >= 0 && ((hex_digit(hi) << 4) | hex_digit(lo)) == sum) {
+            return put("+", 1);
+        }
+        if(!put("-", 1)) return false;
+    }
+}
+
+void GdbStub::sendPacket(const std::string &pkt) {
+    std::string out;
+    uint8_t sum = 0;
+    out.reserve(pkt.size() + 4);
+    out += '$';
+    for(size_t i = 0; i < pkt.size(); i++) {
+        char c = pkt[i];
+        if(c == '$' || c == '#' || c == '}' || c == '*') {
+            out += '}';
+            sum += '}';
+            c ^= 0x20;
+        }
+        out += c;
+        sum += c;
+    }
+    out += '#';
+    out += hexchars[sum >> 4];
+    out += hexchars[sum & 0x0F];
+
+    // with acks on, resend until the client accepts it
+    int c = '-';
+    while(c == '-') {
+        if(!put(out.data(), out.size()) || noack) break;
+        do {
+            c = getc(true);
+        } while(c >= 0 && c != '+' && c != '-');
+    }
+}
+
+/**
+ * T with the reason for breakpoints and watchpoints, or a plain S for
+ * anything else
+ */
+std::string GdbStub::stopReply(int signal) {
+    std::string reply = "T";
+    uint8_t sig = signal;
+    append_hex(reply, &sig, 1);
+    if(signal != SIGTRAP_GDB) {
+        reply[0] = 'S';
+        return reply;
+    }
+
+    switch(dbg->getStopReason()) {
+        case STOP_WATCH_READ:
+            reply += "rwatch:";
+            break;
+        case STOP_WATCH_WRITE:
+            reply += "watch:";
+            break;
+        case STOP_BREAKPOINT:
+            return reply + "hwbreak:;";
+        default:
+            reply[0] = 'S';
+            return reply;
+    }
+
+    char addr[16];
+    sprintf(addr, "%x;", dbg->getStopAddress());
+    return reply + addr;
+}
+
+std::string GdbStub::readRegister(int reg) {
+    std::string s;
+    uint32_t v;
+    if(reg < 0 || reg >= NREGS) {
+        return "E01";
+    } else if(reg < 4) {
+        v = cpu->state.registers[reg];
+    } else if(reg < 8) {
+        memcpy(&v, &cpu->state.fregisters[reg - 4], 4);
+    } else if(reg == 8) {
+        v = cpu->state.pc;
+    } else if(reg == 9) {
+        v = cpu->state.sp;
+    } else if(reg == 10) {
+        append_hex(s, &cpu->state.sb, 1);
+        return s;
+    }
+
+    uint8_t b[4] = { (uint8_t) v, (uint8_t) (v >> 8), (uint8_t) (v >> 16), (uint8_t) (v >> 24) };
+    append_hex(s, b, 4);
+    return s;
+}
+
+bool GdbStub::writeRegister(int reg, const char *hex) {
+    uint8_t b[4];
+    if(reg < 0 || reg >= NREGS) return false;
+    if(reg == 10) {
+        return parse_hex_bytes(hex, &cpu->state.sb, 1);
+    }
+
+    if(!parse_hex_bytes(hex, b, 4)) return false;
+    uint32_t v = b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
+    if(reg < 4) {
+        cpu->state.registers[reg] = v;
+    } else if(reg < 8) {
+        memcpy(&cpu->state.fregisters[reg - 4], &v, 4);
+    } else if(reg == 8) {
+        cpu->state.pc = v;
+    } else {
+        cpu->state.sp = v;
+    }
+    return true;
+}
+
+std::string GdbStub::readRegisters() {
+    std::string s;
+    for(int i = 0; i < NREGS; i++) {
+        s += readRegister(i);
+    }
+    return s;
+}
+
+bool GdbStub::writeRegisters(const char *hex) {
+    if(strlen(hex) < (NREGS - 1) * 8 + 2) return false;
+    for(int i = 0; i < NREGS; i++) {
+        if(!writeRegister(i, hex + i * 8)) return false;
+    }
+    return true;
+}
+
+std::string GdbStub::readMemory(uint32_t addr, uint32_t len) {
+    uint8_t buf[2048];
+    if(len > sizeof(buf)) len = sizeof(buf);
+
+    // reads past the end of memory come back short
+    size_t n = mem ? mem->dump(addr, len, buf) : 0;
+    if(!n && len) return "E01";
+
+    std::string s;
+    append_hex(s, buf, n);
+    return s;
+}
+
+bool GdbStub::writeMemory(uint32_t addr, uint32_t len, const char *hex) {
+    uint8_t buf[2048];
+    if(!mem || len > sizeof(buf) || strlen(hex) < len * 2) return false;
+    if(!parse_hex_bytes(hex, buf, len)) return false;
+    mem->fill(addr, len, buf);
+    return true;
+}
+
+// Z/z packets: type,addr,kind
+std::string GdbStub::breakpoint(const std::string &pkt, bool insert) {
+    const char *p = pkt.c_str() + 1;
+    int type = parse_hex(&p);
+    if(*p++ != ',') return "E01";
+    uint32_t addr = parse_hex(&p);
+    if(*p++ != ',') return "E01";
+    uint32_t len = parse_hex(&p);
+    if(!len) len = 1;
+
+    int kind;
+    switch(type) {
+        case 0: // sw and hw breakpoints are the same thing here
+        case 1:
+            if(insert) dbg->addBreakpoint(addr);
+            else dbg->removeBreakpoint(addr);
+            return "OK";
+        case 2:
+            kind = WATCH_WRITE;
+            break;
+        case 3:
+            kind = WATCH_READ;
+            break;
+        case 4:
+            kind = WATCH_ACCESS;
+            break;
+        default:
+            return "";
+    }
+
+    if(insert) dbg->addWatchpoint(addr, len, kind);
+    else dbg->removeWatchpoint(addr, len, kind);
+    return "OK";
+}
+
+std::string GdbStub::resume(bool step) {
+    if(step) {
+        dbg->step();
+        return stopReply(SIGTRAP_GDB);
+    }
+
+    for(;;) {
+        uint64_t ran = dbg->run(RUN_CHUNK);
+        if(dbg->getStopReason() != STOP_NONE || ran < RUN_CHUNK) {
+            return stopReply(SIGTRAP_GDB);
+        }
+
+        int c = getc(false);
+        if(c == 0x03) return stopReply(SIGINT_GDB);
+        if(c == -2) return ""; // client went away
+    }
+}
+
+std::string GdbStub::query(const std::string &pkt) {
+    if(!pkt.compare(0, 10, "qSupported")) {
+        return "PacketSize=1000;qXfer:features:read+;QStartNoAckMode+;hwbreak+";
+    } else if(pkt == "QStartNoAckMode") {
+        sendPacket("OK");
+        noack = true;
+        return "";
+    } else if(pkt == "qAttached") {
+        return "1";
+    } else if(pkt == "qC") {
+        return "QC1";
+    } else if(pkt == "qfThreadInfo") {
+        return "m1";
+    } else if(pkt == "qsThreadInfo") {
+        return "l";
+    } else if(!pkt.compare(0, 31, "qXfer:features:read:target.xml:")) {
+        const char *p = pkt.c_str() + 31;
+        uint32_t off = parse_hex(&p);
+        p++;
+        uint32_t len = parse_hex(&p);
+        uint32_t total = strlen(target_xml);
+        if(off >= total) return "l";
+        if(len > total - off) return std::string("l") + (target_xml + off);
+        return std::string("m") + std::string(target_xml + off, len);
+    }
+    return "";
+}
+
+/**
+ * handles one packet. returns false once the client is done with us.
+ */
+bool GdbStub::handle(const std::string &pkt) {
+    const char *p = pkt.c_str() + 1;
+    uint32_t addr, len;
+    std::string reply;
+
+    switch(pkt[0]) {
+        case '?':
+            reply = stopReply(SIGTRAP_GDB);
+            break;
+        case 'g':
+            reply = readRegisters();
+            break;
+        case 'G':
+            reply = writeRegisters(p) ? "OK" : "E01";
+            break;
+        case 'p':
+            reply = readRegister(parse_hex(&p));
+            break;
+        case 'P':
+            addr = parse_hex(&p);
+            reply = (*p == '=' && writeRegister(addr, p + 1)) ? "OK" : "E01";
+            break;
+        case 'm':
+            addr = parse_hex(&p);
+            if(*p++ != ',') {
+                reply = "E01";
+                break;
+            }
+            reply = readMemory(addr, parse_hex(&p));
+            break;
+        case 'M':
+            addr = parse_hex(&p);
+            if(*p++ != ',') {
+                reply = "E01";
+                break;
+            }
+            len = parse_hex(&p);
+            reply = (*p == ':' && writeMemory(addr, len, p + 1)) ? "OK" : "E01";
+            break;
+        case 'c':
+        case 's':
+            if(*p) cpu->state.pc = parse_hex(&p);
+            reply = resume(pkt[0] == 's');
+            if(reply.empty()) return false;
+            break;
+        case 'Z':
+        case 'z':
+            reply = breakpoint(pkt, pkt[0] == 'Z');
+            break;
+        case 'H':
+            reply = "OK";
+            break;
+        case 'q':
+        case 'Q':
+            reply = query(pkt);
+            if(noack && pkt == "QStartNoAckMode") return true;
+            break;
+        case 'D':
+            sendPacket("OK");
+            return false;
+        case 'k':
+            killed = true;
+            return false;
+        case 0x03:
+            reply = stopReply(SIGINT_GDB);
+            break;
+        default:
+            break; // empty reply: unsupported
+    }
+
+    sendPacket(reply);
+    return true;
+}
+
+/**
+ * waits for a client and serves it until it detaches or disconnects
+ */
+void GdbStub::serve() {
+    int client = accept(listenfd, NULL, NULL);
+    if(client < 0) throw Exception("gdb stub: accept failed");
+
+    int one = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    serveClient(client);
+}
+
+/**
+ * serves a client that is already connected, such as one end of a
+ * socketpair, until it detaches or disconnects; the socket is closed
+ * after
+ */
+void GdbStub::serveClient(int client) {
+    disconnect();
+    fd = client;
+    killed = false;
+
+    std::string pkt;
+    while(readPacket(pkt)) {
+        if(!handle(pkt)) break;
+    }
+    disconnect();
+}
@@ -0,0 +1,74 @@
+#ifndef _BOSTEK_GDB_STUB_HPP
+#define _BOSTEK_GDB_STUB_HPP
+
+#include <stdint.h>
+#include <string>
+
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/string.hpp"
+
+class Debugger;
+class Memory;
+
+namespace Bostek {
+namespace Cpu {
+class BCpu;
+}
+}
+
+/**
+ * GDB remote serial protocol server for a BCpu
+ *
+ * Listens on a localhost TCP port or a unix socket and serves one client
+ * at a time. Continue runs the debugger in large chunks and only polls the
+ * socket for a break request between chunks. A client that goes away, even
+ * in the middle of a reply, is a detach.
+ *
+ * Register numbers: 0-3 A-D, 4-7 float A-D, 8 PC, 9 SP, 10 SB.
+ * The layout is also served as target.xml.
+ */
+class GdbStub : public Object {
+    Debugger *dbg;
+    Bostek::Cpu::BCpu *cpu;
+    Memory *mem;
+
+    int listenfd;
+    int fd;
+    String unixpath;
+    bool noack;
+    bool killed;
+
+    char inbuf[4096];
+    int inpos;
+    int inlen;
+
+    int getc(bool block);
+    bool put(const char *data, size_t len);
+    bool readPacket(std::string &pkt);
+    void sendPacket(const std::string &pkt);
+
+    std::string stopReply(int signal);
+    std::string readRegister(int reg);
+    bool writeRegister(int reg, const char *hex);
+    std::string readRegisters();
+    bool writeRegisters(const char *hex);
+    std::string readMemory(uint32_t addr, uint32_t len);
+    bool writeMemory(uint32_t addr, uint32_t len, const char *hex);
+    std::string breakpoint(const std::string &pkt, bool insert);
+    std::string resume(bool step);
+    std::string query(const std::string &pkt);
+    bool handle(const std::string &pkt);
+    void disconnect();
+
+    public:
+    GdbStub(Debugger *dbg, Bostek::Cpu::BCpu *cpu);
+    ~GdbStub();
+
+    void listenTcp(int port);
+    void listenUnix(const char *path);
+    void serve();
+    void serveClient(int client);
+    bool wasKilled() { return killed; }
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include "lexer.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+
+#include "cpplib/common/exception.hpp"
+
+SourceBuffer::SourceBuffer(const char *filename) : name(filename), data(NULL), size(0), mapped(false) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) throw Exception(String("unable to open ") + String(filename));
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw Exception(String("unable to stat ") + String(filename));
+    }
+
+    size = st.st_size;
+    if(size) {
+        void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p != MAP_FAILED) {
+            data = (char*) p;
+            mapped = true;
+            madvise(p, size, MADV_SEQUENTIAL);
+        } else { // pipes and the like
+            data = (char*) malloc(size);
+            if(pread(fd, data, size, 0) != (ssize_t) size) {
+                free(data);
+                close(fd);
+                throw Exception(String("unable to read ") + String(filename));
+            }
+        }
+    }
+    close(fd);
+}
+
+SourceBuffer::SourceBuffer(const char *_name, const char *text, size_t len) : name(_name), size(len), mapped(false) {
+    data = (char*) malloc(len ? len : 1);
+    memcpy(data, text, len);
+}
+
+SourceBuffer::~SourceBuffer() {
+    if(mapped) {
+        munmap(data, size);
+    } else {
+        free(data);
+    }
+}
+
+bool Token::equals(const char *s) const {
+    return !strncmp(text, s, len) && s[len] == '\0';
+}
+
+String Token::toString() const {
+    if(type == TOKEN_EOF) return "end of file";
+    if(type == TOKEN_NEWLINE) return "end of line";
+    std::string s(text, len);
+    return String(s.c_str());
+}
+
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline bool is_ident_start(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+}
+
+static inline bool is_ident(char c) {
+    return is_ident_start(c) || is_digit(c);
+}
+
+static inline int digit_value(char c) {
+    if(is_digit(c)) return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 99;
+}
+
+Lexer::Lexer(SourceBuffer *_source, int _file) : source(_source), line(1), file(_file), peeked(false) {
+    source->retain();
+    p = source->begin();
+    end = source->end();
+}
+
+Lexer::~Lexer() {
+    source->release();
+}
+
+void Lexer::error(const char *msg) const {
+    throw Exception(String(source->getName()) + ":" + String::fromInt(line) + ": " + String(msg));
+}
+
+void Lexer::error(const Token &t, const char *msg) const {
+    throw Exception(String(source->getName()) + ":" + String::fromInt(t.line) + ": " + String(msg));
+}
+
+Token Lexer::next() {
+    if(peeked) {
+        peeked = false;
+        return lookahead;
+    }
+    return scan();
+}
+
+const Token &Lexer::peek() {
+    if(!peeked) {
+        lookahead = scan();
+        peeked = true;
+    }
+    return lookahead;
+}
+
+// p is on the first digit; start includes any prefix
+Token Lexer::scanNumber(const char *start, int base) {
+    Token t;
+    t.type = TOKEN_NUMBER;
+    t.line = line;
+    t.file = file;
+
+    const char *digits = p;
+    uint64_t v = 0;
+    while(p < end && digit_value(*p) < base) {
+        v = v * base + digit_value(*p++);
+        if(v > 0xFFFFFFFFULL) error("value too large");
+    }
+    if(p == digits || (p < end && is_ident(*p))) {
+        error(base == 16 ? "invalid hex value" : "invalid decimal value");
+    }
+
+    t.text = start;
+    t.len = p - start;
+    t.value = v;
+    return t;
+}
+
+Token Lexer::scan() {
+    // blanks and comments; newlines are tokens
+    while(p < end) {
+        char c = *p;
+        if(c == ' ' || c == '\t' || c == '\r') {
+            p++;
+        } else if(c == ';') {
+            while(p < end && *p != '\n') p++;
+        } else {
+            break;
+        }
+    }
+
+    Token t;
+    t.line = line;
+    t.file = file;
+    t.text = p;
+    t.len = 1;
+    t.value = 0;
+
+    if(p == end) {
+        t.type = TOKEN_EOF;
+        t.len = 0;
+        return t;
+    }
+
+    const char *start = p;
+    char c = *p++;
+    if(c == '\n') {
+        t.type = TOKEN_NEWLINE;
+        line++;
+    } else if(is_ident_start(c)) {
+        while(p < end && is_ident(*p)) p++;
+        t.type = TOKEN_IDENTIFIER;
+        t.len = p - start;
+    } else if(c == '.' && p < end && is_ident_start(*p)) {
+        t.text = p;
+        while(p < end && is_ident(*p)) p++;
+        t.type = TOKEN_DIRECTIVE;
+        t.len = p - t.text;
+    } else if(c == '$') {
+        return scanNumber(start, 16);
+    } else if(c == '#') {
+        return scanNumber(start, 10);
+    } else if(c == '0' && p < end && (*p == 'x' || *p == 'X')) {
+        p++;
+        return scanNumber(start, 16);
+    } else if(is_digit(c)) {
+        p--;
+        return scanNumber(start, 10);
+    } else if(c == '\'') {
+        if(end - p < 2 || p[1] != '\'') error("invalid character constant");
+        t.type = TOKEN_NUMBER;
+        t.value = (uint8_t) p[0];
+        p += 2;
+        t.len = 3;
+    } else if(c == '"') {
+        t.text = p;
+        while(p < end && *p != '"' && *p != '\n') p++;
+        if(p == end || *p != '"') error("unterminated string");
+        t.type = TOKEN_STRING;
+        t.len = p - t.text;
+        p++;
+    } else {
+        t.type = TOKEN_PUNCT;
+    }
+    return t;
+}
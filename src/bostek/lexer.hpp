@@ -0,0 +1,90 @@
+#ifndef _BOSTEK_LEXER_HPP
+#define _BOSTEK_LEXER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/string.hpp"
+
+/**
+ * A whole assembly source in one contiguous buffer. Files are mapped
+ * rather than read where possible. Tokens point into the buffer, so it
+ * has to outlive them.
+ */
+class SourceBuffer : public Object {
+    String name;
+    char *data;
+    size_t size;
+    bool mapped;
+
+    public:
+    SourceBuffer(const char *filename);
+    SourceBuffer(const char *name, const char *text, size_t len); // copies text
+    virtual ~SourceBuffer();
+
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+    size_t getSize() const { return size; }
+    const String &getName() const { return name; }
+};
+
+enum TokenType {
+    TOKEN_EOF,
+    TOKEN_NEWLINE,
+    TOKEN_IDENTIFIER,
+    TOKEN_NUMBER,
+    TOKEN_DIRECTIVE, // .NAME; the text is NAME
+    TOKEN_STRING, // the text is between the quotes
+    TOKEN_PUNCT, // any other single character
+};
+
+/**
+ * Span of the source buffer, plus the value of a number
+ */
+struct Token {
+    TokenType type;
+    const char *text;
+    int len;
+    uint32_t value;
+    int line;
+    int file; // numbered by whoever made the lexer
+
+    bool is(char c) const { return type == TOKEN_PUNCT && text[0] == c; }
+    bool equals(const char *s) const;
+    String toString() const;
+};
+
+/**
+ * Hand written scanner over a SourceBuffer. Comments run from ';' to the
+ * end of the line. Numbers are decimal (optionally prefixed with '#'),
+ * hex with '$' or "0x", or a quoted character.
+ *
+ * Errors throw an Exception naming the file and line.
+ */
+class Lexer {
+    SourceBuffer *source;
+    const char *p;
+    const char *end;
+    int line;
+    int file;
+
+    Token lookahead;
+    bool peeked;
+
+    Token scan();
+    Token scanNumber(const char *start, int base);
+
+    public:
+    Lexer(SourceBuffer *source, int file = 0);
+    ~Lexer();
+
+    Token next();
+    const Token &peek();
+    int getLine() const { return line; }
+    const String &getName() const { return source->getName(); }
+    void error(const char *msg) const;
+    void error(const Token &t, const char *msg) const;
+};
+
+#endif
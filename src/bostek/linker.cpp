@@ -0,0 +1,232 @@
+#include "linker.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+#include "assembler.hpp"
+#include "bcpu.hpp"
+#include "cpplib/common/exception.hpp"
+
+using namespace Bostek::Cpu;
+
+struct Placement {
+    uint32_t addr;
+    uint32_t size;
+    int object;
+
+    bool operator<(const Placement &o) const { return addr < o.addr; }
+};
+
+static const int field_size[] = { 1, 2, 4, 2, 4, 2 }; // by RelocationKind
+
+static void write_constant(uint8_t *out, int size, uint32_t v) {
+    for(int i = 0; i < size; i++) {
+        out[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+Linker::Linker() : end_addr(ASM_ORIGIN), linked(false) {
+}
+
+Linker::~Linker() {
+}
+
+void Linker::error(int object, const String &msg) {
+    throw Exception(String(objects[object]->name) + ": " + msg);
+}
+
+void Linker::error(int object, const Relocation &r, const String &msg) {
+    if(r.file < 0) error(object, msg);
+    throw Exception(String(objects[object]->files[r.file]) + ":" + String::fromInt(r.line) + ": " + msg);
+}
+
+/**
+ * objects are laid out in the order they are added
+ */
+void Linker::add(ObjectFile *obj) {
+    if(linked) throw Exception("linker already finished");
+    objects.push_back(Ref<ObjectFile>::share(obj));
+}
+
+void Linker::layout() {
+    std::vector<Placement> placed;
+    uint64_t pc = ASM_ORIGIN;
+    bases.resize(objects.size());
+    for(int o = 0; o < objects.size(); o++) {
+        const std::vector<ObjectSection> &sections = objects[o]->sections;
+        for(int k = 0; k < sections.size(); k++) {
+            if(sections[k].absolute) pc = sections[k].origin;
+            else pc = (pc + sections[k].align - 1) & ~(uint64_t) (sections[k].align - 1);
+            bases[o].push_back(pc);
+
+            Placement p = { (uint32_t) pc, (uint32_t) sections[k].data.size(), o };
+            pc += sections[k].data.size();
+            if(pc > 0x100000000ULL) error(o, "past the end of the address space");
+            if(p.size) placed.push_back(p);
+        }
+    }
+    end_addr = pc;
+
+    std::stable_sort(placed.begin(), placed.end());
+    for(int i = 1; i < placed.size(); i++) {
+        if(placed[i - 1].addr + (uint64_t) placed[i - 1].size > placed[i].addr) {
+            error(placed[i].object, String("overlaps ") + objects[placed[i - 1].object]->name);
+        }
+    }
+}
+
+// gives every label its address, and checks everything used is defined
+void Linker::resolve() {
+    globals_of.resize(objects.size());
+    for(int o = 0; o < objects.size(); o++) {
+        std::vector<ObjectSymbol> &symbols = objects[o]->symbols;
+        for(int i = 0; i < symbols.size(); i++) {
+            ObjectSymbol &s = symbols[i];
+            int g = names.intern(s.name.c_str(), s.name.length());
+            if(g == globals.size()) {
+                Global n = { -1, 0 };
+                globals.push_back(n);
+            }
+            globals_of[o].push_back(g);
+
+            if(s.section < 0) continue;
+            if(globals[g].object >= 0) {
+                error(o, String("symbol ") + s.name + " already defined in " + objects[globals[g].object]->name);
+            }
+            globals[g].object = o;
+            globals[g].addr = bases[o][s.section] + s.value;
+        }
+    }
+
+    for(int o = 0; o < objects.size(); o++) {
+        for(int i = 0; i < globals_of[o].size(); i++) {
+            if(globals[globals_of[o][i]].object < 0) {
+                error(o, String("unknown symbol ") + objects[o]->symbols[i].name);
+            }
+        }
+    }
+}
+
+/**
+ * places everything and resolves the labels; write() calls this itself
+ */
+void Linker::link() {
+    if(linked) return;
+    layout();
+    resolve();
+    linked = true;
+}
+
+void Linker::apply(int object, const Relocation &r, SparseImage *image) {
+    const ObjectSection &s = objects[object]->sections[r.section];
+    if(r.offset + (uint64_t) field_size[r.kind] > s.data.size() || (r.kind == RELOC_MEM && r.offset < 2)) {
+        error(object, "corrupt relocation");
+    }
+
+    uint32_t place = bases[object][r.section] + r.offset;
+    uint32_t v = r.addend;
+    if(r.symbol >= 0) v += globals[globals_of[object][r.symbol]].addr;
+    uint32_t before = r.kind == RELOC_MEM ? 2 : 0; // MEM changes the opcode too
+    uint8_t *out = image->at(place - before, field_size[r.kind] + before) + before;
+    uint32_t rel = v - (place + field_size[r.kind]);
+
+    switch(r.kind) {
+        case RELOC_ABS8:
+            if(v > 0xFF && v < 0xFFFFFF80) error(object, r, "constant too large");
+            write_constant(out, 1, v);
+            break;
+        case RELOC_ABS16:
+            if(v > 0xFFFF && v < 0xFFFF8000) error(object, r, "constant too large");
+            write_constant(out, 2, v);
+            break;
+        case RELOC_ABS32:
+            write_constant(out, 4, v);
+            break;
+        case RELOC_REL16:
+            if((int32_t) rel < -0x8000 || (int32_t) rel > 0x7FFF) error(object, r, "jump out of range");
+            write_constant(out, 2, rel);
+            break;
+        case RELOC_REL32:
+            write_constant(out, 4, rel);
+            break;
+        case RELOC_MEM:
+            // the same choice the assembler makes; the opcode is the relative form
+            if(v <= 0xFFFF) {
+                out[-2] += ALODB_RRK - LODB_RRK;
+                write_constant(out, 2, v);
+            } else if(rel <= 0xFFFF) {
+                write_constant(out, 2, rel);
+            } else {
+                error(object, r, "address out of range");
+            }
+            break;
+    }
+}
+
+/**
+ * copies every section into the image, and fills in the relocations
+ */
+void Linker::write(SparseImage *image) {
+    link();
+    for(int o = 0; o < objects.size(); o++) {
+        const std::vector<ObjectSection> &sections = objects[o]->sections;
+        for(int k = 0; k < sections.size(); k++) {
+            const std::vector<uint8_t> &data = sections[k].data;
+            if(data.empty()) continue;
+            if(bases[o][k] + (uint64_t) data.size() > 0x100000000ULL) error(o, "section past the end of the address space");
+            image->write(bases[o][k], &data[0], data.size());
+        }
+
+        const std::vector<Relocation> &relocations = objects[o]->relocations;
+        for(int i = 0; i < relocations.size(); i++) {
+            apply(o, relocations[i], image);
+        }
+    }
+}
+
+/**
+ * the same, into a flat image of the address space from 0
+ */
+void Linker::write(uint8_t *image, uint32_t size) {
+    link();
+    for(int o = 0; o < objects.size(); o++) {
+        const std::vector<ObjectSection> &sections = objects[o]->sections;
+        for(int k = 0; k < sections.size(); k++) {
+            if(bases[o][k] + (uint64_t) sections[k].data.size() > size) error(o, "address out of range of the image");
+        }
+    }
+
+    SparseImage sparse;
+    write(&sparse);
+    sparse.flatten(image, size);
+}
+
+bool Linker::lookup(const char *name, uint32_t *addr) {
+    link();
+    int g = names.find(name, strlen(name));
+    if(g < 0 || globals[g].object < 0) return false;
+    *addr = globals[g].addr;
+    return true;
+}
+
+uint32_t Linker::getEnd() {
+    link();
+    return end_addr;
+}
+
+/**
+ * writes "address name" for every label, in address order; the same
+ * format as Assembler::writeMap
+ */
+void Linker::writeMap(FILE *f) {
+    link();
+    std::vector<std::pair<uint32_t, int> > labels;
+    for(int g = 0; g < globals.size(); g++) {
+        if(globals[g].object >= 0) labels.push_back(std::make_pair(globals[g].addr, g));
+    }
+    std::stable_sort(labels.begin(), labels.end());
+    for(int i = 0; i < labels.size(); i++) {
+        fprintf(f, "%08x %s\n", labels[i].first, names.name(labels[i].second));
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef _BOSTEK_LINKER_HPP
+#define _BOSTEK_LINKER_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "objectFile.hpp"
+#include "sparseImage.hpp"
+#include "symbolTable.hpp"
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/ref.hpp"
+
+/**
+ * Places object files in the address space and fills in the fields
+ * that depend on where everything went.
+ *
+ * Relocatable sections are laid out in the order they were added,
+ * starting at ASM_ORIGIN; each goes where the previous section ended,
+ * rounded up to its alignment, so objects linked together land where
+ * they would have had they been assembled as one. Absolute sections
+ * stay at their origin.
+ *
+ * Errors throw an Exception naming the object, or the file and line of
+ * the instruction a relocation is for.
+ */
+class Linker : public Object {
+    struct Global {
+        int object; // defining it, or -1
+        uint32_t addr;
+    };
+
+    std::vector<Ref<ObjectFile> > objects;
+    std::vector<std::vector<uint32_t> > bases; // of each object's sections
+    std::vector<std::vector<int> > globals_of; // each object's symbols, as globals
+    std::vector<Global> globals;
+    SymbolTable names;
+    uint32_t end_addr;
+    bool linked;
+
+    void error(int object, const String &msg);
+    void error(int object, const Relocation &r, const String &msg);
+    void layout();
+    void resolve();
+    void apply(int object, const Relocation &r, SparseImage *image);
+
+    public:
+    Linker();
+    virtual ~Linker();
+
+    void add(ObjectFile *obj);
+    void link();
+
+    bool lookup(const char *name, uint32_t *addr);
+    uint32_t getEnd();
+
+    void write(SparseImage *image);
+    void write(uint8_t *image, uint32_t size);
+    void writeMap(FILE *f);
+};
+
+#endif
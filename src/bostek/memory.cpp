@@ -1,52 +1,408 @@
 #include "memory.hpp"
 
-Memory::Memory(int _size) {
-    size = _size;
-    ptr = new uint8_t[size];
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "cpplib/common/exception.hpp"
+
+#define HUGE_PAGE_SIZE 0x200000
+
+static uint64_t round_up(uint64_t v, uint64_t align) {
+    return (v + align - 1) & ~(align - 1);
+}
+
+static uint64_t hash_mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+}
+
+static uint64_t hash_bytes(const uint8_t *p, uint64_t n) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    uint64_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = hash_mix(h, w);
+    }
+    for(; i < n; i++) {
+        h = hash_mix(h, p[i]);
+    }
+    return h;
+}
+
+Memory::Memory(uint64_t _size, unsigned _flags) : size(_size), mapsize(0), ptr(NULL), flags(_flags), hugetlb(false) {
+    map();
+
+    npages = (size + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+    dirty = new uint64_t[(npages + 63) / 64];
+    pagehash = new uint64_t[npages];
+    zero();
+
+    handler = NULL;
+    traps = new uint8_t[MEMORY_MAP_PAGES];
+    memset(traps, 0, MEMORY_MAP_PAGES);
+    if(size < 0x100000000ULL) {
+        // a partial last page is flagged too; its slow path checks the size
+        uint64_t first = size >> MEMORY_PAGE_SHIFT;
+        memset(traps + first, PAGE_UNMAPPED, MEMORY_MAP_PAGES - first);
+    }
 }
 
 Memory::~Memory() {
-    delete[] ptr;
+    if(ptr) munmap(ptr, mapsize);
+    delete[] dirty;
+    delete[] pagehash;
+    delete[] traps;
 }
 
-void Memory::zero() {
-    for(int i = 0; i < size; i++) {
-        ptr[i] = '\0';
+void Memory::map() {
+    void *p = MAP_FAILED;
+
+    // explicit huge pages need a reserved pool. without MAP_NORESERVE the
+    // mapping fails up front (instead of SIGBUS on touch) if it is too small
+#ifdef MAP_HUGETLB
+    if((flags & MEMORY_HUGEPAGE) && size >= HUGE_PAGE_SIZE) {
+        mapsize = round_up(size, HUGE_PAGE_SIZE);
+        p = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugetlb = p != MAP_FAILED;
+    }
+#endif
+
+    if(p == MAP_FAILED) {
+        mapsize = round_up(size ? size : 1, sysconf(_SC_PAGESIZE));
+        p = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(p == MAP_FAILED) throw Exception("unable to map guest memory");
+
+#ifdef MADV_HUGEPAGE
+        if(flags & MEMORY_HUGEPAGE) madvise(p, mapsize, MADV_HUGEPAGE);
+#endif
     }
+
+    ptr = (uint8_t*) p;
+}
+
+uint64_t Memory::getSize() {
+    return size;
 }
 
-void Memory::fill(uint32_t addr, int n, void *ptr) {
-    for(int i = 0; i < n; i++) {
-        writeb(addr + i, ((uint8_t*)ptr)[i]);
+bool Memory::usesHugePages() {
+    return hugetlb;
+}
+
+/**
+ * binds (and migrates) the backing pages to a NUMA node.
+ * returns false if the system does not support it.
+ */
+bool Memory::bindNode(int node) {
+#ifdef __linux__
+    unsigned long mask[16];
+    if(node < 0 || node >= (int) (sizeof(mask) * 8)) return false;
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+    return syscall(SYS_mbind, ptr, mapsize, MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_MOVE) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * binds to the node of the calling thread. Should be called from the
+ * thread that runs the cpu using this memory.
+ */
+bool Memory::bindLocalNode() {
+#ifdef __linux__
+    unsigned cpu, node;
+    if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return false;
+    return bindNode(node);
+#else
+    return false;
+#endif
+}
+
+void Memory::markDirty(uint64_t addr, uint64_t n) {
+    if(!n) return;
+    for(uint64_t page = addr >> MEMORY_PAGE_SHIFT; page <= (addr + n - 1) >> MEMORY_PAGE_SHIFT; page++) {
+        dirty[page >> 6] |= 1ULL << (page & 63);
+    }
+}
+
+uint64_t Memory::hashPage(uint64_t page) {
+    uint64_t base = page << MEMORY_PAGE_SHIFT;
+    uint64_t n = MEMORY_PAGE_SIZE;
+    if(base + n > size) n = size - base;
+    return hash_bytes(ptr + base, n);
+}
+
+uint64_t Memory::getPageCount() {
+    return npages;
+}
+
+bool Memory::isPageDirty(uint64_t page) {
+    return dirty[page >> 6] & (1ULL << (page & 63));
+}
+
+uint64_t Memory::pageDigest(uint64_t page) {
+    if(isPageDirty(page)) {
+        pagehash[page] = hashPage(page);
+        dirty[page >> 6] &= ~(1ULL << (page & 63));
     }
+    return pagehash[page];
 }
 
+/**
+ * hash of the whole memory contents. Only pages written since the
+ * previous digest are rehashed.
+ */
+uint64_t Memory::digest() {
+    uint64_t h = hash_mix(0, size);
+    for(uint64_t i = 0; i < (npages + 63) / 64; i++) {
+        uint64_t bits = dirty[i];
+        while(bits) {
+            uint64_t page = i * 64 + __builtin_ctzll(bits);
+            pagehash[page] = hashPage(page);
+            bits &= bits - 1;
+        }
+        dirty[i] = 0;
+    }
+
+    for(uint64_t page = 0; page < npages; page++) {
+        h = hash_mix(h, pagehash[page]);
+    }
+    return h;
+}
+
+void Memory::setHandler(MemoryHandler *_handler) {
+    handler = _handler;
+}
+
+void Memory::setTrap(uint32_t addr, uint64_t n, uint8_t bits) {
+    if(!n) return;
+    uint64_t last = ((uint64_t) addr + n - 1) >> MEMORY_PAGE_SHIFT;
+    if(last >= MEMORY_MAP_PAGES) last = MEMORY_MAP_PAGES - 1;
+    for(uint64_t page = addr >> MEMORY_PAGE_SHIFT; page <= last; page++) {
+        traps[page] |= bits;
+    }
+}
+
+void Memory::clearTrap(uint32_t addr, uint64_t n, uint8_t bits) {
+    bits &= ~PAGE_UNMAPPED; // follows the size; never cleared
+    if(!n) return;
+    uint64_t last = ((uint64_t) addr + n - 1) >> MEMORY_PAGE_SHIFT;
+    if(last >= MEMORY_MAP_PAGES) last = MEMORY_MAP_PAGES - 1;
+    for(uint64_t page = addr >> MEMORY_PAGE_SHIFT; page <= last; page++) {
+        traps[page] &= ~bits;
+    }
+}
+
+uint8_t Memory::getTrap(uint32_t addr) {
+    return traps[addr >> MEMORY_PAGE_SHIFT];
+}
+
+/**
+ * reports and disarms watched pages in a range written behind the trap map
+ */
+void Memory::watchHit(uint64_t addr, uint64_t n) {
+    if(!n) return;
+    for(uint64_t page = addr >> MEMORY_PAGE_SHIFT; page <= (addr + n - 1) >> MEMORY_PAGE_SHIFT; page++) {
+        if(traps[page] & PAGE_WATCH) {
+            traps[page] &= ~PAGE_WATCH;
+            if(handler) handler->pageWritten(page << MEMORY_PAGE_SHIFT);
+        }
+    }
+}
+
+uint8_t Memory::trapReadb(uint32_t addr) {
+    uint8_t trap = traps[addr >> MEMORY_PAGE_SHIFT];
+    uint32_t v;
+    if(handler && (trap & PAGE_IO) && handler->ioRead(addr, 1, &v)) return v;
+    if(handler && (trap & PAGE_TRAP_READ)) handler->trapRead(addr);
+    if((trap & PAGE_GUARD) || addr >= size) {
+        if(handler) handler->fault(addr, PAGE_TRAP_READ);
+        return 0xFF;
+    }
+    return ptr[addr];
+}
+
+uint16_t Memory::trapReadw(uint32_t addr) {
+    uint32_t v;
+    if(handler && (traps[addr >> MEMORY_PAGE_SHIFT] & PAGE_IO) && handler->ioRead(addr, 2, &v)) return v;
+    uint16_t lo = trapReadb(addr); // in order, so a fault reports the first bad byte
+    return (trapReadb(addr+1) << 8) | lo;
+}
+
+uint32_t Memory::trapReadl(uint32_t addr) {
+    uint32_t v;
+    if(handler && (traps[addr >> MEMORY_PAGE_SHIFT] & PAGE_IO) && handler->ioRead(addr, 4, &v)) return v;
+    uint32_t v0 = trapReadb(addr);
+    uint32_t v1 = trapReadb(addr+1);
+    uint32_t v2 = trapReadb(addr+2);
+    return (trapReadb(addr+3) << 24) | (v2 << 16) | (v1 << 8) | v0;
+}
+
+uint8_t Memory::trapFetchb(uint32_t addr) {
+    uint8_t trap = traps[addr >> MEMORY_PAGE_SHIFT];
+    if(handler && (trap & PAGE_TRAP_EXEC)) handler->trapExec(addr);
+    if((trap & PAGE_GUARD) || addr >= size) {
+        if(handler) handler->fault(addr, PAGE_TRAP_EXEC);
+        return 0xFF;
+    }
+    return ptr[addr];
+}
+
+void Memory::trapWriteb(uint32_t addr, uint8_t v) {
+    uint8_t trap = traps[addr >> MEMORY_PAGE_SHIFT];
+    if(handler && (trap & PAGE_IO) && handler->ioWrite(addr, 1, v)) return;
+    if((trap & PAGE_GUARD) || addr >= size) {
+        if(handler) handler->fault(addr, PAGE_TRAP_WRITE);
+        return;
+    }
+    ptr[addr] = v;
+    markDirty(addr, 1);
+    if(trap & PAGE_WATCH) watchHit(addr, 1);
+    if(handler && (trap & PAGE_TRAP_WRITE)) handler->trapWrite(addr);
+}
+
+void Memory::trapWritew(uint32_t addr, uint16_t v) {
+    if(handler && (traps[addr >> MEMORY_PAGE_SHIFT] & PAGE_IO) && handler->ioWrite(addr, 2, v)) return;
+    trapWriteb(addr, v & 0x000000FF);
+    trapWriteb(addr+1, (v & 0x0000FF00) >> 8);
+}
+
+void Memory::trapWritel(uint32_t addr, uint32_t v) {
+    if(handler && (traps[addr >> MEMORY_PAGE_SHIFT] & PAGE_IO) && handler->ioWrite(addr, 4, v)) return;
+    trapWriteb(addr, v & 0x000000FF);
+    trapWriteb(addr+1, (v & 0x0000FF00) >> 8);
+    trapWriteb(addr+2, (v & 0x00FF0000) >> 16);
+    trapWriteb(addr+3, (v & 0xFF000000) >> 24);
+}
+
+void Memory::zero() {
+    // dropping the pages is cheaper than touching them; they refault as zero
+    if(madvise(ptr, mapsize, MADV_DONTNEED) != 0) {
+        memset(ptr, 0, size);
+    }
+
+    // every page is now known to be zero; only the last may be short
+    memset(dirty, 0, ((npages + 63) / 64) * sizeof(uint64_t));
+    if(npages) {
+        uint64_t zerohash = hash_bytes(ptr, MEMORY_PAGE_SIZE < size ? MEMORY_PAGE_SIZE : size);
+        for(uint64_t page = 0; page < npages; page++) {
+            pagehash[page] = zerohash;
+        }
+        pagehash[npages - 1] = hashPage(npages - 1);
+    }
+}
+
+void Memory::fill(uint32_t addr, size_t n, void *src) {
+    if(addr >= size) return;
+    if(n > size - addr) n = size - addr;
+    memcpy(ptr + addr, src, n);
+    markDirty(addr, n);
+    watchHit(addr, n);
+}
+
+/**
+ * copies out up to n bytes without going through the trap map.
+ * returns the number of bytes copied.
+ */
+size_t Memory::dump(uint32_t addr, size_t n, void *dst) {
+    if(addr >= size) return 0;
+    if(n > size - addr) n = size - addr;
+    memcpy(dst, ptr + addr, n);
+    return n;
+}
+
+/**
+ * host view of n bytes of ram, or NULL if they are not all in memory.
+ * Reading through it does not go through the trap map.
+ */
+const uint8_t *Memory::getRange(uint32_t addr, size_t n) {
+    if(addr >= size || n > size - addr) return NULL;
+    return ptr + addr;
+}
+
+/**
+ * moves n bytes within memory, as a dma engine would. Like fill(), this
+ * works on the backing store directly and does not go through the trap map.
+ */
+void Memory::move(uint32_t dst, uint32_t src, size_t n) {
+    if(dst >= size || src >= size) return;
+    if(n > size - dst) n = size - dst;
+    if(n > size - src) n = size - src;
+    memmove(ptr + dst, ptr + src, n);
+    markDirty(dst, n);
+    watchHit(dst, n);
+}
+
+void Memory::set(uint32_t dst, uint8_t v, size_t n) {
+    if(dst >= size) return;
+    if(n > size - dst) n = size - dst;
+    memset(ptr + dst, v, n);
+    markDirty(dst, n);
+    watchHit(dst, n);
+}
+
+// multi-byte accesses stay on the fast path if both ends are on untrapped pages
+#define TRAPPED(addr, len, mask) \
+    ((traps[(addr) >> MEMORY_PAGE_SHIFT] | traps[(uint32_t) ((addr) + (len) - 1) >> MEMORY_PAGE_SHIFT]) & (mask))
+
+#define READ_MASK (PAGE_TRAP_READ | PAGE_UNMAPPED | PAGE_IO | PAGE_GUARD)
+#define WRITE_MASK (PAGE_TRAP_WRITE | PAGE_UNMAPPED | PAGE_IO | PAGE_WATCH | PAGE_GUARD)
+#define EXEC_MASK (PAGE_TRAP_EXEC | PAGE_UNMAPPED | PAGE_GUARD)
+
+#define MARK_DIRTY(addr) \
+    (dirty[(addr) >> (MEMORY_PAGE_SHIFT + 6)] |= 1ULL << (((addr) >> MEMORY_PAGE_SHIFT) & 63))
+
 uint8_t Memory::readb(uint32_t addr) {
-    if(addr >= size) return 0xFF; // TODO: trap?
+    if(traps[addr >> MEMORY_PAGE_SHIFT] & READ_MASK) return trapReadb(addr);
     return ptr[addr];
 }
 
 uint16_t Memory::readw(uint32_t addr) {
-    return (readb(addr+1) << 8) | readb(addr);
+    if(TRAPPED(addr, 2, READ_MASK)) return trapReadw(addr);
+    return (ptr[(uint32_t) (addr+1)] << 8) | ptr[addr];
 }
 
 uint32_t Memory::readl(uint32_t addr) {
-    return  (readb(addr+3) << 24) | (readb(addr+2) << 16) | (readb(addr+1) << 8) | readb(addr);
+    if(TRAPPED(addr, 4, READ_MASK)) return trapReadl(addr);
+    return (ptr[(uint32_t) (addr+3)] << 24) | (ptr[(uint32_t) (addr+2)] << 16) |
+           (ptr[(uint32_t) (addr+1)] << 8) | ptr[addr];
+}
+
+uint8_t Memory::fetchb(uint32_t addr) {
+    if(traps[addr >> MEMORY_PAGE_SHIFT] & EXEC_MASK) return trapFetchb(addr);
+    return ptr[addr];
 }
 
 void Memory::writeb(uint32_t addr, uint8_t v) {
-    if(addr >= size) return;
+    if(traps[addr >> MEMORY_PAGE_SHIFT] & WRITE_MASK) return trapWriteb(addr, v);
     ptr[addr] = v;
+    MARK_DIRTY(addr);
 }
 
 void Memory::writew(uint32_t addr, uint16_t v) {
-    writeb(addr, v & 0x000000FF);
-    writeb(addr+1, (v & 0x0000FF00) >> 8);
+    if(TRAPPED(addr, 2, WRITE_MASK)) return trapWritew(addr, v);
+    ptr[addr] = v & 0x000000FF;
+    ptr[(uint32_t) (addr+1)] = (v & 0x0000FF00) >> 8;
+    MARK_DIRTY(addr);
+    MARK_DIRTY((uint32_t) (addr+1));
 }
 
 void Memory::writel(uint32_t addr, uint32_t v) {
-    writeb(addr, v & 0x000000FF);
-    writeb(addr+1, (v & 0x0000FF00) >> 8);
-    writeb(addr+2, (v & 0x00FF0000) >> 16);
-    writeb(addr+3, (v & 0xFF000000) >> 24);
+    if(TRAPPED(addr, 4, WRITE_MASK)) return trapWritel(addr, v);
+    ptr[addr] = v & 0x000000FF;
+    ptr[(uint32_t) (addr+1)] = (v & 0x0000FF00) >> 8;
+    ptr[(uint32_t) (addr+2)] = (v & 0x00FF0000) >> 16;
+    ptr[(uint32_t) (addr+3)] = (v & 0xFF000000) >> 24;
+    MARK_DIRTY(addr);
+    MARK_DIRTY((uint32_t) (addr+3));
 }
@@ -2,22 +2,124 @@
 #define _BOSTEK_MEMORY_HPP
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "cpplib/common/object.hpp"
 
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_MAP_PAGES (1 << (32 - MEMORY_PAGE_SHIFT)) // pages in the guest address space
+
+enum MemoryFlags {
+    MEMORY_DEFAULT=0x00,
+    MEMORY_HUGEPAGE=0x01, // try MAP_HUGETLB, fall back to transparent huge pages
+};
+
+enum PageTrap {
+    PAGE_TRAP_READ=0x01,
+    PAGE_TRAP_WRITE=0x02,
+    PAGE_TRAP_EXEC=0x04,
+    PAGE_UNMAPPED=0x08, // whole or partly past the end of memory
+    PAGE_IO=0x10, // has device registers on it
+    PAGE_WATCH=0x20, // report the next write to the handler, then clear
+    PAGE_GUARD=0x40, // any access faults
+};
+
+/**
+ * Receives accesses to pages that are flagged in the trap map
+ */
+class MemoryHandler {
+    public:
+    virtual ~MemoryHandler() {}
+    virtual void trapRead(uint32_t addr) = 0;
+    virtual void trapWrite(uint32_t addr) = 0;
+    virtual void trapExec(uint32_t addr) = 0;
+    virtual void pageWritten(uint32_t addr) = 0;
+
+    // an access to a guard page or past the end of memory. access is one of
+    // PAGE_TRAP_READ/WRITE/EXEC. May throw; if it returns, reads give 0xFF
+    // and writes are dropped
+    virtual void fault(uint32_t addr, int access) = 0;
+
+    // return false if no device claims the address; the access then goes to ram
+    virtual bool ioRead(uint32_t addr, int size, uint32_t *v) = 0;
+    virtual bool ioWrite(uint32_t addr, int size, uint32_t v) = 0;
+};
+
+/**
+ * Guest RAM
+ *
+ * Backed by an anonymous mapping, so untouched pages cost nothing and are
+ * placed on first touch. Call bindLocalNode() from the thread that runs
+ * the owning cpu to keep the pages on that thread's NUMA node.
+ *
+ * Writes mark their page in a dirty bitmap. Each page keeps a cached hash,
+ * so digest() only rehashes pages written since the last digest.
+ *
+ * Every page of the 32-bit address space has a byte in the trap map.
+ * Accesses only leave the fast path if their page is flagged, which covers
+ * the end of memory, pages with debug traps on them and device registers.
+ * PAGE_WATCH reports only the first write to a page until it is set again,
+ * which lets devices find changed pages without slowing down every write.
+ * Guard pages and pages past the end fault through the handler, so in-range
+ * accesses need no bounds compare.
+ */
 class Memory : public Object {
-    int size;
+    uint64_t size;
+    uint64_t mapsize; // size of the mapping; rounded up to the page size used
     uint8_t *ptr;
+    unsigned flags;
+    bool hugetlb;
+
+    uint64_t npages;
+    uint64_t *dirty; // one bit per page
+    uint64_t *pagehash; // valid for pages whose dirty bit is clear
+
+    uint8_t *traps; // PageTrap bits, one byte per page
+    MemoryHandler *handler;
+
+    void map();
+    void markDirty(uint64_t addr, uint64_t n);
+    uint64_t hashPage(uint64_t page);
+    void watchHit(uint64_t addr, uint64_t n);
+
+    uint8_t trapReadb(uint32_t addr);
+    uint16_t trapReadw(uint32_t addr);
+    uint32_t trapReadl(uint32_t addr);
+    uint8_t trapFetchb(uint32_t addr);
+    void trapWriteb(uint32_t addr, uint8_t v);
+    void trapWritew(uint32_t addr, uint16_t v);
+    void trapWritel(uint32_t addr, uint32_t v);
 
     public:
-    Memory(int size);
+    Memory(uint64_t size, unsigned flags=MEMORY_DEFAULT);
     ~Memory();
 
+    uint64_t getSize();
+    bool usesHugePages();
+    bool bindNode(int node);
+    bool bindLocalNode();
+
+    uint64_t getPageCount();
+    bool isPageDirty(uint64_t page);
+    uint64_t pageDigest(uint64_t page);
+    uint64_t digest();
+
+    void setHandler(MemoryHandler *handler);
+    void setTrap(uint32_t addr, uint64_t n, uint8_t bits);
+    void clearTrap(uint32_t addr, uint64_t n, uint8_t bits);
+    uint8_t getTrap(uint32_t addr);
+
     void zero();
-    void fill(uint32_t addr, int n, void *ptr);
+    void fill(uint32_t addr, size_t n, void *ptr);
+    size_t dump(uint32_t addr, size_t n, void *ptr);
+    const uint8_t *getRange(uint32_t addr, size_t n);
+    void move(uint32_t dst, uint32_t src, size_t n);
+    void set(uint32_t dst, uint8_t v, size_t n);
     uint8_t readb(uint32_t addr);
     uint16_t readw(uint32_t addr);
     uint32_t readl(uint32_t addr);
+    uint8_t fetchb(uint32_t addr);
     void writeb(uint32_t addr, uint8_t v);
     void writew(uint32_t addr, uint16_t v);
     void writel(uint32_t addr, uint32_t v);
@@ -0,0 +1,141 @@
+#include "mnemonics.hpp"
+
+#include "opcodes.hpp"
+
+using namespace Bostek::Cpu;
+
+/*
+ * Mnemonics are the names in the opcode table, less the forms the
+ * assembler picks from the operands, plus a few shorthands.
+ *
+ * Every mnemonic and register name is known up front, so they are found
+ * through a perfect hash built by the compiler: names are packed into a
+ * 64-bit key, and a multiplier is searched for that sends every key to
+ * its own slot. A lookup is one multiply, one load and one compare.
+ */
+
+#define MNEMONIC_MAX 192
+#define MNEMONIC_HASH_BITS 12
+#define MNEMONIC_EMPTY 0xFF
+
+struct MnemonicSet {
+    Mnemonic entries[MNEMONIC_MAX];
+    int count;
+};
+
+struct MnemonicHash {
+    uint64_t multiplier;
+    uint8_t index[1 << MNEMONIC_HASH_BITS];
+};
+
+static constexpr void add(MnemonicSet &s, const char *stem, char suffix, int kind, int op, int type=0) {
+    Mnemonic &m = s.entries[s.count++];
+    int i = 0;
+    for(; stem[i]; i++) m.name[i] = stem[i];
+    if(suffix) m.name[i++] = suffix;
+    for(; i < MNEMONIC_NAME_MAX; i++) m.name[i] = '\0';
+    m.kind = kind;
+    m.op = op;
+    m.type = type;
+}
+
+// the mnemonic naming the opcode, or -1 if the assembler picks it from the operands
+static constexpr int mnemonic_kind(const Opcode &o) {
+    if(!o.name[0]) return -1;
+    switch(o.unit) {
+        case UNIT_CONTROL:
+            if(o.layout == LAYOUT_NONE) return MNEMONIC_NULARY;
+            if(o.layout != LAYOUT_R) return -1;
+            return o.name[0] == 'C' ? MNEMONIC_CPU : MNEMONIC_STATUS;
+        case UNIT_LOAD: return o.layout == LAYOUT_MEM ? MNEMONIC_LOAD : -1;
+        case UNIT_STORE: return o.layout == LAYOUT_MEM ? MNEMONIC_STORE : -1;
+        case UNIT_MOVE: return o.layout == LAYOUT_RR ? MNEMONIC_MOVE : -1;
+        case UNIT_SWAP: return MNEMONIC_SWAP;
+        case UNIT_PUSH: return o.layout == LAYOUT_TR ? MNEMONIC_PUSH : -1;
+        case UNIT_POP: return o.layout == LAYOUT_TR ? MNEMONIC_POP : -1;
+        case UNIT_JUMP: return MNEMONIC_JUMP_FIXED;
+        case UNIT_BRANCH: return MNEMONIC_BRANCH;
+        case UNIT_ARITHMETIC:
+            if(o.layout == LAYOUT_RR) return MNEMONIC_BINARY;
+            return o.layout == LAYOUT_TR ? MNEMONIC_UNARY : -1;
+        default: return -1;
+    }
+}
+
+static constexpr MnemonicSet build() {
+    MnemonicSet s = {};
+    for(int op = 0; op < 256; op++) {
+        const Opcode &o = opcode_table.op[op];
+        int kind = mnemonic_kind(o);
+        if(kind < 0) continue;
+        if(o.type != TYPE_NONE) {
+            add(s, o.name, 0, kind, op, o.type);
+        } else if(kind == MNEMONIC_PUSH || kind == MNEMONIC_POP || kind == MNEMONIC_UNARY) {
+            for(int t = TYPE_BYTE; t <= TYPE_FLOAT; t++) add(s, o.name, opcode_types[t], kind, op, t);
+        } else {
+            add(s, o.name, 0, kind, op);
+        }
+    }
+
+    // shorthands
+    add(s, "CPU", 0, MNEMONIC_CPU, CPUB);
+    for(int i = 0; i < 3; i++) add(s, status_stems[i], 0, MNEMONIC_STATUS, ANSB_R + i);
+    add(s, "JMP", 0, MNEMONIC_JUMP, RJMP);
+    add(s, "JSR", 0, MNEMONIC_JUMP, RJSR);
+
+    for(int i = 0; i < 16; i++) {
+        if(register_names[i][0]) add(s, register_names[i], 0, MNEMONIC_REGISTER, i);
+    }
+    return s;
+}
+
+static constexpr uint64_t pack(const char *text, int len) {
+    uint64_t key = 0;
+    for(int i = 0; i < len; i++) key |= (uint64_t) (uint8_t) text[i] << (8 * i);
+    return key;
+}
+
+static constexpr uint32_t slot(uint64_t key, uint64_t multiplier) {
+    return (key * multiplier) >> (64 - MNEMONIC_HASH_BITS);
+}
+
+static constexpr int name_length(const Mnemonic &m) {
+    int len = 0;
+    while(len < MNEMONIC_NAME_MAX && m.name[len]) len++;
+    return len;
+}
+
+static constexpr MnemonicHash build_hash(const MnemonicSet &s) {
+    MnemonicHash h = {};
+    for(uint64_t multiplier = 0x9E3779B97F4A7C15ULL; ; multiplier += 0x5851F42D4C957F2EULL) {
+        h.multiplier = multiplier | 1;
+        for(int i = 0; i < (1 << MNEMONIC_HASH_BITS); i++) h.index[i] = MNEMONIC_EMPTY;
+
+        bool perfect = true;
+        for(int i = 0; i < s.count && perfect; i++) {
+            uint32_t j = slot(pack(s.entries[i].name, name_length(s.entries[i])), h.multiplier);
+            if(h.index[j] != MNEMONIC_EMPTY) perfect = false;
+            h.index[j] = i;
+        }
+        if(perfect) return h;
+    }
+}
+
+static constexpr MnemonicSet mnemonics = build();
+static constexpr MnemonicHash mnemonic_hash = build_hash(mnemonics);
+
+static_assert(mnemonics.count <= MNEMONIC_MAX && mnemonics.count < MNEMONIC_EMPTY, "too many mnemonics");
+
+/**
+ * the mnemonic or register named by the span, or NULL
+ */
+const Mnemonic *lookupMnemonic(const char *text, int len) {
+    if(len <= 0 || len > MNEMONIC_NAME_MAX) return NULL;
+    uint64_t key = pack(text, len);
+    uint8_t i = mnemonic_hash.index[slot(key, mnemonic_hash.multiplier)];
+    if(i == MNEMONIC_EMPTY) return NULL;
+
+    const Mnemonic *m = &mnemonics.entries[i];
+    if(pack(m->name, name_length(*m)) != key) return NULL;
+    return m;
+}
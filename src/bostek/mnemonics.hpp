@@ -0,0 +1,35 @@
+#ifndef _BOSTEK_MNEMONICS_HPP
+#define _BOSTEK_MNEMONICS_HPP
+
+#include <stdint.h>
+
+enum MnemonicKind {
+    MNEMONIC_NULARY, // NOP, HLT, ...
+    MNEMONIC_CPU,
+    MNEMONIC_STATUS, // ANS, ORS, XRS; op is the register form
+    MNEMONIC_JUMP, // JMP, JSR; relaxed
+    MNEMONIC_JUMP_FIXED, // AJMP, LRJSR, ...; as written
+    MNEMONIC_BRANCH,
+    MNEMONIC_LOAD,
+    MNEMONIC_STORE,
+    MNEMONIC_MOVE, // op is the register form
+    MNEMONIC_SWAP,
+    MNEMONIC_PUSH,
+    MNEMONIC_POP,
+    MNEMONIC_BINARY, // op is the register form
+    MNEMONIC_UNARY,
+    MNEMONIC_REGISTER, // op is the register number
+};
+
+#define MNEMONIC_NAME_MAX 8
+
+struct Mnemonic {
+    char name[MNEMONIC_NAME_MAX];
+    uint8_t kind;
+    uint8_t op;
+    uint8_t type;
+};
+
+const Mnemonic *lookupMnemonic(const char *text, int len);
+
+#endif
@@ -2,15 +2,25 @@
 
 #include "cpu.hpp"
 #include "memory.hpp"
+#include "debugger.hpp"
+#include "device.hpp"
 
 #include <stddef.h>
+#include <stdio.h>
 
-NorthBridge::NorthBridge() : cpu(NULL), mem(NULL) {
+NorthBridge::NorthBridge() : cpu(NULL), mem(NULL), debugger(NULL), clocks(0), idleclocks(0), sliceend(0), stopped(false), running(false),
+        fault_action(FAULT_IGNORE), faulted(false) {
 }
 
 NorthBridge::~NorthBridge() {
+    for(int i = 0; i < devices.size(); i++) {
+        devices[i].dev->release();
+    }
     if(cpu) cpu->release();
-    if(mem) mem->release();
+    if(mem) {
+        mem->setHandler(NULL);
+        mem->release();
+    }
 }
 
 void NorthBridge::attachCpu(Cpu *_cpu) {
@@ -20,6 +30,23 @@ void NorthBridge::attachCpu(Cpu *_cpu) {
 
 void NorthBridge::attachMemory(Memory *_mem) {
     mem = _mem;
+    mem->setHandler(this);
+    for(int i = 0; i < devices.size(); i++) {
+        mem->setTrap(devices[i].base, devices[i].size, PAGE_IO);
+    }
+    for(int i = 0; i < watches.size(); i++) {
+        mem->setTrap(watches[i].base, watches[i].size, PAGE_WATCH);
+    }
+}
+
+void NorthBridge::attachDevice(Device *dev, uint32_t base) {
+    devices.push_back(DeviceMapping(base, dev->getSize(), dev));
+    dev->setNorthBridge(this);
+    if(mem) mem->setTrap(base, dev->getSize(), PAGE_IO);
+}
+
+void NorthBridge::attachDebugger(Debugger *_debugger) {
+    debugger = _debugger;
 }
 
 void NorthBridge::detachCpu() {
@@ -27,9 +54,256 @@ void NorthBridge::detachCpu() {
 }
 
 void NorthBridge::detachMemory() {
+    if(mem) mem->setHandler(NULL);
     mem = NULL;
 }
 
+void NorthBridge::detachDebugger() {
+    debugger = NULL;
+}
+
+Cpu *NorthBridge::getCpu() {
+    return cpu;
+}
+
+Memory *NorthBridge::getMemory() {
+    return mem;
+}
+
+uint64_t NorthBridge::getClocks() {
+    return clocks;
+}
+
+/**
+ * clks skipped while the cpu waited for an irq
+ */
+uint64_t NorthBridge::getIdleClocks() {
+    return idleclocks;
+}
+
+/**
+ * fires the event id on dev after delay clks
+ */
+void NorthBridge::schedule(uint64_t delay, Device *dev, int id) {
+    uint64_t when = clocks + delay;
+    events.insert(std::make_pair(when, Event(dev, id)));
+    if(when < sliceend) sliceend = when; // end the running slice early
+}
+
+void NorthBridge::cancel(Device *dev, int id) {
+    std::multimap<uint64_t, Event>::iterator it = events.begin();
+    while(it != events.end()) {
+        if(it->second.dev == dev && it->second.id == id) {
+            events.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
+void NorthBridge::raiseIrq(uint8_t ivec) {
+    if(cpu) cpu->irq(ivec);
+}
+
+/**
+ * passes the first write to each page of the range to dev->pageWritten().
+ * The device rearms a page with Memory::setTrap(addr, n, PAGE_WATCH).
+ */
+void NorthBridge::watchWrites(Device *dev, uint32_t base, uint32_t size) {
+    watches.push_back(DeviceMapping(base, size, dev));
+    if(mem) mem->setTrap(base, size, PAGE_WATCH);
+}
+
+void NorthBridge::unwatchWrites(Device *dev) {
+    std::vector<DeviceMapping>::iterator it = watches.begin();
+    while(it != watches.end()) {
+        if(it->dev == dev) {
+            if(mem) mem->clearTrap(it->base, it->size, PAGE_WATCH);
+            it = watches.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    // pages shared with another watch stay armed
+    if(mem) {
+        for(int i = 0; i < watches.size(); i++) {
+            mem->setTrap(watches[i].base, watches[i].size, PAGE_WATCH);
+        }
+    }
+}
+
+void NorthBridge::fireEvents() {
+    while(!events.empty() && events.begin()->first <= clocks) {
+        Event e = events.begin()->second;
+        events.erase(events.begin());
+        e.dev->event(e.id);
+    }
+}
+
+/**
+ * clocks the cpu up to nclks times. Returns early if stop() is called,
+ * StopExecution is thrown or the cpu halts. Returns the number of clks
+ * executed.
+ */
+uint64_t NorthBridge::run(uint64_t nclks) {
+    if(!cpu || cpu->isHalted()) return 0;
+
+    uint64_t start = clocks;
+    uint64_t end = clocks + nclks;
+    stopped = false;
+    running = true;
+    faulted = false;
+
+    while(!stopped && clocks < end) {
+        // irq entry from an event can fault too, so events are inside the try
+        try {
+            fireEvents();
+
+            sliceend = end;
+            if(!events.empty() && events.begin()->first < sliceend) {
+                sliceend = events.begin()->first;
+            }
+
+            if(cpu->isWaiting()) {
+                idleclocks += sliceend - clocks;
+                clocks = sliceend; // nothing can happen before the next event
+                continue;
+            }
+
+            // stop() and schedule() move sliceend, so the loop needs no other check
+            while(clocks < sliceend) {
+                clocks++;
+                cpu->clk();
+            }
+        } catch(StopExecution &) {
+            clocks--; // the abandoned clk did not execute
+            stopped = true;
+        } catch(MemoryFault &f) {
+            handleFault(f); // the faulting clk is counted
+        }
+    }
+
+    // events due at the end are part of this run, unless it was stopped
+    if(!stopped) {
+        try {
+            fireEvents();
+        } catch(MemoryFault &f) {
+            handleFault(f);
+        }
+    }
+    running = false;
+
+    sliceend = clocks;
+    return clocks - start;
+}
+
+void NorthBridge::handleFault(const MemoryFault &f) {
+    if(fault_action != FAULT_TRAP) return stopOnFault(f, "fault");
+
+    try {
+        cpu->fault(f.addr);
+    } catch(MemoryFault &f2) {
+        stopOnFault(f2, "double fault");
+    }
+}
+
+void NorthBridge::stopOnFault(const MemoryFault &f, const char *what) {
+    static const char *access[] = {"", "read", "write", "", "exec"};
+    fprintf(stderr, "bostek: %s: %s at 0x%08x, pc 0x%08x\n", what,
+            access[f.access & 0x07], f.addr, cpu->getPc());
+    last_fault = f;
+    faulted = true;
+    stopped = true;
+}
+
+void NorthBridge::setFaultAction(FaultAction action) {
+    fault_action = action;
+}
+
+/**
+ * the fault the last run() stopped on, or NULL
+ */
+const MemoryFault *NorthBridge::getFault() {
+    return faulted ? &last_fault : NULL;
+}
+
+/**
+ * stops run() after the current clk
+ */
+void NorthBridge::stop() {
+    sliceend = clocks;
+    stopped = true;
+}
+
+/**
+ * ends the current slice after this clk, so run() notices the cpu is waiting
+ */
+void NorthBridge::idle() {
+    sliceend = clocks;
+}
+
+void NorthBridge::trapRead(uint32_t addr) {
+    if(debugger) debugger->trapRead(addr);
+}
+
+void NorthBridge::trapWrite(uint32_t addr) {
+    if(debugger) debugger->trapWrite(addr);
+}
+
+void NorthBridge::trapExec(uint32_t addr) {
+    if(debugger) debugger->trapExec(addr);
+}
+
+void NorthBridge::pageWritten(uint32_t addr) {
+    for(int i = 0; i < watches.size(); i++) {
+        DeviceMapping &m = watches[i];
+        // the page overlaps the range
+        if(addr - m.base < m.size || m.base - addr < MEMORY_PAGE_SIZE) {
+            m.dev->pageWritten(addr);
+        }
+    }
+}
+
+/**
+ * accesses from outside run() (devices, the host) are never faulted
+ */
+void NorthBridge::fault(uint32_t addr, int access) {
+    if(!running || fault_action == FAULT_IGNORE) return;
+    throw MemoryFault(addr, access);
+}
+
+bool NorthBridge::ioRead(uint32_t addr, int size, uint32_t *v) {
+    for(int i = 0; i < devices.size(); i++) {
+        DeviceMapping &m = devices[i];
+        uint32_t offset = addr - m.base;
+        if(offset < m.size) {
+            switch(size) {
+                case 1: *v = m.dev->readb(offset); break;
+                case 2: *v = m.dev->readw(offset); break;
+                default: *v = m.dev->readl(offset); break;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NorthBridge::ioWrite(uint32_t addr, int size, uint32_t v) {
+    for(int i = 0; i < devices.size(); i++) {
+        DeviceMapping &m = devices[i];
+        uint32_t offset = addr - m.base;
+        if(offset < m.size) {
+            switch(size) {
+                case 1: m.dev->writeb(offset, v); break;
+                case 2: m.dev->writew(offset, v); break;
+                default: m.dev->writel(offset, v); break;
+            }
+            return true;
+        }
+    }
+    return false;
+}
 
 uint8_t NorthBridge::readb(uint32_t addr) {
     if(mem) return mem->readb(addr);
@@ -46,6 +320,11 @@ uint32_t NorthBridge::readl(uint32_t addr) {
     return 0x00000000;
 }
 
+uint8_t NorthBridge::fetchb(uint32_t addr) {
+    if(mem) return mem->fetchb(addr);
+    return 0x00;
+}
+
 void NorthBridge::writeb(uint32_t addr, uint8_t v) {
     if(mem) return mem->writeb(addr, v);
 }
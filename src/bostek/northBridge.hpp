@@ -2,19 +2,90 @@
 #define _BOSTEK_NORTH_BRIDGE_HPP
 
 #include <stdint.h>
+#include <map>
+#include <vector>
 #include "cpplib/common/object.hpp"
+#include "memory.hpp"
 
 class Cpu;
-class Memory;
+class Debugger;
+class Device;
+
+/**
+ * Thrown from within a clk() to abandon the current instruction and stop run()
+ */
+struct StopExecution {
+};
+
+/**
+ * Thrown from Memory on a guard page or out of range access during run()
+ */
+struct MemoryFault {
+    uint32_t addr;
+    int access; // PAGE_TRAP_READ/WRITE/EXEC
+
+    MemoryFault() : addr(0), access(0) {}
+    MemoryFault(uint32_t a, int acc) : addr(a), access(acc) {}
+};
+
+enum FaultAction {
+    FAULT_IGNORE, // reads give 0xFF, writes are dropped
+    FAULT_TRAP, // abandon the instruction and enter the cpu's fault vector
+    FAULT_STOP, // abandon the instruction, print a diagnostic and stop run()
+};
+
+struct DeviceMapping {
+    uint32_t base;
+    uint32_t size;
+    Device *dev;
+
+    DeviceMapping(uint32_t b, uint32_t s, Device *d) : base(b), size(s), dev(d) {}
+};
+
+struct Event {
+    Device *dev;
+    int id;
+
+    Event(Device *d, int i) : dev(d), id(i) {}
+};
 
 /**
  * Links together Cpu/Memory/IO
  *
  * Redirects memory mapped registers to appropriate location
+ *
+ * Devices schedule events in clks from now. run() clocks the cpu in slices
+ * that end at the next event, so nothing is polled per clk. Events fire
+ * between clks, which is also the only place devices should raise irqs.
+ * While the cpu waits for an irq, time jumps straight to the next event.
+ *
+ * Devices can also watch ranges of ram; the first write to each page is
+ * passed on to them, after which the page has to be watched again.
+ *
+ * Memory faults are handled as set by setFaultAction(). A fault while the
+ * cpu is entering its fault vector always stops.
  */
-class NorthBridge : public Object {
+class NorthBridge : public Object, public MemoryHandler {
     Cpu *cpu;
     Memory *mem;
+    Debugger *debugger;
+    std::vector<DeviceMapping> devices;
+    std::vector<DeviceMapping> watches;
+    std::multimap<uint64_t, Event> events;
+
+    uint64_t clocks; // clks executed by run()
+    uint64_t idleclocks;
+    uint64_t sliceend; // clock the current slice of run() ends at
+    bool stopped;
+    bool running;
+
+    FaultAction fault_action;
+    bool faulted; // the last run() stopped on a fault
+    MemoryFault last_fault;
+
+    void fireEvents();
+    void handleFault(const MemoryFault &f);
+    void stopOnFault(const MemoryFault &f, const char *what);
 
     public:
     NorthBridge();
@@ -22,12 +93,42 @@ class NorthBridge : public Object {
 
     void attachCpu(Cpu *cpu);
     void attachMemory(Memory *mem);
+    void attachDevice(Device *dev, uint32_t base);
+    void attachDebugger(Debugger *debugger);
     void detachCpu();
     void detachMemory();
+    void detachDebugger();
+
+    Cpu *getCpu();
+    Memory *getMemory();
+    uint64_t getClocks();
+    uint64_t getIdleClocks();
+
+    void schedule(uint64_t delay, Device *dev, int id);
+    void cancel(Device *dev, int id);
+    void raiseIrq(uint8_t ivec);
+    void watchWrites(Device *dev, uint32_t base, uint32_t size);
+    void unwatchWrites(Device *dev);
+
+    void setFaultAction(FaultAction action);
+    const MemoryFault *getFault();
+
+    uint64_t run(uint64_t nclks);
+    void stop();
+    void idle();
+
+    virtual void trapRead(uint32_t addr);
+    virtual void trapWrite(uint32_t addr);
+    virtual void trapExec(uint32_t addr);
+    virtual void pageWritten(uint32_t addr);
+    virtual void fault(uint32_t addr, int access);
+    virtual bool ioRead(uint32_t addr, int size, uint32_t *v);
+    virtual bool ioWrite(uint32_t addr, int size, uint32_t v);
 
     uint8_t readb(uint32_t addr);
     uint16_t readw(uint32_t addr);
     uint32_t readl(uint32_t addr);
+    uint8_t fetchb(uint32_t addr);
     void writeb(uint32_t addr, uint8_t v);
     void writew(uint32_t addr, uint16_t v);
     void writel(uint32_t addr, uint32_t v);
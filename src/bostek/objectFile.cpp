@@ -0,0 +1,183 @@
+#include "objectFile.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "lexer.hpp"
+#include "cpplib/common/exception.hpp"
+
+/*
+ * BOBJ layout:
+ *   "BOBJ" version name_len name
+ *   file_count { name_len name }
+ *   section_count { flags origin align size data }
+ *   symbol_count { name_len name section value }
+ *   relocation_count { section offset kind symbol addend file line }
+ */
+
+#define SECTION_ABSOLUTE 0x01
+
+static void put_long(std::vector<uint8_t> &out, uint32_t v) {
+    for(int i = 0; i < 4; i++) {
+        out.push_back(v & 0xFF);
+        v >>= 8;
+    }
+}
+
+static void put_string(std::vector<uint8_t> &out, String s) {
+    put_long(out, s.length());
+    out.insert(out.end(), s.c_str(), s.c_str() + s.length());
+}
+
+// bounds checked reads over a loaded file
+class ObjectReader {
+    const uint8_t *p;
+    const uint8_t *end;
+    const char *filename;
+
+    public:
+    ObjectReader(const char *_filename, const uint8_t *begin, const uint8_t *_end) :
+        p(begin), end(_end), filename(_filename) {}
+
+    void error() {
+        throw Exception(String(filename) + ": corrupt object file");
+    }
+
+    const uint8_t *bytes(uint32_t n) {
+        if(end - p < n) error();
+        const uint8_t *b = p;
+        p += n;
+        return b;
+    }
+
+    uint32_t readl() {
+        const uint8_t *b = bytes(4);
+        return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+    }
+
+    String readString() {
+        uint32_t len = readl();
+        std::string s((const char*) bytes(len), len);
+        return String(s.c_str());
+    }
+
+    bool done() { return p == end; }
+};
+
+ObjectFile::ObjectFile(const char *_name) : name(_name) {
+}
+
+ObjectFile::~ObjectFile() {
+}
+
+ObjectFile *ObjectFile::load(const char *filename) {
+    SourceBuffer *file = new SourceBuffer(filename);
+    ObjectFile *obj = NULL;
+    try {
+        ObjectReader in(filename, (const uint8_t*) file->begin(), (const uint8_t*) file->end());
+        if(file->getSize() < 8 || memcmp(file->begin(), OBJECT_MAGIC, 4)) {
+            throw Exception(String(filename) + ": not an object file");
+        }
+        in.bytes(4);
+        if(in.readl() != OBJECT_VERSION) throw Exception(String(filename) + ": unsupported object version");
+
+        obj = new ObjectFile(in.readString().c_str());
+        uint32_t n = in.readl();
+        for(uint32_t i = 0; i < n; i++) {
+            obj->files.push_back(in.readString());
+        }
+
+        n = in.readl();
+        for(uint32_t i = 0; i < n; i++) {
+            ObjectSection s;
+            s.absolute = in.readl() & SECTION_ABSOLUTE;
+            s.origin = in.readl();
+            s.align = in.readl();
+            if(!s.align || (s.align & (s.align - 1))) in.error();
+            uint32_t size = in.readl();
+            const uint8_t *data = in.bytes(size);
+            s.data.assign(data, data + size);
+            obj->sections.push_back(s);
+        }
+
+        n = in.readl();
+        for(uint32_t i = 0; i < n; i++) {
+            ObjectSymbol s;
+            s.name = in.readString();
+            s.section = (int32_t) in.readl();
+            s.value = in.readl();
+            if(s.section < -1 || s.section >= (int) obj->sections.size()) in.error();
+            obj->symbols.push_back(s);
+        }
+
+        n = in.readl();
+        for(uint32_t i = 0; i < n; i++) {
+            Relocation r;
+            r.section = in.readl();
+            r.offset = in.readl();
+            r.kind = (RelocationKind) in.readl();
+            r.symbol = (int32_t) in.readl();
+            r.addend = in.readl();
+            r.file = (int32_t) in.readl();
+            r.line = in.readl();
+            if(r.section < 0 || r.section >= (int) obj->sections.size() ||
+                    r.symbol < -1 || r.symbol >= (int) obj->symbols.size() || r.kind > RELOC_MEM ||
+                    r.file < -1 || r.file >= (int) obj->files.size()) {
+                in.error();
+            }
+            obj->relocations.push_back(r);
+        }
+        if(!in.done()) in.error();
+    } catch(...) {
+        if(obj) obj->release();
+        file->release();
+        throw;
+    }
+    file->release();
+    return obj;
+}
+
+void ObjectFile::save(const char *filename) {
+    std::vector<uint8_t> out(OBJECT_MAGIC, OBJECT_MAGIC + 4);
+    put_long(out, OBJECT_VERSION);
+    put_string(out, name);
+
+    put_long(out, files.size());
+    for(int i = 0; i < files.size(); i++) {
+        put_string(out, files[i]);
+    }
+
+    put_long(out, sections.size());
+    for(int i = 0; i < sections.size(); i++) {
+        put_long(out, sections[i].absolute ? SECTION_ABSOLUTE : 0);
+        put_long(out, sections[i].origin);
+        put_long(out, sections[i].align);
+        put_long(out, sections[i].data.size());
+        out.insert(out.end(), sections[i].data.begin(), sections[i].data.end());
+    }
+
+    put_long(out, symbols.size());
+    for(int i = 0; i < symbols.size(); i++) {
+        put_string(out, symbols[i].name);
+        put_long(out, symbols[i].section);
+        put_long(out, symbols[i].value);
+    }
+
+    put_long(out, relocations.size());
+    for(int i = 0; i < relocations.size(); i++) {
+        const Relocation &r = relocations[i];
+        put_long(out, r.section);
+        put_long(out, r.offset);
+        put_long(out, r.kind);
+        put_long(out, r.symbol);
+        put_long(out, r.addend);
+        put_long(out, r.file);
+        put_long(out, r.line);
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if(!f) throw Exception(String("unable to open ") + String(filename));
+    bool ok = fwrite(&out[0], 1, out.size(), f) == out.size();
+    if(fclose(f) != 0 || !ok) throw Exception(String("unable to write ") + String(filename));
+}
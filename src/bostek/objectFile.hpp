@@ -0,0 +1,68 @@
+#ifndef _BOSTEK_OBJECTFILE_HPP
+#define _BOSTEK_OBJECTFILE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/string.hpp"
+
+#define OBJECT_MAGIC "BOBJ"
+#define OBJECT_VERSION 3
+
+enum RelocationKind {
+    RELOC_ABS8, // the address, range checked
+    RELOC_ABS16,
+    RELOC_ABS32,
+    RELOC_REL16, // the address less the end of the field
+    RELOC_REL32,
+    RELOC_MEM, // LOD/STO address; the linker picks the absolute or relative opcode
+};
+
+struct ObjectSection {
+    bool absolute; // placed at origin, rather than wherever the linker likes
+    uint32_t origin;
+    uint32_t align; // of the start of a relocatable section
+    std::vector<uint8_t> data;
+};
+
+struct ObjectSymbol {
+    String name;
+    int section; // -1 for a symbol defined in another object
+    uint32_t value; // offset into the section
+};
+
+// a field to fill in with the address of symbol + addend
+struct Relocation {
+    int section;
+    uint32_t offset; // of the field in the section
+    RelocationKind kind;
+    int symbol; // -1 for an absolute address
+    uint32_t addend;
+    int file; // into ObjectFile::files, or -1 if not known
+    int line; // of the instruction, for errors
+};
+
+/**
+ * Assembled code that has not been placed yet: one or more sections,
+ * the labels they define, and the fields that depend on where things
+ * end up. Every label is visible to the other objects linked with it.
+ *
+ * On disk this is a BOBJ file; all integers are little endian.
+ */
+class ObjectFile : public Object {
+    public:
+    String name; // of the source
+    std::vector<String> files; // the source and what it included, for relocation errors
+    std::vector<ObjectSection> sections;
+    std::vector<ObjectSymbol> symbols;
+    std::vector<Relocation> relocations;
+
+    ObjectFile(const char *name);
+    virtual ~ObjectFile();
+
+    static ObjectFile *load(const char *filename);
+    void save(const char *filename);
+};
+
+#endif
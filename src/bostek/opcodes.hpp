@@ -0,0 +1,194 @@
+#ifndef _BOSTEK_OPCODES_HPP
+#define _BOSTEK_OPCODES_HPP
+
+#include <stdint.h>
+
+#include "bcpu.hpp"
+
+namespace Bostek {
+namespace Cpu {
+
+/*
+ * What every opcode byte means, built by the compiler from the encoding
+ * rules. The cpu dispatches on it, basm derives its mnemonics and sizes
+ * from it, and bdis decodes with it, so the three cannot disagree.
+ */
+
+// the part of the cpu that carries an opcode out
+enum OpcodeUnit {
+    UNIT_NONE, // undefined; the cpu stays on it
+    UNIT_CONTROL,
+    UNIT_LOAD,
+    UNIT_STORE,
+    UNIT_MOVE,
+    UNIT_SWAP,
+    UNIT_PUSH,
+    UNIT_POP,
+    UNIT_JUMP,
+    UNIT_BRANCH,
+    UNIT_ARITHMETIC,
+};
+
+// how the operands are laid out after the opcode
+enum OperandLayout {
+    LAYOUT_NONE, // op
+    LAYOUT_R, // op reg
+    LAYOUT_K8, // op imm8
+    LAYOUT_RR, // op src<<4|dst
+    LAYOUT_RK, // op dst imm; as wide as the type
+    LAYOUT_TR, // op type<<4|reg; the type is in the operand
+    LAYOUT_T, // op type<<4
+    LAYOUT_TK, // op type<<4 imm
+    LAYOUT_MEM, // op offset<<4|reg rel16; from the next instruction
+    LAYOUT_AMEM, // op offset<<4|reg addr16
+    LAYOUT_LMEM, // like LAYOUT_MEM, with a 32 bit offset read over what follows
+    LAYOUT_ALMEM, // like LAYOUT_AMEM, with a 32 bit address read over what follows
+    LAYOUT_ABS16, // op addr16
+    LAYOUT_ABS32, // op addr32
+    LAYOUT_REL16, // op rel16; from the next instruction
+    LAYOUT_REL32, // op rel32; from the next instruction
+};
+
+#define OPCODE_NAME_MAX 8
+
+struct Opcode {
+    char name[OPCODE_NAME_MAX]; // empty if reserved; a stem if the type is in the operand
+    uint8_t unit;
+    uint8_t layout;
+    uint8_t type; // of the operands, or TYPE_NONE
+    uint8_t cycles; // nominal clks, taking any branch
+};
+
+struct OpcodeTable {
+    Opcode op[256];
+};
+
+static constexpr const char opcode_types[] = "BWLF"; // suffixes, in Type order
+static constexpr const char *register_names[] = {
+    "A", "B", "C", "D", "AH", "BH", "CH", "DH", "", "", "", "", "SB", "PC", "SP", "ZE",
+};
+
+static constexpr const char *binary_stems[] = {
+    "ADD", "ADC", "SUB", "SBC", "CMP", "AND", "IOR", "XOR", "MUL", "DIV", "MOD", "POW", "MIN", "MAX",
+};
+static constexpr const char *unary_stems[] = {
+    "INC", "DEC", "TST", "COM", "NEG", "ABS", "SXT", "ZXT", "SHL", "SHR", "ROL", "ROR",
+};
+static constexpr const char *nulary_names[] = { "NOP", "HLT", "WFI", "RET", "RFI", "IRQ", "NMI" };
+static constexpr const char *status_stems[] = { "ANS", "ORS", "XRS" };
+static constexpr const char *jump_names[] = { "AJMP", "LAJMP", "AJSR", "LAJSR", "RJMP", "LRJMP", "RJSR", "LRJSR" };
+static constexpr const char flag_names[] = "CHFTIVZS"; // in Flag order
+
+constexpr int type_size(int type) {
+    return type == TYPE_BYTE ? 1 : type == TYPE_WORD ? 2 : 4;
+}
+
+constexpr void define_opcode(OpcodeTable &t, int op, const char *stem, char suffix, int unit, int layout,
+        int type, int cycles) {
+    Opcode &o = t.op[op];
+    int i = 0;
+    for(; stem[i]; i++) o.name[i] = stem[i];
+    if(suffix) o.name[i++] = suffix;
+    for(; i < OPCODE_NAME_MAX; i++) o.name[i] = '\0';
+    o.unit = unit;
+    o.layout = layout;
+    o.type = type;
+    o.cycles = cycles;
+}
+
+/*
+ * Cycles are one clk, plus one for each memory access beyond the fetch
+ * and one for a transfer of control. They annotate listings; the
+ * emulator itself retires an instruction every clk.
+ */
+constexpr OpcodeTable build_opcodes() {
+    OpcodeTable t = {};
+    for(int op = 0; op < 256; op++) define_opcode(t, op, "", 0, UNIT_NONE, LAYOUT_NONE, TYPE_NONE, 1);
+
+    for(int i = NOP; i <= NMI; i++) {
+        int cycles = i == RET || i == RFI ? 3 : 1;
+        define_opcode(t, i, nulary_names[i], 0, UNIT_CONTROL, LAYOUT_NONE, TYPE_NONE, cycles);
+    }
+    define_opcode(t, CPUB, "CPU", 'B', UNIT_CONTROL, LAYOUT_R, TYPE_BYTE, 1);
+    for(int i = 0; i < 3; i++) {
+        define_opcode(t, ANSB_R + i, status_stems[i], 'B', UNIT_CONTROL, LAYOUT_R, TYPE_BYTE, 1);
+        define_opcode(t, ANSB_K + i, status_stems[i], 'B', UNIT_CONTROL, LAYOUT_K8, TYPE_BYTE, 1);
+    }
+    // the cpu skips these like CPUB
+    define_opcode(t, 0x0B, "", 0, UNIT_CONTROL, LAYOUT_K8, TYPE_BYTE, 1);
+    define_opcode(t, 0x0F, "", 0, UNIT_CONTROL, LAYOUT_K8, TYPE_BYTE, 1);
+
+    for(int ty = TYPE_BYTE; ty <= TYPE_FLOAT; ty++) {
+        char c = opcode_types[ty];
+        define_opcode(t, LODB_RRK + ty, "LOD", c, UNIT_LOAD, LAYOUT_MEM, ty, 2);
+        define_opcode(t, LLODB_RRK + ty, "LLOD", c, UNIT_LOAD, LAYOUT_LMEM, ty, 2);
+        define_opcode(t, STOB_RRK + ty, "STO", c, UNIT_STORE, LAYOUT_MEM, ty, 2);
+        define_opcode(t, LSTOB_RRK + ty, "LSTO", c, UNIT_STORE, LAYOUT_LMEM, ty, 2);
+        define_opcode(t, ALODB_RRK + ty, "LOD", c, UNIT_LOAD, LAYOUT_AMEM, ty, 2);
+        define_opcode(t, ALLODB_RRK + ty, "LLOD", c, UNIT_LOAD, LAYOUT_ALMEM, ty, 2);
+        define_opcode(t, ASTOB_RRK + ty, "STO", c, UNIT_STORE, LAYOUT_AMEM, ty, 2);
+        define_opcode(t, ALSTOB_RRK + ty, "LSTO", c, UNIT_STORE, LAYOUT_ALMEM, ty, 2);
+        define_opcode(t, MOVB_RR + ty, "MOV", c, UNIT_MOVE, LAYOUT_RR, ty, 1);
+        define_opcode(t, MOVB_RK + ty, "MOV", c, UNIT_MOVE, LAYOUT_RK, ty, 1);
+        define_opcode(t, SWPB + ty, "SWP", c, UNIT_SWAP, LAYOUT_RR, ty, 1);
+        for(int i = 0; i < 14; i++) {
+            define_opcode(t, ADD + 8 * i + ty, binary_stems[i], c, UNIT_ARITHMETIC, LAYOUT_RR, ty, 1);
+            define_opcode(t, ADD + 8 * i + 4 + ty, binary_stems[i], c, UNIT_ARITHMETIC, LAYOUT_RK, ty, 1);
+        }
+    }
+    define_opcode(t, POPX_R, "POP", 0, UNIT_POP, LAYOUT_TR, TYPE_NONE, 2);
+    define_opcode(t, PSHX_R, "PSH", 0, UNIT_PUSH, LAYOUT_TR, TYPE_NONE, 2);
+    define_opcode(t, POPX_X, "POP", 0, UNIT_POP, LAYOUT_T, TYPE_NONE, 2);
+    define_opcode(t, PSHX_K, "PSH", 0, UNIT_PUSH, LAYOUT_TK, TYPE_NONE, 2);
+    // conversions, BTOF to FTOL, are not implemented
+
+    // the low bits are long, jsr and relative; $68 to $6F repeat them
+    for(int i = 0; i < 16; i++) {
+        int layout = (i & 0x04 ? LAYOUT_REL16 : LAYOUT_ABS16) + (i & 0x01);
+        int cycles = i & 0x02 ? 3 : 2;
+        define_opcode(t, AJMP + i, i < 8 ? jump_names[i] : "", 0, UNIT_JUMP, layout, TYPE_NONE, cycles);
+    }
+    for(int i = 0; i < 16; i++) {
+        char name[4] = { 'J', flag_names[i % 8], i < 8 ? 'C' : 'S', '\0' };
+        define_opcode(t, JCC + i, name, 0, UNIT_BRANCH, LAYOUT_REL16, TYPE_NONE, 2);
+    }
+
+    for(int i = 0; i < 12; i++) define_opcode(t, INCX + i, unary_stems[i], 0, UNIT_ARITHMETIC, LAYOUT_TR, TYPE_NONE, 1);
+    return t;
+}
+
+static constexpr OpcodeTable opcode_table = build_opcodes();
+
+/**
+ * bytes the instruction takes, which is how far the cpu moves past it.
+ * op2 only matters for LAYOUT_TK. Undefined opcodes count as one byte.
+ */
+constexpr int opcode_length(uint8_t op, uint8_t op2 = 0) {
+    const Opcode &o = opcode_table.op[op];
+    switch(o.layout) {
+        case LAYOUT_R:
+        case LAYOUT_K8:
+        case LAYOUT_RR:
+        case LAYOUT_TR:
+        case LAYOUT_T: return 2;
+        case LAYOUT_RK: return 2 + type_size(o.type);
+        case LAYOUT_TK: return 2 + type_size((op2 >> 4) & 0x03);
+        case LAYOUT_MEM:
+        case LAYOUT_AMEM:
+        case LAYOUT_LMEM:
+        case LAYOUT_ALMEM: return 4;
+        case LAYOUT_ABS16:
+        case LAYOUT_REL16: return 3;
+        case LAYOUT_ABS32:
+        case LAYOUT_REL32: return 5;
+        default: return 1;
+    }
+}
+
+static_assert(opcode_length(MOVL_RK) == 6 && opcode_length(PSHX_K, TYPE_WORD << 4) == 4, "bad opcode lengths");
+static_assert(opcode_length(LRJSR) == 5 && opcode_table.op[JZS].unit == UNIT_BRANCH, "bad jump opcodes");
+
+}
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "parallelAssembler.hpp"
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "assembler.hpp"
+#include "cpplib/common/exception.hpp"
+
+ParallelAssembler::ParallelAssembler(int _threads) : threads(_threads), next(0), done(false), optimize(false) {
+    if(threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads <= 0) threads = 1;
+}
+
+ParallelAssembler::~ParallelAssembler() {
+}
+
+void ParallelAssembler::setOptimize(bool on) {
+    optimize = on;
+}
+
+void ParallelAssembler::add(SourceBuffer *source) {
+    if(done) throw Exception("parallel assembler already finished");
+    Job job;
+    job.source = Ref<SourceBuffer>::share(source);
+    job.failed = false;
+    jobs.push_back(job);
+}
+
+void *ParallelAssembler::worker(void *arg) {
+    ((ParallelAssembler*) arg)->work();
+    return NULL;
+}
+
+// claims jobs until there are none left; each job is only touched by its claimer
+void ParallelAssembler::work() {
+    for(;;) {
+        int i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+        if(i >= (int) jobs.size()) return;
+
+        Job &job = jobs[i];
+        Assembler *as = new Assembler(true);
+        as->setOptimize(optimize);
+        try {
+            as->assemble(job.source.get());
+            job.object = Ref<ObjectFile>::share(as->getObject());
+            job.includes = as->getIncludes();
+            job.include_hashes = as->getIncludeHashes();
+        } catch(Exception &e) {
+            job.error = e.getMessage();
+            job.failed = true;
+            job.includes = as->getIncludes(); // what it read before failing, to watch for a fix
+        }
+        as->release();
+    }
+}
+
+/**
+ * assembles everything added; throws the first error in the order the
+ * sources were added
+ */
+void ParallelAssembler::run() {
+    if(done) return;
+    done = true;
+
+    int n = threads < (int) jobs.size() ? threads : jobs.size();
+    std::vector<pthread_t> pool;
+    for(int i = 1; i < n; i++) {
+        pthread_t t;
+        if(pthread_create(&t, NULL, worker, this) != 0) break; // the rest still get done below
+        pool.push_back(t);
+    }
+    work();
+    for(int i = 0; i < pool.size(); i++) {
+        pthread_join(pool[i], NULL);
+    }
+
+    for(int i = 0; i < jobs.size(); i++) {
+        if(jobs[i].failed) throw Exception(jobs[i].error);
+    }
+}
+
+int ParallelAssembler::getCount() {
+    return jobs.size();
+}
+
+ObjectFile *ParallelAssembler::getObject(int i) {
+    return jobs[i].object.get();
+}
+
+// files the source included, or read before it failed
+const std::vector<String> &ParallelAssembler::getIncludes(int i) {
+    return jobs[i].includes;
+}
+
+// hashes of the includes, as the source was assembled with them
+const std::vector<uint64_t> &ParallelAssembler::getIncludeHashes(int i) {
+    return jobs[i].include_hashes;
+}
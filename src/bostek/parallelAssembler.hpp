@@ -0,0 +1,55 @@
+#ifndef _BOSTEK_PARALLELASSEMBLER_HPP
+#define _BOSTEK_PARALLELASSEMBLER_HPP
+
+#include <vector>
+
+#include "lexer.hpp"
+#include "objectFile.hpp"
+#include "cpplib/common/object.hpp"
+#include "cpplib/common/ref.hpp"
+#include "cpplib/common/string.hpp"
+
+/**
+ * Assembles many sources at once, each into its own relocatable object,
+ * on a pool of threads. Every source gets a fresh Assembler, so nothing
+ * is shared between them but the sources themselves.
+ *
+ * Objects come back in the order the sources were added, and the error
+ * thrown is the first in that order, so neither depends on which thread
+ * got there first. Linking the objects in order then gives the same
+ * image every time.
+ */
+class ParallelAssembler : public Object {
+    struct Job {
+        Ref<SourceBuffer> source;
+        Ref<ObjectFile> object;
+        std::vector<String> includes;
+        std::vector<uint64_t> include_hashes;
+        String error;
+        bool failed;
+    };
+
+    std::vector<Job> jobs;
+    int threads;
+    int next; // job to claim
+    bool done;
+    bool optimize; // peephole every source
+
+    static void *worker(void *arg);
+    void work();
+
+    public:
+    ParallelAssembler(int threads = 0); // 0 for one per core
+    virtual ~ParallelAssembler();
+
+    void setOptimize(bool on);
+    void add(SourceBuffer *source);
+    void run();
+
+    int getCount();
+    ObjectFile *getObject(int i);
+    const std::vector<String> &getIncludes(int i);
+    const std::vector<uint64_t> &getIncludeHashes(int i);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "perfCounters.hpp"
+
+#include <string.h>
+
+PerfCounters::PerfCounters() {
+    memset(base, 0, sizeof(base));
+    memset(snapshot, 0, sizeof(snapshot));
+}
+
+PerfCounters::~PerfCounters() {
+}
+
+uint64_t PerfCounters::raw(int event) {
+    if(event == PERF_CYCLES) return nbr->getClocks();
+    Cpu *cpu = nbr->getCpu();
+    return cpu ? cpu->getPerfCount(event) : 0;
+}
+
+/**
+ * count of a PerfEvent since the last reset
+ */
+uint64_t PerfCounters::read(int event) {
+    if(event < 0 || event >= PERF_EVENTS) return 0;
+    return raw(event) - base[event];
+}
+
+void PerfCounters::reset() {
+    for(int i = 0; i < PERF_EVENTS; i++) {
+        base[i] = raw(i);
+        snapshot[i] = 0;
+    }
+}
+
+uint32_t PerfCounters::getSize() {
+    return PERF_SIZE;
+}
+
+uint8_t PerfCounters::readb(uint32_t offset) {
+    if(offset < PERF_COUNTERS || offset >= PERF_SIZE) return 0x00;
+    offset -= PERF_COUNTERS;
+    return snapshot[offset / 8] >> (8 * (offset % 8));
+}
+
+void PerfCounters::writeb(uint32_t offset, uint8_t v) {
+    if(offset != PERF_CTRL) return;
+    if(v & PERF_CTRL_RESET) reset();
+    if(v & PERF_CTRL_SNAPSHOT) {
+        for(int i = 0; i < PERF_EVENTS; i++) snapshot[i] = read(i);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _BOSTEK_PERF_COUNTERS_HPP
+#define _BOSTEK_PERF_COUNTERS_HPP
+
+#include "device.hpp"
+#include "cpu.hpp"
+
+enum PerfRegister {
+    PERF_CTRL=0x00,
+    PERF_COUNTERS=0x08, // a 64 bit count per PerfEvent, as of the last snapshot
+    PERF_SIZE=PERF_COUNTERS + 8 * PERF_EVENTS,
+};
+
+enum PerfCtrl {
+    PERF_CTRL_SNAPSHOT=0x01, // latch every counter at once
+    PERF_CTRL_RESET=0x02, // count from zero
+};
+
+/**
+ * Performance counters of the attached cpu
+ *
+ * Nothing is counted here; the counts are taken from the cpu and the
+ * NorthBridge clock when read. The guest latches them all with
+ * PERF_CTRL_SNAPSHOT, so multi-word reads are consistent.
+ */
+class PerfCounters : public Device {
+    uint64_t base[PERF_EVENTS]; // raw counts at the last reset
+    uint64_t snapshot[PERF_EVENTS];
+
+    uint64_t raw(int event);
+
+    public:
+    PerfCounters();
+    virtual ~PerfCounters();
+
+    uint64_t read(int event);
+    void reset();
+
+    virtual uint32_t getSize();
+    virtual uint8_t readb(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+};
+
+#endif
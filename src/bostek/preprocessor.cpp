@@ -0,0 +1,399 @@
+#include "preprocessor.hpp"
+
+#include <string.h>
+#include <string>
+
+#include "assemblyCache.hpp"
+#include "cpplib/common/exception.hpp"
+
+static bool same(const Token &a, const Token &b) {
+    return a.len == b.len && !memcmp(a.text, b.text, a.len);
+}
+
+static bool line_ended(const Token &t) {
+    return t.type == TOKEN_NEWLINE || t.type == TOKEN_EOF;
+}
+
+Preprocessor::Preprocessor(SourceBuffer *source, std::vector<String> &_files) :
+        files(_files), has_pending(false), peeked(false), at_start(true), label_start(false) {
+    files.push_back(source->getName());
+    Frame f;
+    f.lexer = new Lexer(source, files.size() - 1);
+    f.pos = 0;
+    frames.push_back(f);
+}
+
+Preprocessor::~Preprocessor() {
+    for(int i = 0; i < frames.size(); i++) {
+        delete frames[i].lexer;
+    }
+}
+
+void Preprocessor::error(const Token &t, const char *msg) const {
+    throw Exception(String(files[t.file]) + ":" + String::fromInt(t.line) + ": " + String(msg));
+}
+
+/**
+ * the next token from the innermost include or expansion, with none of
+ * the directives carried out. Only the outermost file ever ends.
+ */
+Token Preprocessor::raw() {
+    if(has_pending) {
+        has_pending = false;
+        return pending;
+    }
+
+    for(;;) {
+        Frame &f = frames.back();
+        if(f.lexer) {
+            Token t = f.lexer->next();
+            if(t.type != TOKEN_EOF || frames.size() == 1) return t;
+            delete f.lexer;
+            frames.pop_back();
+            t.type = TOKEN_NEWLINE; // the end of an include ends its last line
+            return t;
+        }
+        if(f.pos < f.tokens.size()) return f.tokens[f.pos++];
+        frames.pop_back();
+    }
+}
+
+const Token &Preprocessor::raw_peek() {
+    if(!has_pending) {
+        pending = raw();
+        has_pending = true;
+    }
+    return pending;
+}
+
+void Preprocessor::nest(const Token &t) {
+    if(frames.size() >= PREPROCESSOR_DEPTH) error(t, "includes or macros nested too deeply");
+}
+
+void Preprocessor::end_line(const Token &directive) {
+    Token t = raw();
+    if(!line_ended(t)) {
+        error(t, (String("unexpected ") + t.toString() + " after ." + directive.toString()).c_str());
+    }
+}
+
+void Preprocessor::skip_line() {
+    while(!line_ended(raw()));
+}
+
+Token Preprocessor::next() {
+    if(peeked) {
+        peeked = false;
+        return lookahead;
+    }
+    return scan();
+}
+
+const Token &Preprocessor::peek() {
+    if(!peeked) {
+        lookahead = scan();
+        peeked = true;
+    }
+    return lookahead;
+}
+
+Token Preprocessor::scan() {
+    for(;;) {
+        Token t = raw();
+        if(t.type == TOKEN_DIRECTIVE && conditional(t)) continue;
+        if(t.type == TOKEN_EOF && !conditionals.empty()) error(t, "unterminated .IF");
+        if(!conditionals.empty() && !conditionals.back().active) continue;
+
+        if(t.type == TOKEN_DIRECTIVE && directive(t)) {
+            at_start = true;
+            continue;
+        }
+
+        if(t.type == TOKEN_IDENTIFIER) {
+            int m = macro_names.find(t.text, t.len);
+            if(m >= 0 && at_start && !raw_peek().is(':')) {
+                expand(t, m);
+                continue;
+            }
+
+            int c = constant_names.find(t.text, t.len);
+            if(c >= 0) {
+                t.type = TOKEN_NUMBER;
+                t.value = constants[c];
+            }
+        }
+
+        // a label may come before a macro
+        bool start = at_start;
+        at_start = t.type == TOKEN_NEWLINE || (t.is(':') && label_start);
+        label_start = start && t.type == TOKEN_IDENTIFIER;
+        return t;
+    }
+}
+
+/**
+ * carries out conditional directives, including in branches not being
+ * assembled, where only the nesting counts
+ */
+bool Preprocessor::conditional(const Token &t) {
+    bool active = conditionals.empty() || conditionals.back().active;
+    if(t.equals("IF") || t.equals("IFDEF") || t.equals("IFNDEF")) {
+        Conditional c;
+        c.enclosing = active;
+        c.active = false;
+        if(!active) {
+            skip_line();
+        } else if(t.equals("IF")) {
+            c.active = expr() != 0;
+            end_line(t);
+        } else {
+            Token name = raw();
+            if(name.type != TOKEN_IDENTIFIER) error(name, (String("expected name, not ") + name.toString()).c_str());
+            bool defined = macro_names.find(name.text, name.len) >= 0 || constant_names.find(name.text, name.len) >= 0;
+            c.active = t.equals("IFDEF") ? defined : !defined;
+            end_line(t);
+        }
+        c.taken = c.active;
+        conditionals.push_back(c);
+    } else if(t.equals("ELSE")) {
+        if(conditionals.empty()) error(t, ".ELSE without .IF");
+        end_line(t);
+        Conditional &c = conditionals.back();
+        c.active = c.enclosing && !c.taken;
+        c.taken = true;
+    } else if(t.equals("ENDIF")) {
+        if(conditionals.empty()) error(t, ".ENDIF without .IF");
+        end_line(t);
+        conditionals.pop_back();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// false for the directives the assembler handles itself
+bool Preprocessor::directive(const Token &t) {
+    if(t.equals("INCLUDE")) {
+        include(t);
+    } else if(t.equals("MACRO")) {
+        define_macro(t);
+    } else if(t.equals("REPT")) {
+        repeat(t);
+    } else if(t.equals("SET")) {
+        Token name = raw();
+        if(name.type != TOKEN_IDENTIFIER) error(name, (String("expected name, not ") + name.toString()).c_str());
+        uint32_t v = expr();
+        end_line(t);
+        int c = constant_names.intern(name.text, name.len);
+        if(c == constants.size()) constants.push_back(0);
+        constants[c] = v;
+    } else if(t.equals("ENDM") || t.equals("ENDR")) {
+        error(t, (String(".") + t.toString() + " without a start").c_str());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// relative to the directory of the including file
+String Preprocessor::path(const Token &including, const Token &name) {
+    std::string p(name.text, name.len);
+    if(p[0] != '/') {
+        std::string dir(String(files[including.file]).c_str());
+        size_t slash = dir.rfind('/');
+        if(slash != std::string::npos) p = dir.substr(0, slash + 1) + p;
+    }
+    return String(p.c_str());
+}
+
+void Preprocessor::include(const Token &t) {
+    Token name = raw();
+    if(name.type != TOKEN_STRING || !name.len) error(name, ".INCLUDE expects a file name");
+    end_line(t);
+    nest(t);
+
+    String p = path(t, name);
+    std::map<String, Include>::iterator it = loaded.find(p);
+    if(it == loaded.end()) {
+        Include inc;
+        try {
+            inc.source = Ref<SourceBuffer>(new SourceBuffer(p.c_str()));
+        } catch(Exception &e) {
+            // listed all the same, so creating it counts as a change
+            includes.push_back(p);
+            include_hashes.push_back(0);
+            error(name, e.getMessage().c_str());
+        }
+        files.push_back(p);
+        inc.file = files.size() - 1;
+        includes.push_back(p);
+        include_hashes.push_back(AssemblyCache::hash(inc.source->begin(), inc.source->getSize()));
+        it = loaded.insert(std::make_pair(p, inc)).first;
+    }
+
+    Frame f;
+    f.lexer = new Lexer(it->second.source.get(), it->second.file);
+    f.pos = 0;
+    frames.push_back(f);
+}
+
+/**
+ * the tokens up to the directive closing t, which is consumed. Bodies
+ * may hold other bodies.
+ */
+std::vector<Token> Preprocessor::body(const Token &t, const char *end) {
+    std::vector<Token> tokens;
+    int depth = 0;
+    for(;;) {
+        Token n = raw();
+        if(n.type == TOKEN_EOF) error(t, (String("unterminated .") + t.toString()).c_str());
+        if(n.type == TOKEN_DIRECTIVE) {
+            if(n.equals("MACRO") || n.equals("REPT")) {
+                depth++;
+            } else if(n.equals("ENDM") || n.equals("ENDR")) {
+                if(depth == 0) {
+                    if(!n.equals(end)) error(n, (String("unexpected .") + n.toString()).c_str());
+                    end_line(n);
+                    return tokens;
+                }
+                depth--;
+            }
+        }
+        tokens.push_back(n);
+    }
+}
+
+void Preprocessor::define_macro(const Token &t) {
+    Token name = raw();
+    if(name.type != TOKEN_IDENTIFIER) error(name, (String("expected macro name, not ") + name.toString()).c_str());
+    if(macro_names.find(name.text, name.len) >= 0) {
+        error(name, (String("macro ") + name.toString() + " already defined").c_str());
+    }
+
+    Macro m;
+    for(;;) {
+        Token p = raw();
+        if(line_ended(p)) break;
+        if(p.is(',')) continue;
+        if(p.type != TOKEN_IDENTIFIER) error(p, (String("expected parameter, not ") + p.toString()).c_str());
+        m.params.push_back(p);
+    }
+    m.body = body(t, "ENDM");
+
+    macro_names.intern(name.text, name.len);
+    macros.push_back(m);
+}
+
+void Preprocessor::repeat(const Token &t) {
+    uint32_t count = expr();
+    end_line(t);
+    std::vector<Token> b = body(t, "ENDR");
+    if(!count || b.empty()) return;
+    if((uint64_t) b.size() * count > PREPROCESSOR_MAX_TOKENS) error(t, ".REPT expands to too much");
+    nest(t);
+
+    Frame f;
+    f.lexer = NULL;
+    f.pos = 0;
+    f.tokens.reserve(b.size() * count);
+    for(uint32_t i = 0; i < count; i++) {
+        f.tokens.insert(f.tokens.end(), b.begin(), b.end());
+    }
+    frames.push_back(f);
+}
+
+/**
+ * replays the macro's body with its parameters replaced by the tokens of
+ * the arguments, which run to the end of the line
+ */
+void Preprocessor::expand(const Token &t, int macro) {
+    const Macro &m = macros[macro];
+    std::vector<std::vector<Token> > args(1);
+    for(;;) {
+        Token a = raw();
+        if(line_ended(a)) break;
+        if(a.is(',')) {
+            if(args.back().empty()) error(a, "missing macro argument");
+            args.push_back(std::vector<Token>());
+        } else {
+            args.back().push_back(a);
+        }
+    }
+    if(args.size() == 1 && args[0].empty()) args.clear();
+    if(args.size() != m.params.size()) {
+        error(t, (String("macro ") + t.toString() + " expects " + String::fromInt(m.params.size()) +
+                    " arguments").c_str());
+    }
+    if(!args.empty() && args.back().empty()) error(t, "missing macro argument");
+    nest(t);
+
+    Frame f;
+    f.lexer = NULL;
+    f.pos = 0;
+    for(int i = 0; i < m.body.size(); i++) {
+        const Token &b = m.body[i];
+        int p = -1;
+        for(int j = 0; b.type == TOKEN_IDENTIFIER && j < m.params.size() && p < 0; j++) {
+            if(same(b, m.params[j])) p = j;
+        }
+        if(p < 0) {
+            f.tokens.push_back(b);
+        } else {
+            f.tokens.insert(f.tokens.end(), args[p].begin(), args[p].end());
+        }
+    }
+    frames.push_back(f);
+}
+
+uint32_t Preprocessor::value(const Token &t) {
+    if(t.type == TOKEN_NUMBER) return t.value;
+    if(t.type == TOKEN_IDENTIFIER) {
+        int c = constant_names.find(t.text, t.len);
+        if(c >= 0) return constants[c];
+        error(t, (String("unknown constant ") + t.toString()).c_str());
+    }
+    error(t, (String("expected constant, not ") + t.toString()).c_str());
+    return 0;
+}
+
+// constants added and subtracted
+uint32_t Preprocessor::sum() {
+    uint32_t v = 0;
+    for(;;) {
+        Token t = raw();
+        bool minus = false;
+        if(t.is('-')) {
+            minus = true;
+            t = raw();
+        }
+        uint32_t x = value(t);
+        v += minus ? -x : x;
+
+        const Token &n = raw_peek();
+        if(!n.is('+') && !n.is('-')) return v;
+        if(n.is('+')) raw();
+    }
+}
+
+/**
+ * a sum, or two compared with ==, !=, <, <=, > or >=; comparisons are 1
+ * or 0
+ */
+uint32_t Preprocessor::expr() {
+    uint32_t a = sum();
+    const Token &n = raw_peek();
+    if(!n.is('=') && !n.is('!') && !n.is('<') && !n.is('>')) return a;
+
+    char op = raw().text[0];
+    bool equal = raw_peek().is('=');
+    if(equal) raw();
+    else if(op == '=' || op == '!') error(raw_peek(), "expected =");
+
+    uint32_t b = sum();
+    switch(op) {
+        case '=': return a == b;
+        case '!': return a != b;
+        case '<': return equal ? a <= b : a < b;
+        default: return equal ? a >= b : a > b;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef _BOSTEK_PREPROCESSOR_HPP
+#define _BOSTEK_PREPROCESSOR_HPP
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "lexer.hpp"
+#include "symbolTable.hpp"
+#include "cpplib/common/ref.hpp"
+#include "cpplib/common/string.hpp"
+
+#define PREPROCESSOR_DEPTH 64 // includes and expansions inside each other
+#define PREPROCESSOR_MAX_TOKENS 0x1000000 // in one .REPT expansion
+
+/**
+ * Token stream the assembler reads, with the preprocessor directives
+ * already carried out:
+ *
+ *   .INCLUDE "file"            relative to the including file
+ *   .MACRO name a, b ... .ENDM
+ *   .REPT count ... .ENDR
+ *   .SET name value            a constant, for operands and .IF
+ *   .IF value / .IFDEF name / .IFNDEF name ... .ELSE ... .ENDIF
+ *
+ * A macro is used like a mnemonic, with its arguments separated by
+ * commas. Macro and .REPT bodies are kept as tokens and replayed, never
+ * rescanned as text. Every included file is read once and shared by
+ * later includes of it. The end of an included file ends its last line.
+ * Each is hashed as it is read, so a cache can be keyed on exactly what
+ * was assembled, even if the file is written again meanwhile.
+ *
+ * Files are numbered by their place in the list passed in, which the
+ * preprocessor appends to; tokens carry that number.
+ */
+class Preprocessor {
+    struct Frame {
+        Lexer *lexer; // or else replaying tokens
+        std::vector<Token> tokens;
+        int pos;
+    };
+
+    struct Macro {
+        std::vector<Token> params;
+        std::vector<Token> body;
+    };
+
+    struct Include {
+        Ref<SourceBuffer> source;
+        int file;
+    };
+
+    struct Conditional {
+        bool active; // in the branch being assembled
+        bool taken; // some branch has been
+        bool enclosing; // everything outside was active
+    };
+
+    std::vector<String> &files;
+    std::vector<Frame> frames;
+    std::map<String, Include> loaded; // by path
+    std::vector<String> includes;
+    std::vector<uint64_t> include_hashes; // of the bytes read, as AssemblyCache::hash
+
+    SymbolTable macro_names;
+    std::vector<Macro> macros;
+    SymbolTable constant_names;
+    std::vector<uint32_t> constants;
+    std::vector<Conditional> conditionals;
+
+    Token pending; // pushed back by raw_peek
+    bool has_pending;
+    Token lookahead;
+    bool peeked;
+    bool at_start; // of a statement, where a macro may be used
+    bool label_start;
+
+    Token raw();
+    const Token &raw_peek();
+    Token scan();
+    void nest(const Token &t);
+    void end_line(const Token &directive);
+    void skip_line();
+    bool directive(const Token &t);
+    bool conditional(const Token &t);
+    void include(const Token &t);
+    void define_macro(const Token &t);
+    void repeat(const Token &t);
+    void expand(const Token &t, int macro);
+    std::vector<Token> body(const Token &t, const char *end);
+    uint32_t value(const Token &t);
+    uint32_t sum();
+    uint32_t expr();
+    String path(const Token &including, const Token &name);
+
+    public:
+    Preprocessor(SourceBuffer *source, std::vector<String> &files);
+    ~Preprocessor();
+
+    Token next();
+    const Token &peek();
+    void error(const Token &t, const char *msg) const;
+    const std::vector<String> &getIncludes() const { return includes; }
+    const std::vector<uint64_t> &getIncludeHashes() const { return include_hashes; }
+};
+
+#endif
@@ -0,0 +1,364 @@
+#include "bcpu.hpp"
+#include "memory.hpp"
+#include "northBridge.hpp"
+#include "dmaController.hpp"
+#include "timer.hpp"
+#include "uart.hpp"
+#include "blockDevice.hpp"
+#include "videoController.hpp"
+#include "perfCounters.hpp"
+#include "coverage.hpp"
+#include "debugger.hpp"
+#include "gdbStub.hpp"
+#include "sparseImage.hpp"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+#include "cpplib/common/string.hpp"
+#include "cpplib/common/exception.hpp"
+#include "cpplib/common/ref.hpp"
+
+using Bostek::Cpu::BCpu;
+
+#define RUN_CHUNK 0x1000000 // clks between checks for the cycle limit
+
+struct DeviceParam {
+    String kind;
+    uint32_t base;
+    String arg; // block device image
+};
+
+struct Params {
+    String image;
+    uint64_t memsize;
+    uint32_t load;
+    uint32_t pc;
+    uint32_t sp;
+    int cores;
+    String engine;
+    uint64_t limit;
+    FaultAction faults;
+    bool hugepages;
+    String frame; // tga to save the last video frame to
+    String coverage; // file to merge coverage into
+    String symbols; // map to label the coverage report with
+    String gdb; // port or unix socket path to wait for gdb on
+    std::vector<DeviceParam> devices;
+};
+
+/**
+ * One machine; with more than one core each gets its own copy of the
+ * image, memory and devices, run on its own thread
+ */
+struct Machine {
+    Params *params;
+    int core;
+    Ref<NorthBridge> nbr; // owns the rest
+    BCpu *cpu;
+    Memory *mem;
+    VideoController *video;
+    Ref<Coverage> coverage;
+    uint64_t clks;
+    double seconds;
+    const char *error;
+};
+
+void error(const char *msg) {
+    printf("bostek-run: %s\n", msg);
+    exit(-1);
+}
+
+void usage() {
+    printf("usage: bostek-run [options] image\n"
+           "  -m size       memory size, with optional K/M/G suffix (default 1M)\n"
+           "  -l addr       address to load a raw image at (default 0)\n"
+           "  -p addr       initial pc (default 0x1000)\n"
+           "  -s addr       initial sp (default: top of memory)\n"
+           "  -c n          independent cores, one thread each (default 1)\n"
+           "  -e engine     execution engine: interp (default)\n"
+           "  -n clks       stop after this many clks (default: run to HLT)\n"
+           "  -f action     memory faults: ignore (default), trap or stop\n"
+           "  -d dev@addr   attach a device: dma, timer, uart, video, perf or\n"
+           "                block@addr:file\n"
+           "  -o file.tga   save the final video frame\n"
+           "  -C file.cov   merge code coverage from every core into file\n"
+           "  -S file.map   print a coverage report labelled from a symbol map\n"
+           "  -g port|path  wait for gdb on a localhost port or a unix socket\n"
+           "  -H            back memory with huge pages\n");
+    exit(-1);
+}
+
+uint64_t parse_number(const char *s, bool suffix=false) {
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+    if(end == s) error("invalid number");
+    if(suffix) {
+        switch(*end) {
+            case 'k': case 'K': v <<= 10; end++; break;
+            case 'm': case 'M': v <<= 20; end++; break;
+            case 'g': case 'G': v <<= 30; end++; break;
+        }
+    }
+    if(*end) error("invalid number");
+    return v;
+}
+
+DeviceParam parse_device(const char *s) {
+    DeviceParam d;
+    const char *at = strchr(s, '@');
+    if(!at) error("expect device as kind@addr");
+    d.kind = std::string(s, at - s).c_str();
+
+    const char *colon = strchr(at, ':');
+    std::string addr = colon ? std::string(at + 1, colon - at - 1) : std::string(at + 1);
+    d.base = parse_number(addr.c_str());
+    if(colon) d.arg = String(colon + 1);
+
+    if(d.kind != "dma" && d.kind != "timer" && d.kind != "uart" && d.kind != "video" && d.kind != "block" && d.kind != "perf") {
+        error("unknown device");
+    }
+    if(d.kind == "block" && d.arg.empty()) error("expect block@addr:file");
+    return d;
+}
+
+Params parse_params(int argc, char **argv) {
+    Params params;
+    params.memsize = 0x100000;
+    params.load = 0;
+    params.pc = 0x1000;
+    params.sp = 0;
+    params.cores = 1;
+    params.engine = "interp";
+    params.limit = UINT64_MAX;
+    params.faults = FAULT_IGNORE;
+    params.hugepages = false;
+
+    while(optind < argc) {
+        char c = getopt(argc, argv, "-m:l:p:s:c:e:n:f:d:o:C:S:g:Hh");
+        switch(c) {
+            case 'm': params.memsize = parse_number(optarg, true); break;
+            case 'l': params.load = parse_number(optarg); break;
+            case 'p': params.pc = parse_number(optarg); break;
+            case 's': params.sp = parse_number(optarg); break;
+            case 'c': params.cores = parse_number(optarg); break;
+            case 'e': params.engine = optarg; break;
+            case 'n': params.limit = parse_number(optarg, true); break;
+            case 'd': params.devices.push_back(parse_device(optarg)); break;
+            case 'o': params.frame = optarg; break;
+            case 'C': params.coverage = optarg; break;
+            case 'S': params.symbols = optarg; break;
+            case 'g': params.gdb = optarg; break;
+            case 'H': params.hugepages = true; break;
+            case 'f':
+                if(!strcmp(optarg, "ignore")) params.faults = FAULT_IGNORE;
+                else if(!strcmp(optarg, "trap")) params.faults = FAULT_TRAP;
+                else if(!strcmp(optarg, "stop")) params.faults = FAULT_STOP;
+                else error("fault action must be ignore, trap or stop");
+                break;
+            case 'h':
+            case '?':
+                usage();
+                break;
+            default:
+                if(!params.image.empty()) error("expect one image");
+                params.image = optarg;
+                break;
+        }
+    }
+
+    if(params.image.empty()) usage();
+    if(params.engine != "interp") error("unknown engine; only interp is available");
+    if(params.cores < 1) error("expect at least one core");
+    if(!params.gdb.empty() && params.cores > 1) error("-g expects one core");
+    if(!params.memsize || params.memsize > 0x100000000ULL) error("memory size must be 1 byte to 4G");
+    if(!params.sp) params.sp = params.memsize > 0xFFFFFFFF ? 0xFFFFFFFC : params.memsize & ~3;
+    return params;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void build(Machine *m, SparseImage *image) {
+    Params *p = m->params;
+    m->mem = new Memory(p->memsize, p->hugepages ? MEMORY_HUGEPAGE : MEMORY_DEFAULT);
+    m->mem->bindLocalNode();
+    for(int i = 0; i < image->getSegmentCount(); i++) {
+        const ImageSegment &s = image->getSegment(i);
+        m->mem->fill(s.addr, s.data.size(), (void*) &s.data[0]);
+    }
+    m->cpu = new BCpu(p->pc, p->sp);
+    m->nbr.reset(new NorthBridge);
+    m->nbr->attachCpu(m->cpu);
+    m->nbr->attachMemory(m->mem);
+    m->nbr->setFaultAction(p->faults);
+    m->video = NULL;
+    if(!p->coverage.empty() || !p->symbols.empty()) {
+        m->coverage.reset(new Coverage);
+        m->cpu->setCoverage(m->coverage.get());
+    }
+
+    for(int i = 0; i < p->devices.size(); i++) {
+        DeviceParam &d = p->devices[i];
+        Device *dev;
+        if(d.kind == "dma") dev = new DmaController;
+        else if(d.kind == "perf") dev = new PerfCounters;
+        else if(d.kind == "timer") dev = new Timer;
+        else if(d.kind == "uart") dev = new Uart(1, m->core == 0 ? 0 : -1); // one reader for stdin
+        else if(d.kind == "block") dev = new BlockDevice(d.arg.c_str());
+        else dev = m->video = new VideoController;
+        m->nbr->attachDevice(dev, d.base);
+    }
+}
+
+/**
+ * lets gdb drive the machine until it detaches; false if it killed it
+ */
+bool debug_machine(Machine *m) {
+    const char *where = m->params->gdb.c_str();
+    char *end;
+    long port = strtol(where, &end, 10);
+
+    Ref<Debugger> dbg(new Debugger(m->nbr.get()));
+    Ref<GdbStub> stub(new GdbStub(dbg.get(), m->cpu));
+    if(*where && !*end) stub->listenTcp(port);
+    else stub->listenUnix(where);
+    printf("bostek-run: waiting for gdb on %s\n", where);
+    fflush(stdout);
+
+    stub->serve();
+    return !stub->wasKilled();
+}
+
+void *run_machine(void *arg) {
+    Machine *m = (Machine*) arg;
+    m->error = NULL;
+    m->clks = 0;
+    m->seconds = 0;
+
+    try {
+        Ref<SparseImage> image(SparseImage::load(m->params->image.c_str(), m->params->load));
+        build(m, image.get());
+    } catch(Exception &e) {
+        m->error = strdup(e.getMessage().c_str());
+        return NULL;
+    }
+
+    double start = now();
+    uint64_t limit = m->params->limit;
+    if(!m->params->gdb.empty()) {
+        try {
+            if(!debug_machine(m)) limit = 0;
+        } catch(Exception &e) {
+            m->error = strdup(e.getMessage().c_str());
+            return NULL;
+        }
+        m->clks = m->nbr->getClocks();
+    }
+    while(m->clks < limit) {
+        uint64_t n = limit - m->clks < RUN_CHUNK ? limit - m->clks : RUN_CHUNK;
+        uint64_t ran = m->nbr->run(n);
+        m->clks += ran;
+        if(ran < n) break; // halted, faulted or stopped
+    }
+    m->seconds = now() - start;
+    m->cpu->flushCoverage();
+    return NULL;
+}
+
+void print_state(Machine *m) {
+    BCpu *cpu = m->cpu;
+    const MemoryFault *f = m->nbr->getFault();
+    const char *reason = cpu->isHalted() ? "halted" : f ? "fault" : "clk limit";
+
+    printf("core %d: %s after %llu clks\n", m->core, reason, (unsigned long long) m->clks);
+    if(f) printf("  fault   %08x (%s)\n", f->addr,
+            f->access == PAGE_TRAP_WRITE ? "write" : f->access == PAGE_TRAP_EXEC ? "exec" : "read");
+    printf("  pc %08x  sp %08x  sb %02x\n", cpu->state.pc, cpu->state.sp, cpu->state.sb);
+    for(int i = 0; i < 4; i++) {
+        printf("  %c  %08x  f%c %g\n", 'A' + i, cpu->state.registers[i], 'A' + i, cpu->state.fregisters[i]);
+    }
+
+    uint64_t idle = m->nbr->getIdleClocks();
+    uint64_t executed = cpu->getPerfCount(PERF_INSTRUCTIONS);
+    printf("  %llu instructions, %llu/%llu branches taken/not, %llu loads, %llu stores, %llu interrupts\n",
+            (unsigned long long) executed,
+            (unsigned long long) cpu->getPerfCount(PERF_BRANCHES_TAKEN),
+            (unsigned long long) cpu->getPerfCount(PERF_BRANCHES_NOT_TAKEN),
+            (unsigned long long) cpu->getPerfCount(PERF_LOADS),
+            (unsigned long long) cpu->getPerfCount(PERF_STORES),
+            (unsigned long long) cpu->getPerfCount(PERF_INTERRUPTS));
+    printf("  %.3f s, %llu idle clks, %.2f MIPS\n", m->seconds, (unsigned long long) idle,
+            m->seconds > 0 ? executed / m->seconds / 1e6 : 0.0);
+}
+
+int main(int argc, char **argv) {
+    Params p = parse_params(argc, argv);
+
+    std::vector<Machine> machines(p.cores);
+    std::vector<pthread_t> threads(p.cores);
+    double start = now();
+    for(int i = 0; i < p.cores; i++) {
+        machines[i].params = &p;
+        machines[i].core = i;
+        if(pthread_create(&threads[i], NULL, run_machine, &machines[i]) != 0) error("unable to start thread");
+    }
+
+    uint64_t executed = 0;
+    int status = 0;
+    Ref<Coverage> coverage;
+    if(!p.coverage.empty() || !p.symbols.empty()) {
+        coverage.reset(new Coverage);
+        if(!p.coverage.empty() && access(p.coverage.c_str(), F_OK) == 0 && !coverage->load(p.coverage.c_str())) {
+            error("unable to read coverage file");
+        }
+    }
+
+    for(int i = 0; i < p.cores; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = now() - start;
+
+    for(int i = 0; i < p.cores; i++) {
+        Machine &m = machines[i];
+        if(m.error) {
+            printf("core %d: %s\n", i, m.error);
+            status = -1;
+            continue;
+        }
+        print_state(&m);
+        executed += m.cpu->getPerfCount(PERF_INSTRUCTIONS);
+        if(m.nbr->getFault()) status = 1;
+
+        if(i == 0 && !p.frame.empty()) {
+            if(!m.video || !m.video->saveFrame(p.frame.c_str())) printf("unable to save frame\n");
+        }
+        if(coverage) coverage->merge(m.coverage.get());
+        m.nbr.reset();
+    }
+
+    if(coverage) {
+        printf("coverage: %llu bytes executed\n", (unsigned long long) coverage->getExecutedCount());
+        if(!p.coverage.empty() && !coverage->save(p.coverage.c_str())) printf("unable to save coverage\n");
+        if(!p.symbols.empty()) {
+            std::map<uint32_t, String> symbols;
+            if(!loadSymbols(p.symbols.c_str(), &symbols)) error("unable to read symbol map");
+            coverage->report(stdout, symbols);
+        }
+    }
+
+    if(p.cores > 1) {
+        printf("total: %.3f s, %.2f MIPS\n", seconds, seconds > 0 ? executed / seconds / 1e6 : 0.0);
+    }
+    return status;
+}
@@ -0,0 +1,204 @@
+#include "sparseImage.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lexer.hpp"
+#include "cpplib/common/exception.hpp"
+#include "cpplib/common/string.hpp"
+
+static uint64_t segment_end(const ImageSegment &s) {
+    return (uint64_t) s.addr + s.data.size();
+}
+
+static void put_long(FILE *f, uint32_t v) {
+    uint8_t b[4] = { (uint8_t) v, (uint8_t) (v >> 8), (uint8_t) (v >> 16), (uint8_t) (v >> 24) };
+    fwrite(b, 1, 4, f);
+}
+
+static uint32_t get_long(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+SparseImage::SparseImage() {
+}
+
+SparseImage::~SparseImage() {
+}
+
+/**
+ * copies len bytes to addr, over anything already there
+ */
+void SparseImage::write(uint32_t addr, const uint8_t *data, uint32_t len) {
+    if(!len) return;
+    uint64_t end = (uint64_t) addr + len;
+    if(end > 0x100000000ULL) throw Exception("image write past the end of the address space");
+
+    // segments i up to j touch the new bytes
+    int lo = 0;
+    int hi = segments.size();
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(segment_end(segments[mid]) < addr) lo = mid + 1;
+        else hi = mid;
+    }
+    int i = lo;
+    int j = i;
+    while(j < segments.size() && segments[j].addr <= end) j++;
+
+    if(i == j) {
+        ImageSegment s;
+        s.addr = addr;
+        s.data.assign(data, data + len);
+        segments.insert(segments.begin() + i, s);
+        return;
+    }
+
+    // growing one segment at its end, as sections laid out in order do
+    ImageSegment &s = segments[i];
+    if(j == i + 1 && s.addr <= addr) {
+        if(end - s.addr > s.data.size()) s.data.resize(end - s.addr);
+        memcpy(&s.data[addr - s.addr], data, len);
+        return;
+    }
+
+    uint32_t first = s.addr < addr ? s.addr : addr;
+    uint64_t last = segment_end(segments[j - 1]) > end ? segment_end(segments[j - 1]) : end;
+    std::vector<uint8_t> merged(last - first, 0);
+    for(int k = i; k < j; k++) {
+        memcpy(&merged[segments[k].addr - first], &segments[k].data[0], segments[k].data.size());
+    }
+    memcpy(&merged[addr - first], data, len);
+    s.addr = first;
+    s.data.swap(merged);
+    segments.erase(segments.begin() + i + 1, segments.begin() + j);
+}
+
+/**
+ * the bytes from addr to addr + len, to change in place, or NULL unless
+ * they were all written
+ */
+uint8_t *SparseImage::at(uint32_t addr, uint32_t len) {
+    int lo = 0;
+    int hi = segments.size();
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(segments[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if(!lo) return NULL;
+    ImageSegment &s = segments[lo - 1];
+    if((uint64_t) addr + len > segment_end(s)) return NULL;
+    return &s.data[0] + (addr - s.addr);
+}
+
+/**
+ * copies addr to addr + len out, with zeros between segments
+ */
+void SparseImage::read(uint32_t addr, uint8_t *out, uint32_t len) const {
+    memset(out, 0, len);
+    uint64_t end = (uint64_t) addr + len;
+    for(int i = 0; i < segments.size(); i++) {
+        const ImageSegment &s = segments[i];
+        if(s.addr >= end) break;
+        if(segment_end(s) <= addr) continue;
+        uint32_t from = s.addr > addr ? s.addr : addr;
+        uint64_t to = segment_end(s) < end ? segment_end(s) : end;
+        memcpy(out + (from - addr), &s.data[from - s.addr], to - from);
+    }
+}
+
+/**
+ * copies every segment into a dump of the address space from 0, which
+ * they have to fit in
+ */
+void SparseImage::flatten(uint8_t *out, uint32_t size) const {
+    if(!segments.empty() && segment_end(segments.back()) > size) {
+        throw Exception("address out of range of the image");
+    }
+    for(int i = 0; i < segments.size(); i++) {
+        memcpy(out + segments[i].addr, &segments[i].data[0], segments[i].data.size());
+    }
+}
+
+uint64_t SparseImage::getDataSize() const {
+    uint64_t n = 0;
+    for(int i = 0; i < segments.size(); i++) n += segments[i].data.size();
+    return n;
+}
+
+/**
+ * reads a BIMG file, or a raw dump, which goes at raw_addr
+ */
+SparseImage *SparseImage::load(const char *filename, uint32_t raw_addr) {
+    SourceBuffer *file = new SourceBuffer(filename);
+    SparseImage *image = new SparseImage;
+    try {
+        const uint8_t *p = (const uint8_t*) file->begin();
+        const uint8_t *end = (const uint8_t*) file->end();
+        if(file->getSize() < 4 || memcmp(p, IMAGE_MAGIC, 4)) {
+            if((uint64_t) raw_addr + file->getSize() > 0x100000000ULL) {
+                throw Exception(String(filename) + ": image does not fit in the address space");
+            }
+            image->write(raw_addr, p, file->getSize());
+        } else {
+            String corrupt = String(filename) + ": corrupt image";
+            if(end - p < 12) throw Exception(corrupt);
+            if(get_long(p + 4) != IMAGE_VERSION) throw Exception(String(filename) + ": unsupported image version");
+            uint32_t n = get_long(p + 8);
+            p += 12;
+            for(uint32_t i = 0; i < n; i++) {
+                if(end - p < 8) throw Exception(corrupt);
+                uint32_t addr = get_long(p);
+                uint32_t size = get_long(p + 4);
+                p += 8;
+                if(end - p < size || (uint64_t) addr + size > 0x100000000ULL) throw Exception(corrupt);
+                image->write(addr, p, size);
+                p += size;
+            }
+            if(p != end) throw Exception(corrupt);
+        }
+    } catch(...) {
+        image->release();
+        file->release();
+        throw;
+    }
+    file->release();
+    return image;
+}
+
+void SparseImage::save(const char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if(!f) throw Exception(String("unable to open ") + String(filename));
+    fwrite(IMAGE_MAGIC, 1, 4, f);
+    put_long(f, IMAGE_VERSION);
+    put_long(f, segments.size());
+    for(int i = 0; i < segments.size(); i++) {
+        put_long(f, segments[i].addr);
+        put_long(f, segments[i].data.size());
+        fwrite(&segments[i].data[0], 1, segments[i].data.size(), f);
+    }
+    bool ok = !ferror(f);
+    if(fclose(f) != 0 || !ok) throw Exception(String("unable to write ") + String(filename));
+}
+
+/**
+ * writes a raw dump from address 0 to the end of the last segment, for
+ * tools that want one
+ */
+void SparseImage::saveRaw(const char *filename) {
+    FILE *f = fopen(filename, "wb");
+    if(!f) throw Exception(String("unable to open ") + String(filename));
+    static const uint8_t zeros[0x1000] = {};
+    uint64_t pos = 0;
+    for(int i = 0; i < segments.size(); i++) {
+        for(; pos < segments[i].addr; pos += sizeof(zeros)) {
+            fwrite(zeros, 1, segments[i].addr - pos < sizeof(zeros) ? segments[i].addr - pos : sizeof(zeros), f);
+        }
+        pos = segments[i].addr;
+        fwrite(&segments[i].data[0], 1, segments[i].data.size(), f);
+        pos += segments[i].data.size();
+    }
+    bool ok = !ferror(f);
+    if(fclose(f) != 0 || !ok) throw Exception(String("unable to write ") + String(filename));
+}
@@ -0,0 +1,48 @@
+#ifndef _BOSTEK_SPARSEIMAGE_HPP
+#define _BOSTEK_SPARSEIMAGE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "cpplib/common/object.hpp"
+
+#define IMAGE_MAGIC "BIMG"
+#define IMAGE_VERSION 1
+
+struct ImageSegment {
+    uint32_t addr;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * Memory contents anywhere in the 32 bit address space, kept as the
+ * ranges that were written; everything else reads as zero. Segments are
+ * in address order, and ones that touch are merged, so a program and its
+ * data usually make one.
+ *
+ * On disk this is a BIMG file: "BIMG" version segment_count, then
+ * { addr size data } per segment; all integers are little endian. Files
+ * without the magic load as a raw dump, so older images still work.
+ */
+class SparseImage : public Object {
+    std::vector<ImageSegment> segments;
+
+    public:
+    SparseImage();
+    virtual ~SparseImage();
+
+    void write(uint32_t addr, const uint8_t *data, uint32_t len);
+    uint8_t *at(uint32_t addr, uint32_t len);
+    void read(uint32_t addr, uint8_t *out, uint32_t len) const;
+    void flatten(uint8_t *out, uint32_t size) const;
+
+    int getSegmentCount() const { return segments.size(); }
+    const ImageSegment &getSegment(int i) const { return segments[i]; }
+    uint64_t getDataSize() const;
+
+    static SparseImage *load(const char *filename, uint32_t raw_addr = 0);
+    void save(const char *filename);
+    void saveRaw(const char *filename);
+};
+
+#endif
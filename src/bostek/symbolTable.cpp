@@ -0,0 +1,85 @@
+#include "symbolTable.hpp"
+
+#include <string.h>
+
+#define SYMBOL_TABLE_INITIAL 256 // slots; always a power of two
+
+SymbolTable::SymbolTable() {
+    Slot empty = { 0, -1 };
+    slots.assign(SYMBOL_TABLE_INITIAL, empty);
+}
+
+// FNV-1a
+uint32_t SymbolTable::hash(const char *text, int len) {
+    uint32_t h = 2166136261u;
+    for(int i = 0; i < len; i++) {
+        h ^= (uint8_t) text[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// slot holding the name, or the empty slot it would go in
+int SymbolTable::probe(const char *text, int len, uint32_t h) const {
+    uint32_t mask = slots.size() - 1;
+    uint32_t i = h & mask;
+    for(;;) {
+        const Slot &s = slots[i];
+        if(s.index < 0) return i;
+        if(s.hash == h) {
+            const Name &n = names[s.index];
+            if(n.len == (uint32_t) len && !memcmp(&chars[n.offset], text, len)) return i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// doubles the slots once they are half full
+void SymbolTable::grow() {
+    Slot empty = { 0, -1 };
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, empty);
+
+    uint32_t mask = slots.size() - 1;
+    for(int i = 0; i < old.size(); i++) {
+        if(old[i].index < 0) continue;
+        uint32_t j = old[i].hash & mask;
+        while(slots[j].index >= 0) j = (j + 1) & mask;
+        slots[j] = old[i];
+    }
+}
+
+/**
+ * number of the name, or -1 if it has not been interned
+ */
+int SymbolTable::find(const char *text, int len) const {
+    return slots[probe(text, len, hash(text, len))].index;
+}
+
+/**
+ * number of the name, entering it if it is new
+ */
+int SymbolTable::intern(const char *text, int len) {
+    uint32_t h = hash(text, len);
+    int i = probe(text, len, h);
+    if(slots[i].index >= 0) return slots[i].index;
+
+    Name n = { (uint32_t) chars.size(), (uint32_t) len, h };
+    chars.insert(chars.end(), text, text + len);
+    chars.push_back('\0');
+    slots[i].hash = h;
+    slots[i].index = names.size();
+    names.push_back(n);
+
+    if(names.size() * 2 > slots.size()) grow();
+    return names.size() - 1;
+}
+
+const char *SymbolTable::name(int index) const {
+    return &chars[names[index].offset];
+}
+
+int SymbolTable::size() const {
+    return names.size();
+}
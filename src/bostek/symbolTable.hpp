@@ -0,0 +1,44 @@
+#ifndef _BOSTEK_SYMBOLTABLE_HPP
+#define _BOSTEK_SYMBOLTABLE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Interned names, numbered in the order they were first seen.
+ *
+ * Lookups take a span, so token text is looked up without copying it.
+ * Open addressing with linear probing; each slot keeps the name's hash,
+ * so a probe only compares the text when the hashes match.
+ */
+class SymbolTable {
+    struct Slot {
+        uint32_t hash;
+        int index; // -1 if empty
+    };
+
+    struct Name {
+        uint32_t offset; // into chars
+        uint32_t len;
+        uint32_t hash;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<Name> names;
+    std::vector<char> chars; // every name, NUL terminated
+
+    int probe(const char *text, int len, uint32_t hash) const;
+    void grow();
+
+    public:
+    SymbolTable();
+
+    static uint32_t hash(const char *text, int len);
+
+    int find(const char *text, int len) const;
+    int intern(const char *text, int len);
+    const char *name(int index) const;
+    int size() const;
+};
+
+#endif
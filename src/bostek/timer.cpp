@@ -0,0 +1,100 @@
+#include "timer.hpp"
+
+#include <string.h>
+
+Timer::Timer() : base_count(0), base_clock(0), scheduled(false) {
+    memset(regs, 0, sizeof(regs));
+}
+
+Timer::~Timer() {
+}
+
+uint32_t Timer::reg(int r) {
+    return (regs[r+3] << 24) | (regs[r+2] << 16) | (regs[r+1] << 8) | regs[r];
+}
+
+uint32_t Timer::divisor() {
+    return regs[TIMER_PRESCALE] + 1;
+}
+
+uint32_t Timer::count() {
+    if(!(regs[TIMER_CTRL] & TIMER_CTRL_ENABLE)) return base_count;
+    return base_count + (nbr->getClocks() - base_clock) / divisor();
+}
+
+void Timer::setCount(uint32_t v) {
+    base_count = v;
+    base_clock = nbr->getClocks();
+}
+
+/**
+ * schedules the next match, dropping any pending one
+ */
+void Timer::reschedule() {
+    if(scheduled) nbr->cancel(this, 0);
+    scheduled = false;
+    if(!(regs[TIMER_CTRL] & TIMER_CTRL_ENABLE)) return;
+
+    // ticks until the count next equals compare; a full wrap if it already does
+    uint64_t ticks = (uint32_t) (reg(TIMER_COMPARE) - base_count);
+    if(!ticks) ticks = 0x100000000ULL;
+
+    uint64_t when = base_clock + ticks * divisor();
+    nbr->schedule(when - nbr->getClocks(), this, 0);
+    scheduled = true;
+}
+
+uint32_t Timer::getSize() {
+    return TIMER_SIZE;
+}
+
+uint8_t Timer::readb(uint32_t offset) {
+    if(offset < TIMER_COMPARE) return count() >> (8 * offset);
+    if(offset >= TIMER_SIZE) return 0x00;
+    return regs[offset];
+}
+
+void Timer::writeb(uint32_t offset, uint8_t v) {
+    uint32_t c = count();
+    if(offset < TIMER_COMPARE) {
+        int shift = 8 * offset;
+        setCount((c & ~(0xFF << shift)) | (v << shift));
+        reschedule();
+        return;
+    }
+
+    switch(offset) {
+        case TIMER_STATUS:
+            regs[TIMER_STATUS] &= ~(v & TIMER_STATUS_MATCH);
+            return;
+        case TIMER_CTRL:
+        case TIMER_PRESCALE:
+            // rebase so the count so far is kept across the change
+            regs[offset] = v;
+            setCount(c);
+            reschedule();
+            return;
+        default:
+            if(offset >= TIMER_SIZE) return;
+            regs[offset] = v;
+            if(offset < TIMER_CTRL) { // compare; counted from the live count, not the last base
+                setCount(c);
+                reschedule();
+            }
+            return;
+    }
+}
+
+void Timer::event(int id) {
+    scheduled = false;
+    regs[TIMER_STATUS] |= TIMER_STATUS_MATCH;
+
+    if(regs[TIMER_CTRL] & TIMER_CTRL_PERIODIC) {
+        setCount(0);
+    } else {
+        setCount(reg(TIMER_COMPARE));
+    }
+    reschedule();
+
+    if(regs[TIMER_CTRL] & TIMER_CTRL_IRQ) nbr->raiseIrq(regs[TIMER_IVEC]);
+}
@@ -0,0 +1,54 @@
+#ifndef _BOSTEK_TIMER_HPP
+#define _BOSTEK_TIMER_HPP
+
+#include "device.hpp"
+
+enum TimerRegister {
+    TIMER_COUNT=0x00, // long
+    TIMER_COMPARE=0x04, // long
+    TIMER_CTRL=0x08,
+    TIMER_STATUS=0x09,
+    TIMER_IVEC=0x0A,
+    TIMER_PRESCALE=0x0B, // count advances every PRESCALE+1 clks
+    TIMER_SIZE=0x0C,
+};
+
+enum TimerCtrl {
+    TIMER_CTRL_ENABLE=0x01,
+    TIMER_CTRL_PERIODIC=0x02, // count restarts from 0 on a match
+    TIMER_CTRL_IRQ=0x04, // raise TIMER_IVEC on a match
+};
+
+enum TimerStatus {
+    TIMER_STATUS_MATCH=0x01, // write 1 to clear
+};
+
+/**
+ * Counter/compare timer
+ *
+ * The count is not stepped per clk; it is worked out from the clock when
+ * read, and a match is a single event scheduled for the clk it happens on.
+ */
+class Timer : public Device {
+    uint8_t regs[TIMER_SIZE];
+    uint32_t base_count; // count at base_clock
+    uint64_t base_clock;
+    bool scheduled;
+
+    uint32_t reg(int r);
+    uint32_t divisor();
+    uint32_t count();
+    void setCount(uint32_t v);
+    void reschedule();
+
+    public:
+    Timer();
+    virtual ~Timer();
+
+    virtual uint32_t getSize();
+    virtual uint8_t readb(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+    virtual void event(int id);
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "uart.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+Uart::Uart(int _txfd, int _rxfd) : txfd(_txfd), rxfd(_rxfd), tx_end(0), outlen(0),
+        rxhead(0), rxcount(0), inpos(0), inlen(0), rx_scheduled(false), rx_eof(_rxfd < 0) {
+    memset(regs, 0, sizeof(regs));
+}
+
+Uart::~Uart() {
+    flush();
+}
+
+/**
+ * writes out everything queued for the host
+ */
+void Uart::flush() {
+    int n = 0;
+    while(n < outlen) {
+        ssize_t r = write(txfd, outbuf + n, outlen - n);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break; // nowhere to put it; drop the rest
+        n += r;
+    }
+    outlen = 0;
+}
+
+int Uart::txCount() {
+    uint64_t now = nbr->getClocks();
+    if(tx_end <= now) return 0;
+    return (tx_end - now + UART_BYTE_CLKS - 1) / UART_BYTE_CLKS;
+}
+
+void Uart::send(uint8_t v) {
+    if(txCount() >= UART_FIFO_SIZE) {
+        regs[UART_STATUS] |= UART_STATUS_OVERRUN;
+        return;
+    }
+
+    uint64_t now = nbr->getClocks();
+    tx_end = (tx_end > now ? tx_end : now) + UART_BYTE_CLKS;
+    if(regs[UART_CTRL] & UART_CTRL_TX_IRQ) {
+        nbr->cancel(this, UART_EVENT_TX);
+        nbr->schedule(tx_end - now, this, UART_EVENT_TX);
+    }
+
+    if(!outlen && txfd >= 0) nbr->schedule(UART_FLUSH_CLKS, this, UART_EVENT_FLUSH);
+    outbuf[outlen++] = v;
+    if(outlen == UART_BUFFER_SIZE) {
+        nbr->cancel(this, UART_EVENT_FLUSH);
+        flush();
+    }
+}
+
+uint8_t Uart::receive() {
+    startRx();
+    if(!rxcount) return 0x00;
+    uint8_t v = rxfifo[rxhead];
+    rxhead = (rxhead + 1) % UART_FIFO_SIZE;
+    rxcount--;
+    return v;
+}
+
+/**
+ * starts feeding the rx fifo. Deferred until the guest first touches the
+ * uart, since nothing can be scheduled before it is attached.
+ */
+void Uart::startRx() {
+    if(rx_scheduled || rx_eof) return;
+    rx_scheduled = true;
+    nbr->schedule(UART_BYTE_CLKS, this, UART_EVENT_RX);
+}
+
+/**
+ * moves one byte from the host into the rx fifo, and schedules the next
+ */
+void Uart::pollRx() {
+    rx_scheduled = false;
+    if(rxcount == UART_FIFO_SIZE) {
+        // the guest is behind; hold the input rather than dropping it
+        rx_scheduled = true;
+        nbr->schedule(UART_BYTE_CLKS, this, UART_EVENT_RX);
+        return;
+    }
+
+    if(inpos == inlen) {
+        // never block the cpu on a pipe or terminal; the fd is left as it was
+        struct pollfd pfd = { rxfd, POLLIN, 0 };
+        if(poll(&pfd, 1, 0) == 0) {
+            rx_scheduled = true;
+            nbr->schedule(UART_RX_POLL_CLKS, this, UART_EVENT_RX);
+            return;
+        }
+
+        ssize_t r = read(rxfd, inbuf, sizeof(inbuf));
+        if(r == 0) {
+            rx_eof = true;
+            return;
+        }
+        if(r < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                rx_eof = true;
+                return;
+            }
+            rx_scheduled = true;
+            nbr->schedule(UART_RX_POLL_CLKS, this, UART_EVENT_RX);
+            return;
+        }
+        inpos = 0;
+        inlen = r;
+    }
+
+    rxfifo[(rxhead + rxcount) % UART_FIFO_SIZE] = inbuf[inpos++];
+    rxcount++;
+    rx_scheduled = true;
+    nbr->schedule(UART_BYTE_CLKS, this, UART_EVENT_RX);
+    if(regs[UART_CTRL] & UART_CTRL_RX_IRQ) nbr->raiseIrq(regs[UART_IVEC]);
+}
+
+uint32_t Uart::getSize() {
+    return UART_SIZE;
+}
+
+uint8_t Uart::readb(uint32_t offset) {
+    switch(offset) {
+        case UART_DATA:
+            return receive();
+        case UART_STATUS: {
+            startRx();
+            int tx = txCount();
+            uint8_t v = regs[UART_STATUS] & UART_STATUS_OVERRUN;
+            if(rxcount) v |= UART_STATUS_RX_READY;
+            if(tx >= UART_FIFO_SIZE) v |= UART_STATUS_TX_FULL;
+            if(!tx) v |= UART_STATUS_TX_EMPTY;
+            return v;
+        }
+        case UART_RX_COUNT:
+            startRx();
+            return rxcount;
+        case UART_TX_COUNT:
+            return txCount();
+        default:
+            if(offset >= UART_SIZE) return 0x00;
+            return regs[offset];
+    }
+}
+
+void Uart::writeb(uint32_t offset, uint8_t v) {
+    switch(offset) {
+        case UART_DATA:
+            send(v);
+            return;
+        case UART_STATUS:
+            regs[UART_STATUS] &= ~(v & UART_STATUS_OVERRUN);
+            return;
+        case UART_CTRL:
+            regs[UART_CTRL] = v;
+            startRx();
+            return;
+        case UART_IVEC:
+            regs[UART_IVEC] = v;
+            return;
+        default:
+            return;
+    }
+}
+
+void Uart::event(int id) {
+    switch(id) {
+        case UART_EVENT_TX:
+            if(regs[UART_CTRL] & UART_CTRL_TX_IRQ) nbr->raiseIrq(regs[UART_IVEC]);
+            break;
+        case UART_EVENT_RX:
+            pollRx();
+            break;
+        case UART_EVENT_FLUSH:
+            flush();
+            break;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef _BOSTEK_UART_HPP
+#define _BOSTEK_UART_HPP
+
+#include "device.hpp"
+
+enum UartRegister {
+    UART_DATA=0x00, // write to send, read to receive
+    UART_STATUS=0x01,
+    UART_CTRL=0x02,
+    UART_IVEC=0x03,
+    UART_RX_COUNT=0x04, // bytes waiting in the rx fifo
+    UART_TX_COUNT=0x05, // bytes still to go out of the tx fifo
+    UART_SIZE=0x08,
+};
+
+enum UartStatus {
+    UART_STATUS_RX_READY=0x01,
+    UART_STATUS_TX_FULL=0x02,
+    UART_STATUS_TX_EMPTY=0x04,
+    UART_STATUS_OVERRUN=0x08, // a byte was dropped; write 1 to clear
+};
+
+enum UartCtrl {
+    UART_CTRL_RX_IRQ=0x01, // raise UART_IVEC when a byte is received
+    UART_CTRL_TX_IRQ=0x02, // raise UART_IVEC when the tx fifo empties
+};
+
+enum UartEvent {
+    UART_EVENT_TX,
+    UART_EVENT_RX,
+    UART_EVENT_FLUSH,
+};
+
+#define UART_FIFO_SIZE 16
+#define UART_BYTE_CLKS 64 // per byte on the line
+#define UART_RX_POLL_CLKS 100000 // between host reads while there is no input
+#define UART_FLUSH_CLKS 1000000 // longest output is held before a flush
+#define UART_BUFFER_SIZE 4096
+
+/**
+ * Serial console
+ *
+ * The tx fifo only exists as a clock it drains at; bytes are queued for the
+ * host as soon as they are written. Host output is buffered and written
+ * when UART_BUFFER_SIZE bytes are queued, UART_FLUSH_CLKS after the first
+ * queued byte, on flush() or when the uart is destroyed.
+ *
+ * Received bytes come from a host file or pipe, read a buffer at a time
+ * and fed into the rx fifo at line rate. Neither fd is closed by the uart.
+ */
+class Uart : public Device {
+    uint8_t regs[UART_SIZE];
+    int txfd;
+    int rxfd;
+
+    uint64_t tx_end; // clock the tx fifo is empty at
+    uint8_t outbuf[UART_BUFFER_SIZE];
+    int outlen;
+
+    uint8_t rxfifo[UART_FIFO_SIZE];
+    int rxhead;
+    int rxcount;
+    uint8_t inbuf[UART_BUFFER_SIZE];
+    int inpos;
+    int inlen;
+    bool rx_scheduled;
+    bool rx_eof;
+
+    int txCount();
+    void send(uint8_t v);
+    uint8_t receive();
+    void startRx();
+    void pollRx();
+
+    public:
+    Uart(int txfd=1, int rxfd=-1);
+    virtual ~Uart();
+
+    void flush();
+
+    virtual uint32_t getSize();
+    virtual uint8_t readb(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+    virtual void event(int id);
+};
+
+#endif
@@ -0,0 +1,257 @@
+#include "videoController.hpp"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "memory.hpp"
+#include "cpplib/draw/tga.hpp"
+
+// Pixel is laid out R, G, B, A, which is RGBA8888 and a palette entry as is.
+// The conversions treat it as a little endian uint32_t.
+
+static void convertPal8(Pixel *dst, const uint8_t *src, int n, const uint32_t *palette) {
+    uint32_t *out = (uint32_t*) dst;
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        out[i] = palette[src[i]];
+        out[i+1] = palette[src[i+1]];
+        out[i+2] = palette[src[i+2]];
+        out[i+3] = palette[src[i+3]];
+    }
+    for(; i < n; i++) {
+        out[i] = palette[src[i]];
+    }
+}
+
+static uint32_t rgb565(uint16_t p) {
+    uint32_t r = (p >> 11) & 0x1F;
+    uint32_t g = (p >> 5) & 0x3F;
+    uint32_t b = p & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+
+static void convertRgb565(Pixel *dst, const uint8_t *src, int n) {
+    uint32_t *out = (uint32_t*) dst;
+    int i = 0;
+#ifdef __SSE2__
+    // 8 pixels at a time: widen each channel to 8 bits in 16 bit lanes,
+    // pair them up as RG and BA, then interleave into RGBA
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    const __m128i alpha = _mm_set1_epi16((short) 0xFF00);
+    for(; i + 8 <= n; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b = _mm_and_si128(p, mask5);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, alpha);
+        _mm_storeu_si128((__m128i*) (out + i), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*) (out + i + 4), _mm_unpackhi_epi16(rg, ba));
+    }
+#endif
+    for(; i < n; i++) {
+        out[i] = rgb565(src[2*i] | (src[2*i+1] << 8));
+    }
+}
+
+VideoController::VideoController(uint32_t _frame_clks) : frame_clks(_frame_clks), frames(0),
+        image(NULL), vbase(0), vsize(0), reconfigure(true), redraw(true) {
+    memset(regs, 0, sizeof(regs));
+    memset(palette, 0, sizeof(palette));
+}
+
+VideoController::~VideoController() {
+    delete image;
+}
+
+uint32_t VideoController::reg(int r) {
+    return (regs[r+3] << 24) | (regs[r+2] << 16) | (regs[r+1] << 8) | regs[r];
+}
+
+uint32_t VideoController::bytesPerPixel() {
+    switch(regs[VIDEO_FORMAT]) {
+        case VIDEO_FORMAT_RGB565: return 2;
+        case VIDEO_FORMAT_RGBA8888: return 4;
+        default: return 1;
+    }
+}
+
+uint32_t VideoController::pitch() {
+    uint32_t p = (regs[VIDEO_PITCH+1] << 8) | regs[VIDEO_PITCH];
+    if(!p) p = ((regs[VIDEO_WIDTH+1] << 8) | regs[VIDEO_WIDTH]) * bytesPerPixel();
+    return p;
+}
+
+/**
+ * applies a mode or base change: resizes the image and watches the new vram
+ */
+void VideoController::setup() {
+    reconfigure = false;
+    redraw = true;
+    nbr->unwatchWrites(this);
+
+    int w = (regs[VIDEO_WIDTH+1] << 8) | regs[VIDEO_WIDTH];
+    int h = (regs[VIDEO_HEIGHT+1] << 8) | regs[VIDEO_HEIGHT];
+    if(w > VIDEO_MAX_WIDTH) w = VIDEO_MAX_WIDTH;
+    if(h > VIDEO_MAX_HEIGHT) h = VIDEO_MAX_HEIGHT;
+    if(!w || !h) {
+        delete image;
+        image = NULL;
+        vsize = 0;
+        dirty.clear();
+        return;
+    }
+
+    if(!image || image->getWidth() != w || image->getHeight() != h) {
+        delete image;
+        image = new Image(w, h);
+    }
+
+    vbase = reg(VIDEO_BASE);
+    vsize = pitch() * (h - 1) + w * bytesPerPixel();
+    uint64_t first = vbase >> MEMORY_PAGE_SHIFT;
+    uint64_t last = ((uint64_t) vbase + vsize - 1) >> MEMORY_PAGE_SHIFT;
+    dirty.assign(last - first + 1, false);
+    nbr->watchWrites(this, vbase, vsize);
+}
+
+void VideoController::convertLine(Pixel *dst, const uint8_t *src, int n) {
+    switch(regs[VIDEO_FORMAT]) {
+        case VIDEO_FORMAT_RGB565:
+            convertRgb565(dst, src, n);
+            break;
+        case VIDEO_FORMAT_RGBA8888:
+            memcpy(dst, src, n * sizeof(Pixel));
+            break;
+        default:
+            convertPal8(dst, src, n, palette);
+            break;
+    }
+}
+
+/**
+ * brings the image up to date with vram and returns it, or NULL if no
+ * mode is set. Owned by the controller; valid until the mode changes.
+ */
+Image *VideoController::render() {
+    if(reconfigure) setup();
+    if(!image) return NULL;
+
+    Memory *mem = nbr->getMemory();
+    int w = image->getWidth();
+    int h = image->getHeight();
+    uint32_t linelen = w * bytesPerPixel();
+    uint32_t p = pitch();
+    uint64_t first = vbase >> MEMORY_PAGE_SHIFT;
+
+    for(int y = 0; y < h; y++) {
+        uint64_t start = (uint64_t) vbase + (uint64_t) y * p;
+        uint64_t end = start + linelen;
+        if(!redraw) {
+            bool changed = false;
+            for(uint64_t page = start >> MEMORY_PAGE_SHIFT; page <= (end - 1) >> MEMORY_PAGE_SHIFT; page++) {
+                if(dirty[page - first]) {
+                    changed = true;
+                    break;
+                }
+            }
+            if(!changed) continue;
+        }
+
+        Pixel *dst = image->getPixelPtr() + y * w;
+        const uint8_t *src = NULL;
+        if(mem && end <= 0x100000000ULL) src = mem->getRange(start, linelen);
+        if(src) {
+            convertLine(dst, src, w);
+        } else {
+            memset(dst, 0, w * sizeof(Pixel)); // past the end of ram
+        }
+    }
+
+    for(uint64_t i = 0; i < dirty.size(); i++) {
+        if(dirty[i]) {
+            dirty[i] = false;
+            if(mem) mem->setTrap((first + i) << MEMORY_PAGE_SHIFT, MEMORY_PAGE_SIZE, PAGE_WATCH);
+        }
+    }
+    redraw = false;
+    return image;
+}
+
+/**
+ * renders and writes the frame as a tga
+ */
+bool VideoController::saveFrame(const char *filename) {
+    Image *img = render();
+    if(!img) return false;
+    return saveTga(*img, filename);
+}
+
+uint32_t VideoController::getFrames() {
+    return frames;
+}
+
+uint32_t VideoController::getSize() {
+    return VIDEO_SIZE;
+}
+
+uint8_t VideoController::readb(uint32_t offset) {
+    if(offset >= VIDEO_SIZE) return 0x00;
+    if(offset >= VIDEO_PALETTE) return ((uint8_t*) palette)[offset - VIDEO_PALETTE];
+    if(offset >= VIDEO_FRAME && offset < VIDEO_FRAME + 4) return frames >> (8 * (offset - VIDEO_FRAME));
+    return regs[offset];
+}
+
+void VideoController::writeb(uint32_t offset, uint8_t v) {
+    if(offset >= VIDEO_SIZE) return;
+    if(offset >= VIDEO_PALETTE) {
+        ((uint8_t*) palette)[offset - VIDEO_PALETTE] = v;
+        if(regs[VIDEO_FORMAT] == VIDEO_FORMAT_PAL8) redraw = true;
+        return;
+    }
+
+    switch(offset) {
+        case VIDEO_CTRL:
+            if((v & VIDEO_CTRL_ENABLE) && !(regs[VIDEO_CTRL] & VIDEO_CTRL_ENABLE)) {
+                nbr->schedule(frame_clks, this, 0);
+            } else if(!(v & VIDEO_CTRL_ENABLE) && (regs[VIDEO_CTRL] & VIDEO_CTRL_ENABLE)) {
+                nbr->cancel(this, 0);
+            }
+            regs[VIDEO_CTRL] = v;
+            return;
+        case VIDEO_STATUS:
+            regs[VIDEO_STATUS] &= ~(v & VIDEO_STATUS_VBLANK);
+            return;
+        case VIDEO_IVEC:
+            regs[VIDEO_IVEC] = v;
+            return;
+        default:
+            if(offset >= VIDEO_FRAME) return;
+            if(regs[offset] != v) reconfigure = true; // format, size, base or pitch
+            regs[offset] = v;
+            return;
+    }
+}
+
+void VideoController::event(int id) {
+    frames++;
+    regs[VIDEO_STATUS] |= VIDEO_STATUS_VBLANK;
+    nbr->schedule(frame_clks, this, 0);
+    if(regs[VIDEO_CTRL] & VIDEO_CTRL_IRQ) nbr->raiseIrq(regs[VIDEO_IVEC]);
+}
+
+void VideoController::pageWritten(uint32_t addr) {
+    if(reconfigure) return; // everything is redrawn anyway
+    uint64_t page = (addr >> MEMORY_PAGE_SHIFT) - (vbase >> MEMORY_PAGE_SHIFT);
+    if(page < dirty.size()) dirty[page] = true;
+}
@@ -0,0 +1,87 @@
+#ifndef _BOSTEK_VIDEO_CONTROLLER_HPP
+#define _BOSTEK_VIDEO_CONTROLLER_HPP
+
+#include <vector>
+
+#include "device.hpp"
+#include "cpplib/draw/image.hpp"
+
+enum VideoRegister {
+    VIDEO_CTRL=0x00,
+    VIDEO_STATUS=0x01,
+    VIDEO_IVEC=0x02,
+    VIDEO_FORMAT=0x03,
+    VIDEO_WIDTH=0x04, // word; pixels
+    VIDEO_HEIGHT=0x06, // word; lines
+    VIDEO_BASE=0x08, // long; address of vram in ram
+    VIDEO_PITCH=0x0C, // word; bytes per line, 0 for packed lines
+    VIDEO_FRAME=0x10, // long; frames since reset, read only
+    VIDEO_PALETTE=0x100, // 256 RGBA entries
+    VIDEO_SIZE=0x500,
+};
+
+enum VideoCtrl {
+    VIDEO_CTRL_ENABLE=0x01, // count frames
+    VIDEO_CTRL_IRQ=0x02, // raise VIDEO_IVEC on vblank
+};
+
+enum VideoStatus {
+    VIDEO_STATUS_VBLANK=0x01, // write 1 to clear
+};
+
+enum VideoFormat {
+    VIDEO_FORMAT_PAL8=0x00, // palette index
+    VIDEO_FORMAT_RGB565=0x01,
+    VIDEO_FORMAT_RGBA8888=0x02, // bytes in R, G, B, A order
+};
+
+#define VIDEO_FRAME_CLKS 100000
+#define VIDEO_MAX_WIDTH 4096
+#define VIDEO_MAX_HEIGHT 4096
+
+/**
+ * Framebuffer in ram, scanned out by the host
+ *
+ * The guest only ever writes ram, so running costs nothing per pixel.
+ * Vram pages are watched through the NorthBridge; render() converts just
+ * the lines on pages written since the last render, and only rearms those
+ * pages. Changing the mode, base or palette redraws everything.
+ *
+ * Frames are counted by an event every frame_clks clks, with an optional
+ * vblank irq. Nothing is shown; call render() or saveFrame() to get them.
+ */
+class VideoController : public Device {
+    uint8_t regs[VIDEO_PALETTE];
+    uint32_t palette[256];
+    uint32_t frame_clks;
+    uint32_t frames;
+
+    Image *image;
+    uint32_t vbase; // watched range
+    uint32_t vsize;
+    std::vector<bool> dirty; // pages of the watched range
+    bool reconfigure; // mode or base changed
+    bool redraw; // every line needs converting
+
+    uint32_t reg(int r);
+    uint32_t bytesPerPixel();
+    uint32_t pitch();
+    void setup();
+    void convertLine(Pixel *dst, const uint8_t *src, int n);
+
+    public:
+    VideoController(uint32_t frame_clks=VIDEO_FRAME_CLKS);
+    virtual ~VideoController();
+
+    Image *render();
+    bool saveFrame(const char *filename);
+    uint32_t getFrames();
+
+    virtual uint32_t getSize();
+    virtual uint8_t readb(uint32_t offset);
+    virtual void writeb(uint32_t offset, uint8_t v);
+    virtual void event(int id);
+    virtual void pageWritten(uint32_t addr);
+};
+
+#endif
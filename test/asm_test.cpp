@@ -0,0 +1,775 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "../src/bostek/assembler.hpp"
+#include "../src/bostek/assemblyCache.hpp"
+#include "../src/bostek/bcpu.hpp"
+#include "../src/bostek/disassembler.hpp"
+#include "../src/bostek/lexer.hpp"
+#include "../src/bostek/linker.hpp"
+#include "../src/bostek/memory.hpp"
+#include "../src/bostek/mnemonics.hpp"
+#include "../src/bostek/northBridge.hpp"
+#include "../src/bostek/opcodes.hpp"
+#include "../src/bostek/parallelAssembler.hpp"
+#include "../src/bostek/sparseImage.hpp"
+#include "../src/bostek/symbolTable.hpp"
+#include "cpplib/common/exception.hpp"
+
+namespace Bostek {
+namespace Cpu {
+
+static SourceBuffer *source(const char *text) {
+    return new SourceBuffer("test.s", text, strlen(text));
+}
+
+static Assembler *assemble(const char *text, bool relocatable = false) {
+    Assembler *as = new Assembler(relocatable);
+    SourceBuffer *src = source(text);
+    try {
+        as->assemble(src);
+        as->finish();
+    } catch(...) {
+        src->release();
+        as->release();
+        throw;
+    }
+    src->release();
+    return as;
+}
+
+class AsmRunTest : public testing::Test {
+    public:
+    NorthBridge *nbr;
+    Memory *mem;
+    BCpu *cpu;
+
+    virtual void SetUp() {
+        mem = new Memory(0x10000);
+        cpu = new BCpu(ASM_ORIGIN, 0x8000);
+        nbr = new NorthBridge;
+        nbr->attachCpu(cpu);
+        nbr->attachMemory(mem);
+    }
+
+    virtual void TearDown() {
+        delete nbr;
+    }
+
+    void load(Assembler *as) {
+        uint8_t *image = new uint8_t[0x10000]();
+        as->write(image, 0x10000);
+        mem->fill(0, 0x10000, image);
+        delete[] image;
+    }
+
+    void load(Linker *linker) {
+        uint8_t *image = new uint8_t[0x10000]();
+        linker->write(image, 0x10000);
+        mem->fill(0, 0x10000, image);
+        delete[] image;
+    }
+};
+
+TEST(AsmTest, Lexer) {
+    SourceBuffer *src = source(".ORG $1F00\nloop: MOVB A #12 ; comment\n  JZS 0x10 'a' \"hi\"");
+    Lexer lex(src);
+    src->release();
+
+    Token t = lex.next();
+    EXPECT_EQ(t.type, TOKEN_DIRECTIVE);
+    EXPECT_TRUE(t.equals("ORG"));
+    t = lex.next();
+    EXPECT_EQ(t.type, TOKEN_NUMBER);
+    EXPECT_EQ(t.value, 0x1F00);
+    EXPECT_EQ(lex.next().type, TOKEN_NEWLINE);
+
+    t = lex.next();
+    EXPECT_EQ(t.type, TOKEN_IDENTIFIER);
+    EXPECT_TRUE(t.equals("loop"));
+    EXPECT_FALSE(t.equals("loo"));
+    EXPECT_EQ(t.line, 2);
+    EXPECT_TRUE(lex.next().is(':'));
+    EXPECT_TRUE(lex.peek().equals("MOVB"));
+    EXPECT_TRUE(lex.next().equals("MOVB"));
+    EXPECT_TRUE(lex.next().equals("A"));
+    EXPECT_EQ(lex.next().value, 12);
+    EXPECT_EQ(lex.next().type, TOKEN_NEWLINE);
+
+    EXPECT_TRUE(lex.next().equals("JZS"));
+    EXPECT_EQ(lex.next().value, 0x10);
+    EXPECT_EQ(lex.next().value, 'a');
+    t = lex.next();
+    EXPECT_EQ(t.type, TOKEN_STRING);
+    EXPECT_TRUE(t.equals("hi"));
+    EXPECT_EQ(lex.next().type, TOKEN_EOF);
+    EXPECT_EQ(lex.next().type, TOKEN_EOF);
+}
+
+TEST(AsmTest, LexerErrors) {
+    const char *bad[] = { "$12G4", "12a", "$100000000", "\"open", NULL };
+    for(int i = 0; bad[i]; i++) {
+        SourceBuffer *src = source(bad[i]);
+        Lexer lex(src);
+        src->release();
+        EXPECT_THROW(lex.next(), Exception) << bad[i];
+    }
+}
+
+TEST_F(AsmRunTest, ForwardLabels) {
+    Assembler *as = assemble(
+        "start:  MOVL A 0\n"
+        "loop:   INCL A\n"
+        "        CMPL A 10\n"
+        "        JZS done    ; forward\n"
+        "        JMP loop\n"
+        "done:   STOL result A\n"
+        "        HLT\n"
+        "result: NOP\n");
+    load(as);
+
+    uint32_t addr;
+    ASSERT_TRUE(as->lookup("done", &addr));
+    EXPECT_EQ(addr, ASM_ORIGIN + 6 + 2 + 6 + 3 + 3);
+    EXPECT_FALSE(as->lookup("A", &addr));
+    ASSERT_TRUE(as->lookup("result", &addr));
+    as->release();
+
+    nbr->run(1000);
+    EXPECT_TRUE(cpu->isHalted());
+    EXPECT_EQ(cpu->state.registers[REG_A], 10);
+    EXPECT_EQ(mem->readl(addr), 10);
+}
+
+TEST_F(AsmRunTest, Relaxation) {
+    Assembler *as = assemble(
+        "        JZS far\n"
+        "        JMP far\n"
+        "back:   HLT\n"
+        "        .ORG $A000\n"
+        "far:    JMP back\n");
+
+    // out of reach of 16 bits, so both grow; the jump back does too
+    EXPECT_EQ(as->getInstruction(0).size, 8);
+    EXPECT_EQ(as->getInstruction(1).size, 5);
+    EXPECT_EQ(as->getInstruction(4).size, 5);
+    load(as);
+    as->release();
+
+    EXPECT_EQ(mem->readb(0x1000), JZC);
+    EXPECT_EQ(mem->readb(0x1003), LRJMP);
+    EXPECT_EQ(mem->readb(0x1008), LRJMP);
+
+    // Z is clear, so the first branch falls through to the second jump
+    nbr->run(100);
+    EXPECT_TRUE(cpu->isHalted());
+    EXPECT_EQ(cpu->state.pc, 0x100D);
+
+    as = assemble("a: JMP b\n .ORG $8FFF\n b: JMP a\n");
+    EXPECT_EQ(as->getInstruction(0).size, 3);
+    EXPECT_EQ(as->getInstruction(2).size, 5);
+    as->release();
+}
+
+TEST_F(AsmRunTest, Peephole) {
+    const char *text =
+        "start:  MOVL A 0\n"
+        "        MOVL B 0\n"
+        "        PSHL 0\n"
+        "        POPL C\n"
+        "        MOVL B A\n"
+        "        MOVL B A    ; moves nothing new\n"
+        "        SWPB A B\n"
+        "        SWPB B A    ; swaps it back\n"
+        "        MOVW C C\n"
+        "loop:   INCL A\n"
+        "        ADDL B A\n"
+        "        CMPL A 10\n"
+        "        JZC next    ; over a jump, so becomes JZS done\n"
+        "        JMP done\n"
+        "next:   LRJMP loop\n"
+        "done:   JMP store   ; to the next instruction\n"
+        "store:  STOL result B\n"
+        "        HLT\n"
+        "result: NOP\n";
+
+    Assembler *plain = assemble(text);
+    Assembler *as = new Assembler;
+    as->setOptimize(true);
+    SourceBuffer *src = source(text);
+    as->assemble(src);
+    src->release();
+    as->finish();
+
+    EXPECT_EQ(as->getInstructionCount(), plain->getInstructionCount() - 6);
+    EXPECT_EQ(as->getInstruction(0).op, MOVL_RR);
+    EXPECT_EQ(as->getInstruction(0).reg2, REG_ZE);
+    EXPECT_EQ(as->getInstruction(2).op, PSHX_R);
+    EXPECT_EQ(as->getInstruction(8).op, JZS);
+    EXPECT_EQ(as->getInstruction(9).op, RJMP);
+    EXPECT_EQ(as->getInstruction(9).size, 3);
+    EXPECT_LT(as->getEnd(), plain->getEnd());
+
+    uint32_t addr;
+    ASSERT_TRUE(as->lookup("result", &addr));
+    load(as);
+    as->release();
+    plain->release();
+
+    nbr->run(1000);
+    EXPECT_TRUE(cpu->isHalted());
+    EXPECT_EQ(cpu->state.registers[REG_A], 10);
+    EXPECT_EQ(mem->readl(addr), 55);
+    EXPECT_EQ(cpu->state.registers[REG_C], 0);
+
+    // absolute jumps in reach are made relative, in the same bytes
+    as = new Assembler;
+    as->setOptimize(true);
+    src = source("AJMP end\nNOP\nend: HLT\n");
+    as->assemble(src);
+    src->release();
+    as->finish();
+    EXPECT_EQ(as->getInstruction(0).op, RJMP);
+    EXPECT_EQ(as->getInstruction(0).size, 3);
+    as->release();
+}
+
+TEST_F(AsmRunTest, Link) {
+    Assembler *main = assemble(
+        "start:  MOVL A value\n"
+        "        JSR inc\n"
+        "        STOL result A\n"
+        "        HLT\n", true);
+    Assembler *lib = assemble(
+        "inc:    INCL A\n"
+        "        RET\n"
+        "value:  NOP\n"
+        "        .ORG $9000\n"
+        "result: NOP\n", true);
+
+    // the call goes to another object, so it is long and left to the linker
+    EXPECT_EQ(main->getInstruction(1).size, 5);
+    EXPECT_EQ(main->getObject()->relocations.size(), 3);
+
+    // through a file and back
+    char filename[] = "/tmp/asm_testXXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    lib->getObject()->save(filename);
+    ObjectFile *loaded = ObjectFile::load(filename);
+    unlink(filename);
+    EXPECT_EQ(loaded->sections.size(), 2);
+    EXPECT_EQ(loaded->sections[1].origin, 0x9000);
+
+    Linker *linker = new Linker;
+    linker->add(main->getObject());
+    linker->add(loaded);
+    loaded->release();
+    main->release();
+    lib->release();
+    load(linker);
+
+    uint32_t value, result;
+    ASSERT_TRUE(linker->lookup("value", &value));
+    EXPECT_EQ(value, ASM_ORIGIN + 6 + 5 + 4 + 1 + 2 + 1);
+    ASSERT_TRUE(linker->lookup("result", &result));
+    EXPECT_EQ(result, 0x9000);
+    linker->release();
+
+    nbr->run(1000);
+    EXPECT_TRUE(cpu->isHalted());
+    EXPECT_EQ(mem->readl(result), value + 1);
+}
+
+TEST(AsmTest, LinkErrors) {
+    const char *bad[][2] = {
+        { "JMP nowhere\n", "NOP\n" },
+        { "a: NOP\n", "a: NOP\n" },
+        { ".ORG $2000\nMOVL A 1\n", ".ORG $2004\nNOP\n" },
+        { "MOVB A b\n", ".ORG $2000\nb: NOP\n" },
+        { NULL, NULL },
+    };
+    for(int i = 0; bad[i][0]; i++) {
+        EXPECT_THROW({
+            Linker *linker = new Linker;
+            for(int j = 0; j < 2; j++) {
+                Assembler *as = assemble(bad[i][j], true);
+                linker->add(as->getObject());
+                as->release();
+            }
+            uint8_t image[0x10000];
+            linker->write(image, sizeof(image));
+            linker->release();
+        }, Exception) << bad[i][0];
+    }
+
+    // errors from relocations name the line, through an object file too
+    Assembler *as = assemble("NOP\nLODL B $20000\n", true);
+    char filename[] = "/tmp/asm_testXXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    as->getObject()->save(filename);
+    as->release();
+    ObjectFile *loaded = ObjectFile::load(filename);
+    unlink(filename);
+
+    Linker *linker = new Linker;
+    linker->add(loaded);
+    loaded->release();
+    SparseImage *image = new SparseImage;
+    try {
+        linker->write(image);
+        ADD_FAILURE() << "expected an exception";
+    } catch(Exception &e) {
+        EXPECT_TRUE(e.getMessage() == "test.s:2: address out of range") << e.getMessage().c_str();
+    }
+    image->release();
+    linker->release();
+}
+
+TEST(AsmTest, SparseImage) {
+    SparseImage *image = new SparseImage;
+    uint8_t a[] = { 1, 2, 3, 4 };
+    image->write(0x1008, a, 4);
+    image->write(0x1000, a, 4);
+    image->write(0x1004, a, 2); // touches, so grows the segment
+    EXPECT_EQ(image->getSegmentCount(), 2);
+    image->write(0x1006, a, 2); // joins both
+    ASSERT_EQ(image->getSegmentCount(), 1);
+    EXPECT_EQ(image->getSegment(0).addr, 0x1000);
+    EXPECT_EQ(image->getDataSize(), 12);
+
+    uint8_t out[8];
+    image->read(0x0FFE, out, 8);
+    uint8_t expected[] = { 0, 0, 1, 2, 3, 4, 1, 2 };
+    EXPECT_EQ(memcmp(out, expected, 8), 0);
+    EXPECT_TRUE(image->at(0x100A, 2) != NULL);
+    EXPECT_TRUE(image->at(0x100A, 3) == NULL);
+    EXPECT_THROW(image->write(0xFFFFFFFE, a, 4), Exception);
+
+    // only the code is saved, wherever it is
+    Assembler *as = assemble(
+        "        .ORG $12345678\n"
+        "        LAJMP far\n"
+        "far:    HLT\n");
+    as->write(image);
+    as->release();
+    EXPECT_EQ(image->getSegmentCount(), 2);
+
+    char filename[] = "/tmp/asm_testXXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    image->save(filename);
+    SparseImage *loaded = SparseImage::load(filename);
+    ASSERT_EQ(loaded->getSegmentCount(), 2);
+    EXPECT_TRUE(loaded->getSegment(1).data == image->getSegment(1).data);
+    EXPECT_EQ(loaded->getSegment(1).addr, 0x12345678);
+    EXPECT_EQ(loaded->getDataSize(), 12 + 6);
+    loaded->release();
+
+    // anything else is a raw dump
+    FILE *f = fopen(filename, "wb");
+    fwrite(a, 1, 4, f);
+    fclose(f);
+    loaded = SparseImage::load(filename, 0x8000);
+    unlink(filename);
+    ASSERT_EQ(loaded->getSegmentCount(), 1);
+    EXPECT_EQ(loaded->getSegment(0).addr, 0x8000);
+    loaded->release();
+    image->release();
+}
+
+TEST(AsmTest, Parallel) {
+    // each calls the next, so every object depends on the others
+    const int count = 40;
+    char text[128];
+    ParallelAssembler *pas = new ParallelAssembler(8);
+    Linker *serial = new Linker;
+    for(int i = 0; i < count; i++) {
+        snprintf(text, sizeof(text), "f%d: MOVL A %d\n JSR f%d\n RET\n", i, i, (i + 1) % count);
+        SourceBuffer *src = source(text);
+        pas->add(src);
+        src->release();
+
+        Assembler *as = assemble(text, true);
+        serial->add(as->getObject());
+        as->release();
+    }
+    pas->run();
+
+    Linker *parallel = new Linker;
+    ASSERT_EQ(pas->getCount(), count);
+    for(int i = 0; i < count; i++) parallel->add(pas->getObject(i));
+    pas->release();
+
+    uint8_t *a = new uint8_t[0x10000]();
+    uint8_t *b = new uint8_t[0x10000]();
+    serial->write(a, 0x10000);
+    parallel->write(b, 0x10000);
+    EXPECT_EQ(memcmp(a, b, 0x10000), 0);
+    delete[] a;
+    delete[] b;
+    serial->release();
+    parallel->release();
+
+    // the first failing source is reported, however the threads ran
+    const char *bad[] = { "NOP\n", "FOO\n", "BAR\n" };
+    for(int n = 0; n < 10; n++) {
+        pas = new ParallelAssembler(3);
+        for(int i = 0; i < 3; i++) {
+            SourceBuffer *src = new SourceBuffer(i == 1 ? "first.s" : "other.s", bad[i], strlen(bad[i]));
+            pas->add(src);
+            src->release();
+        }
+        try {
+            pas->run();
+            ADD_FAILURE() << "expected an error";
+        } catch(Exception &e) {
+            EXPECT_STREQ(e.getMessage().c_str(), "first.s:1: unknown mnemonic FOO");
+        }
+        pas->release();
+    }
+}
+
+TEST_F(AsmRunTest, Preprocessor) {
+    Assembler *as = assemble(
+        "        .SET COUNT 3\n"
+        "        .MACRO ADDTO reg, n\n"
+        "        ADDL reg n\n"
+        "        .ENDM\n"
+        "start:  MOVL A 0\n"
+        "        .REPT COUNT\n"
+        "        ADDTO A, COUNT + 1\n"
+        "        .ENDR\n"
+        "        .IF COUNT == 3\n"
+        "        INCL A\n"
+        "        .IFDEF MISSING\n"
+        "        INCL A\n"
+        "        .ELSE\n"
+        "        INCL A\n"
+        "        .ENDIF\n"
+        "        .ELSE\n"
+        "        HLT\n"
+        "        .ENDIF\n"
+        "        STOL result A\n"
+        "        HLT\n"
+        "        .ALIGN 4\n"
+        "table:  .DB 1, 2 \"hi\"\n"
+        "        .DW $1234 table\n"
+        "        .DF 1.5 -0.25\n"
+        "        .RES 3\n"
+        "result: .DL 0\n");
+    load(as);
+
+    uint32_t table, result;
+    ASSERT_TRUE(as->lookup("table", &table));
+    ASSERT_TRUE(as->lookup("result", &result));
+    EXPECT_EQ(table % 4, 0);
+    EXPECT_EQ(result, table + 4 + 4 + 8 + 3);
+    as->release();
+
+    EXPECT_EQ(mem->readb(table + 2), 'h');
+    EXPECT_EQ(mem->readw(table + 4), 0x1234);
+    EXPECT_EQ(mem->readw(table + 6), table);
+    float f[2] = { 1.5f, -0.25f };
+    uint32_t bits[2];
+    memcpy(bits, f, sizeof(f));
+    EXPECT_EQ(mem->readl(table + 8), bits[0]);
+    EXPECT_EQ(mem->readl(table + 12), bits[1]);
+
+    nbr->run(1000);
+    EXPECT_TRUE(cpu->isHalted());
+    EXPECT_EQ(mem->readl(result), 3 * 4 + 2);
+}
+
+TEST(AsmTest, Include) {
+    char dir[] = "/tmp/asm_testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    std::string d(dir);
+    FILE *f = fopen((d + "/defs.s").c_str(), "w");
+    fprintf(f, ".IFNDEF DEFS\n.SET DEFS 1\n.MACRO TWICE op\nop\nop\n.ENDM\n.ENDIF\nNOP"); // no final newline
+    fclose(f);
+    f = fopen((d + "/main.s").c_str(), "w");
+    fprintf(f, ".INCLUDE \"defs.s\"\n.INCLUDE \"defs.s\"\nTWICE HLT\n");
+    fclose(f);
+
+    Assembler *as = new Assembler;
+    SourceBuffer *src = new SourceBuffer((d + "/main.s").c_str());
+    as->assemble(src);
+    src->release();
+    ASSERT_EQ(as->getIncludes().size(), 1);
+    EXPECT_TRUE(as->getIncludes()[0] == String((d + "/defs.s").c_str()));
+    ASSERT_EQ(as->getInstructionCount(), 4);
+    EXPECT_EQ(as->getInstruction(0).op, NOP);
+    EXPECT_EQ(as->getInstruction(3).op, HLT);
+    as->release();
+
+    // includes itself forever
+    f = fopen((d + "/loop.s").c_str(), "w");
+    fprintf(f, ".INCLUDE \"loop.s\"\n");
+    fclose(f);
+    as = new Assembler;
+    src = new SourceBuffer((d + "/loop.s").c_str());
+    EXPECT_THROW(as->assemble(src), Exception);
+    src->release();
+    as->release();
+
+    unlink((d + "/defs.s").c_str());
+    unlink((d + "/main.s").c_str());
+    unlink((d + "/loop.s").c_str());
+    rmdir(dir);
+}
+
+TEST(AsmTest, PreprocessorErrors) {
+    const char *bad[] = {
+        ".IF 1\nNOP\n",
+        ".ELSE\n",
+        ".ENDM\n",
+        ".MACRO M a\nNOP\n",
+        ".MACRO M a\nNOP a\n.ENDM\nM\n",
+        ".MACRO M\nM\n.ENDM\nM\n",
+        ".IF UNSET\n.ENDIF\n",
+        ".INCLUDE \"/nonexistent.s\"\n",
+        ".REPT 2\nNOP\n.ENDM\n",
+        ".ALIGN 3\n",
+        NULL,
+    };
+    for(int i = 0; bad[i]; i++) {
+        EXPECT_THROW({
+            Assembler *as = assemble(bad[i]);
+            as->release();
+        }, Exception) << bad[i];
+    }
+}
+
+TEST(AsmTest, Cache) {
+    AssemblyCache *cache = new AssemblyCache;
+    std::vector<String> includes;
+    std::vector<uint64_t> hashes;
+    SourceBuffer *a = source("NOP\n");
+    EXPECT_TRUE(cache->find(a) == NULL);
+
+    Assembler *as = assemble("NOP\n", true);
+    cache->store(a, as->getObject(), includes, hashes);
+    EXPECT_EQ(cache->find(a), as->getObject());
+    as->release();
+
+    // same name, new contents
+    SourceBuffer *b = source("HLT\n");
+    EXPECT_TRUE(cache->find(b) == NULL);
+    SourceBuffer *c = source("NOP\n");
+    EXPECT_TRUE(cache->find(c) != NULL);
+    EXPECT_EQ(cache->getHits(), 2);
+    EXPECT_EQ(cache->getMisses(), 2);
+
+    // an include that can't be read any more is a miss
+    includes.push_back("/nonexistent/include.s");
+    hashes.push_back(0);
+    as = assemble("NOP\n", true);
+    cache->store(a, as->getObject(), includes, hashes);
+    as->release();
+    EXPECT_TRUE(cache->find(a) == NULL);
+
+    a->release();
+    b->release();
+    c->release();
+
+    // an include saved after it was read, but before the store, is still a miss
+    char dir[] = "/tmp/asm_testXXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    std::string d(dir);
+    FILE *f = fopen((d + "/defs.s").c_str(), "w");
+    fprintf(f, "NOP\n");
+    fclose(f);
+    f = fopen((d + "/main.s").c_str(), "w");
+    fprintf(f, ".INCLUDE \"defs.s\"\n");
+    fclose(f);
+
+    SourceBuffer *src = new SourceBuffer((d + "/main.s").c_str());
+    as = new Assembler(true);
+    as->assemble(src);
+    ASSERT_EQ(as->getIncludeHashes().size(), 1);
+    f = fopen((d + "/defs.s").c_str(), "w");
+    fprintf(f, "HLT\n");
+    fclose(f);
+    cache->store(src, as->getObject(), as->getIncludes(), as->getIncludeHashes());
+    EXPECT_TRUE(cache->find(src) == NULL);
+    as->release();
+
+    as = new Assembler(true);
+    as->assemble(src);
+    cache->store(src, as->getObject(), as->getIncludes(), as->getIncludeHashes());
+    EXPECT_EQ(cache->find(src), as->getObject());
+    as->release();
+    src->release();
+
+    unlink((d + "/defs.s").c_str());
+    unlink((d + "/main.s").c_str());
+    rmdir(dir);
+    cache->release();
+}
+
+TEST(AsmTest, Errors) {
+    const char *bad[] = {
+        "JMP nowhere\n",
+        "a: NOP\na: NOP\n",
+        "MOVB A 300\n",
+        "FOO A\n",
+        "MOVB 3 A\n",
+        "LODB A B\n",
+        "A: NOP\n",
+        "MOVX A 1\n",
+        NULL,
+    };
+    for(int i = 0; bad[i]; i++) {
+        EXPECT_THROW({
+            Assembler *as = assemble(bad[i]);
+            uint8_t image[0x10000];
+            as->write(image, sizeof(image));
+            as->release();
+        }, Exception) << bad[i];
+    }
+}
+
+TEST(AsmTest, SymbolTable) {
+    SymbolTable t;
+    EXPECT_EQ(t.find("loop", 4), -1);
+    EXPECT_EQ(t.intern("loop", 4), 0);
+    EXPECT_EQ(t.intern("loop_end", 4), 0); // only the span counts
+    EXPECT_EQ(t.intern("end", 3), 1);
+    EXPECT_EQ(t.find("end", 3), 1);
+    EXPECT_STREQ(t.name(0), "loop");
+
+    // enough to grow several times
+    char name[16];
+    for(int i = 0; i < 5000; i++) {
+        int len = snprintf(name, sizeof(name), "l%d", i);
+        EXPECT_EQ(t.intern(name, len), i + 2);
+    }
+    for(int i = 0; i < 5000; i++) {
+        int len = snprintf(name, sizeof(name), "l%d", i);
+        EXPECT_EQ(t.find(name, len), i + 2);
+        EXPECT_STREQ(t.name(i + 2), name);
+    }
+    EXPECT_EQ(t.size(), 5002);
+    EXPECT_STREQ(t.name(0), "loop");
+}
+
+TEST(AsmTest, Mnemonics) {
+    const Mnemonic *m = lookupMnemonic("MOVL", 4);
+    ASSERT_TRUE(m != NULL);
+    EXPECT_EQ(m->kind, MNEMONIC_MOVE);
+    EXPECT_EQ(m->op, MOVL_RR);
+    EXPECT_EQ(m->type, TYPE_LONG);
+
+    m = lookupMnemonic("JZS", 3);
+    ASSERT_TRUE(m != NULL);
+    EXPECT_EQ(m->kind, MNEMONIC_BRANCH);
+    EXPECT_EQ(m->op, JZS);
+
+    m = lookupMnemonic("ROLF", 4);
+    ASSERT_TRUE(m != NULL);
+    EXPECT_EQ(m->op, ROLX);
+
+    m = lookupMnemonic("SP", 2);
+    ASSERT_TRUE(m != NULL);
+    EXPECT_EQ(m->kind, MNEMONIC_REGISTER);
+    EXPECT_EQ(m->op, REG_SP);
+
+    EXPECT_TRUE(lookupMnemonic("MOVLX", 4) != NULL); // only the span counts
+    EXPECT_TRUE(lookupMnemonic("MOV", 3) == NULL);
+    EXPECT_TRUE(lookupMnemonic("movl", 4) == NULL);
+    EXPECT_TRUE(lookupMnemonic("MOVLMOVL", 8) == NULL);
+    EXPECT_TRUE(lookupMnemonic("MOVLMOVLX", 9) == NULL);
+    EXPECT_TRUE(lookupMnemonic("", 0) == NULL);
+}
+
+TEST(AsmTest, Disassembler) {
+    const char *text[] = {
+        "start:",
+        "MOVL C $12345",
+        "ADDB A B",
+        "ANSB $7F",
+        "LODW A table+B",
+        "STOL table+$4 D",
+        "PSHW $BEEF",
+        "POPL",
+        "INCF C",
+        "loop:",
+        "JZC loop",
+        "LAJSR start+$2",
+        "RJMP $FF0",
+        "table:",
+        "RET",
+        NULL,
+    };
+    std::string src;
+    for(int i = 0; text[i]; i++) src += std::string(text[i]) + "\n";
+
+    Assembler *as = assemble(src.c_str());
+    uint8_t *image = new uint8_t[0x10000]();
+    as->write(image, 0x10000);
+    Disassembler *dis = new Disassembler;
+    const char *labels[] = { "start", "loop", "table" };
+    for(int i = 0; i < 3; i++) {
+        uint32_t addr;
+        ASSERT_TRUE(as->lookup(labels[i], &addr));
+        dis->addSymbol(addr, labels[i]);
+    }
+
+    // labels in the source are not instructions
+    char out[DISASM_TEXT_MAX];
+    uint32_t addr = ASM_ORIGIN;
+    for(int i = 0; text[i]; i++) {
+        if(strchr(text[i], ':')) continue;
+        int cycles;
+        addr += dis->decode(image + addr, as->getEnd() - addr, addr, out, sizeof(out), &cycles);
+        EXPECT_STREQ(out, text[i]);
+        EXPECT_GT(cycles, 0);
+    }
+    EXPECT_EQ(addr, as->getEnd());
+
+    // undefined opcodes and cut off instructions are data
+    uint8_t bad[] = { 0x40, 0x86, 0x00, 0x01 };
+    EXPECT_EQ(dis->decode(bad, 4, 0, out, sizeof(out)), 1);
+    EXPECT_STREQ(out, ".DB $40");
+    EXPECT_EQ(dis->decode(bad + 1, 3, 0, out, sizeof(out)), 3);
+    EXPECT_STREQ(out, ".DB $86, $0, $1");
+
+    dis->symbolize(0x0FFF, out, sizeof(out));
+    EXPECT_STREQ(out, "$FFF");
+    dis->symbolize(ASM_ORIGIN + 0x10, out, sizeof(out));
+    EXPECT_STREQ(out, "start+$10");
+
+    delete[] image;
+    dis->release();
+    as->release();
+}
+
+TEST(AsmTest, OpcodeTable) {
+    // every defined opcode disassembles to something basm takes back
+    Disassembler *dis = new Disassembler;
+    for(int op = 0; op < 256; op++) {
+        const Opcode &o = opcode_table.op[op];
+        if(!o.name[0] || o.unit == UNIT_NONE || o.layout == LAYOUT_LMEM || o.layout == LAYOUT_ALMEM) continue;
+
+        uint8_t code[6] = { (uint8_t) op, 0x21, 0x10, 0x00, 0x00, 0x00 };
+        if(o.layout == LAYOUT_MEM || o.layout == LAYOUT_AMEM) code[1] = 0xF1;
+        char text[DISASM_TEXT_MAX];
+        int len = dis->decode(code, sizeof(code), ASM_ORIGIN, text, sizeof(text));
+        EXPECT_EQ(len, opcode_length(op, code[1])) << text;
+
+        Assembler *as = assemble((std::string(text) + "\n").c_str());
+        EXPECT_EQ(as->getEnd() - ASM_ORIGIN, len) << text;
+        as->release();
+    }
+    dis->release();
+}
+
+} // namespace Cpu
+} // namespace Bostek
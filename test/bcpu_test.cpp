@@ -1165,5 +1165,12 @@ TEST_F(BCpuTest, Arithmetic) {
     cpu->apply(e);
 }
 
+TEST_F(BCpuTest, LongRun) {
+    // memory is zeroed, so these are NOPs; the wait must not count down past them
+    nbr->run(1000);
+    EXPECT_EQ(cpu->state.pc, 0x1000 + 1000);
+    EXPECT_EQ(cpu->op_wait, 0);
+}
+
 } // namespace Cpu
 } // namespace Bostek
@@ -0,0 +1,275 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+
+#include "../src/bostek/bcpu.hpp"
+#include "../src/bostek/coverage.hpp"
+#include "../src/bostek/debugger.hpp"
+#include "../src/bostek/gdbStub.hpp"
+#include "../src/bostek/memory.hpp"
+#include "../src/bostek/northBridge.hpp"
+
+namespace Bostek {
+namespace Cpu {
+
+class DebuggerTest : public testing::Test {
+    public:
+    NorthBridge *nbr;
+    Memory *mem;
+    BCpu *cpu;
+    Debugger *dbg;
+
+    virtual void SetUp() {
+        // 0x1000: INCL A; ASTOL $2000 A; RJMP $1000
+        uint8_t program[] = {
+            INCX, 0x20,
+            ASTOL_RRK, 0xF0, 0x00, 0x20,
+            RJMP, 0xF7, 0xFF,
+        };
+
+        mem = new Memory(0x10000);
+        cpu = new BCpu(0x1000, 0x8000);
+        nbr = new NorthBridge;
+        nbr->attachCpu(cpu);
+        nbr->attachMemory(mem);
+        dbg = new Debugger(nbr);
+        mem->fill(0x1000, sizeof(program), program);
+    }
+
+    virtual void TearDown() {
+        dbg->release();
+        delete nbr;
+    }
+};
+
+TEST_F(DebuggerTest, Run) {
+    EXPECT_EQ(dbg->run(30), 30);
+    EXPECT_EQ(dbg->getStopReason(), STOP_NONE);
+    EXPECT_EQ(cpu->state.registers[REG_A], 10);
+    EXPECT_EQ(mem->readl(0x2000), 10);
+    EXPECT_EQ(nbr->getClocks(), 30);
+}
+
+TEST_F(DebuggerTest, Breakpoint) {
+    dbg->addBreakpoint(0x1002);
+
+    EXPECT_EQ(dbg->run(100), 1);
+    EXPECT_EQ(dbg->getStopReason(), STOP_BREAKPOINT);
+    EXPECT_EQ(cpu->state.pc, 0x1002);
+    EXPECT_EQ(cpu->state.registers[REG_A], 1);
+    EXPECT_EQ(mem->readl(0x2000), 0);
+
+    // resuming steps over the breakpoint under the pc
+    EXPECT_EQ(dbg->run(100), 3);
+    EXPECT_EQ(cpu->state.pc, 0x1002);
+    EXPECT_EQ(cpu->state.registers[REG_A], 2);
+    EXPECT_EQ(mem->readl(0x2000), 1);
+
+    EXPECT_EQ(dbg->step(), 1);
+    EXPECT_EQ(dbg->getStopReason(), STOP_NONE);
+    EXPECT_EQ(cpu->state.pc, 0x1006);
+
+    dbg->removeBreakpoint(0x1002);
+    EXPECT_EQ(dbg->run(100), 100);
+    EXPECT_EQ(mem->getTrap(0x1002), 0);
+}
+
+TEST_F(DebuggerTest, Watchpoint) {
+    dbg->addWatchpoint(0x2002, 1, WATCH_WRITE);
+    dbg->addWatchpoint(0x3000, 4, WATCH_ACCESS);
+
+    EXPECT_EQ(dbg->run(100), 2);
+    EXPECT_EQ(dbg->getStopReason(), STOP_WATCH_WRITE);
+    EXPECT_EQ(dbg->getStopAddress(), 0x2002);
+    EXPECT_EQ(cpu->state.pc, 0x1006); // stops after the store
+    EXPECT_EQ(mem->readl(0x2000), 1);
+
+    // reads do not trigger a write watchpoint
+    dbg->removeWatchpoint(0x2002, 1, WATCH_WRITE);
+    dbg->addWatchpoint(0x2000, 4, WATCH_READ);
+    EXPECT_EQ(dbg->run(100), 100);
+    EXPECT_EQ(nbr->readb(0x3001), 0);
+    EXPECT_EQ(dbg->getStopReason(), STOP_WATCH_READ);
+    EXPECT_EQ(dbg->getStopAddress(), 0x3001);
+}
+
+TEST_F(DebuggerTest, FaultStop) {
+    nbr->setFaultAction(FAULT_STOP);
+    mem->setTrap(0x2000, 1, PAGE_GUARD);
+
+    // the store is abandoned; pc stays on it
+    EXPECT_LT(dbg->run(30), 30);
+    ASSERT_NE(nbr->getFault(), (const MemoryFault*) NULL);
+    EXPECT_EQ(nbr->getFault()->addr, 0x2000);
+    EXPECT_EQ(nbr->getFault()->access, PAGE_TRAP_WRITE);
+    EXPECT_EQ(cpu->state.pc, 0x1002);
+    EXPECT_EQ(cpu->state.registers[REG_A], 1);
+
+    // reads past the end of memory fault the same way
+    mem->clearTrap(0x2000, 1, PAGE_GUARD);
+    mem->writeb(0x1002, ALODL_RRK);
+    mem->writew(0x1004, 0xFFFE);
+    dbg->run(1);
+    ASSERT_NE(nbr->getFault(), (const MemoryFault*) NULL);
+    EXPECT_EQ(nbr->getFault()->access, PAGE_TRAP_READ);
+    EXPECT_EQ(nbr->getFault()->addr, 0x10000);
+}
+
+TEST_F(DebuggerTest, FaultTrap) {
+    nbr->setFaultAction(FAULT_TRAP);
+    mem->setTrap(0x2000, 1, PAGE_GUARD);
+    mem->writel(IVT_BASE + 4 * IVEC_FAULT, 0x3000);
+    mem->writeb(0x3000, HLT);
+
+    EXPECT_LT(dbg->run(10), 10); // stops on the HLT
+    EXPECT_EQ(nbr->getFault(), (const MemoryFault*) NULL);
+    EXPECT_EQ(cpu->state.pc, 0x3000);
+    EXPECT_EQ(cpu->state.sp, 0x8000 - 8);
+    EXPECT_EQ(mem->readl(0x8000 - 8), 0x2000);
+    EXPECT_EQ(mem->readl(0x8000 - 4), 0x1002);
+    EXPECT_FALSE(cpu->state.read_flag(FLAG_I));
+    EXPECT_TRUE(cpu->isHalted());
+    EXPECT_EQ(dbg->run(10), 0);
+}
+
+TEST_F(DebuggerTest, DoubleFault) {
+    nbr->setFaultAction(FAULT_TRAP);
+    mem->setTrap(0x2000, 1, PAGE_GUARD);
+
+    // a stack in a guard page can't take the fault
+    cpu->state.sp = 0x2004;
+    EXPECT_LT(dbg->run(10), 10);
+    ASSERT_NE(nbr->getFault(), (const MemoryFault*) NULL);
+    EXPECT_EQ(nbr->getFault()->access, PAGE_TRAP_WRITE);
+}
+
+TEST_F(DebuggerTest, Coverage) {
+    // 0x1000: INCL A; ASTOL $2000 A; JZS $1000; RJMP $1000
+    uint8_t program[] = {
+        INCX, 0x20,
+        ASTOL_RRK, 0xF0, 0x00, 0x20,
+        JZS, 0xF7, 0xFF,
+        RJMP, 0xF4, 0xFF,
+    };
+    mem->fill(0x1000, sizeof(program), program);
+    Coverage *cov = new Coverage;
+    cpu->setCoverage(cov);
+
+    dbg->run(8);
+    EXPECT_EQ(cov->getExecutedCount(), sizeof(program));
+    EXPECT_TRUE(cov->isExecuted(0x1000));
+    EXPECT_TRUE(cov->isExecuted(0x100B));
+    EXPECT_FALSE(cov->isExecuted(0x100C));
+    EXPECT_TRUE(cov->isNotTaken(0x1006));
+    EXPECT_FALSE(cov->isTaken(0x1006));
+
+    // a block cut off by the end of the run is only there once flushed
+    cpu->state.pc = 0x3000;
+    cpu->setCoverage(cov);
+    dbg->run(4);
+    EXPECT_FALSE(cov->isExecuted(0x3000));
+    cpu->flushCoverage();
+    EXPECT_TRUE(cov->isExecuted(0x3003));
+    EXPECT_FALSE(cov->isExecuted(0x3004));
+
+    // saved runs merge on load
+    char filename[] = "/tmp/bostek_coverageXXXXXX";
+    close(mkstemp(filename));
+    Coverage *other = new Coverage;
+    other->branch(0x1006, true);
+    other->block(0x4000, 0x4001);
+    ASSERT_TRUE(other->save(filename));
+    ASSERT_TRUE(cov->load(filename));
+    EXPECT_TRUE(cov->isTaken(0x1006));
+    EXPECT_TRUE(cov->isNotTaken(0x1006));
+    EXPECT_EQ(cov->getExecutedCount(), sizeof(program) + 4 + 2);
+    unlink(filename);
+
+    cpu->setCoverage(NULL);
+    other->release();
+    cov->release();
+}
+
+struct GdbSession {
+    GdbStub *stub;
+    int fd;
+};
+
+static void *serve_gdb(void *arg) {
+    GdbSession *s = (GdbSession*) arg;
+    s->stub->serveClient(s->fd);
+    return NULL;
+}
+
+// sends a packet and returns the reply, acking both as gdb does
+static std::string exchange(int fd, const std::string &pkt) {
+    uint8_t sum = 0;
+    for(size_t i = 0; i < pkt.size(); i++) sum += pkt[i];
+    char tail[4];
+    snprintf(tail, sizeof(tail), "#%02x", sum);
+    std::string out = "$" + pkt + tail;
+    if(write(fd, out.data(), out.size()) != out.size()) return "write failed";
+
+    char c;
+    if(read(fd, &c, 1) != 1 || c != '+') return "no ack";
+    if(read(fd, &c, 1) != 1 || c != '$') return "no reply";
+    std::string reply;
+    while(read(fd, &c, 1) == 1 && c != '#') reply += c;
+    char sumbuf[2];
+    if(read(fd, sumbuf, 2) != 2 || write(fd, "+", 1) != 1) return "cut off";
+    return reply;
+}
+
+TEST_F(DebuggerTest, GdbStub) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    GdbStub *stub = new GdbStub(dbg, cpu);
+    GdbSession session = { stub, fds[0] };
+    pthread_t t;
+    ASSERT_EQ(pthread_create(&t, NULL, serve_gdb, &session), 0);
+
+    EXPECT_EQ(exchange(fds[1], "?"), "S05");
+
+    // a b c d, the floats, then pc, sp and sb, little endian
+    std::string regs = exchange(fds[1], "g");
+    ASSERT_EQ(regs.size(), 10 * 8 + 2);
+    EXPECT_EQ(regs.substr(0, 8), "00000000");
+    EXPECT_EQ(regs.substr(64, 8), "00100000");
+    EXPECT_EQ(regs.substr(72, 8), "00800000");
+
+    EXPECT_EQ(exchange(fds[1], "M3000,2:beef"), "OK");
+    EXPECT_EQ(mem->readw(0x3000), 0xEFBE);
+    EXPECT_EQ(exchange(fds[1], "m3000,2"), "beef");
+
+    EXPECT_EQ(exchange(fds[1], "Z0,1006,1"), "OK");
+    EXPECT_EQ(exchange(fds[1], "c"), "T05hwbreak:;");
+    EXPECT_EQ(cpu->state.pc, 0x1006);
+    EXPECT_EQ(cpu->state.registers[REG_A], 1);
+    EXPECT_EQ(mem->readl(0x2000), 1);
+
+    // steps over the breakpoint it stopped at
+    EXPECT_EQ(exchange(fds[1], "s"), "S05");
+    EXPECT_EQ(cpu->state.pc, 0x1000);
+    EXPECT_EQ(exchange(fds[1], "z0,1006,1"), "OK");
+
+    EXPECT_EQ(exchange(fds[1], "D"), "OK");
+    pthread_join(t, NULL);
+    EXPECT_FALSE(stub->wasKilled());
+    close(fds[1]);
+
+    // a client gone before the reply is a detach, not a SIGPIPE
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    session.fd = fds[0];
+    ASSERT_EQ(pthread_create(&t, NULL, serve_gdb, &session), 0);
+    ASSERT_EQ(write(fds[1], "$g#67", 5), 5);
+    close(fds[1]);
+    pthread_join(t, NULL);
+
+    stub->release();
+}
+
+} // namespace Cpu
+} // namespace Bostek
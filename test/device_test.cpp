@@ -0,0 +1,416 @@
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../src/bostek/bcpu.hpp"
+#include "../src/bostek/blockDevice.hpp"
+#include "../src/bostek/dmaController.hpp"
+#include "../src/bostek/memory.hpp"
+#include "../src/bostek/northBridge.hpp"
+#include "../src/bostek/perfCounters.hpp"
+#include "../src/bostek/timer.hpp"
+#include "../src/bostek/uart.hpp"
+#include "../src/bostek/videoController.hpp"
+
+namespace Bostek {
+namespace Cpu {
+
+#define DEVICE_BASE 0xF000
+#define ISR 0x4000
+
+class DeviceTest : public testing::Test {
+    public:
+    NorthBridge *nbr;
+    Memory *mem;
+    BCpu *cpu;
+
+    // memory is zeroed, so the cpu runs NOPs
+    virtual void SetUp() {
+        mem = new Memory(0x10000);
+        cpu = new BCpu(0x1000, 0x8000);
+        nbr = new NorthBridge;
+        nbr->attachCpu(cpu);
+        nbr->attachMemory(mem);
+        mem->writel(IVT_BASE + 4 * 3, ISR);
+    }
+
+    virtual void TearDown() {
+        delete nbr;
+    }
+};
+
+TEST_F(DeviceTest, DmaCopy) {
+    DmaController *dma = new DmaController;
+    nbr->attachDevice(dma, DEVICE_BASE);
+
+    uint8_t data[64];
+    for(int i = 0; i < sizeof(data); i++) data[i] = i;
+    mem->fill(0x2000, sizeof(data), data);
+
+    nbr->writel(DEVICE_BASE + DMA_SRC, 0x2000);
+    nbr->writel(DEVICE_BASE + DMA_DST, 0x3000);
+    nbr->writel(DEVICE_BASE + DMA_LEN, sizeof(data));
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + DMA_LEN), sizeof(data));
+    nbr->writeb(DEVICE_BASE + DMA_CTRL, DMA_CTRL_START);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + DMA_STATUS), DMA_STATUS_BUSY);
+
+    // a busy transfer keeps its mode
+    nbr->writeb(DEVICE_BASE + DMA_CTRL, DMA_MODE_FILL | DMA_CTRL_IRQ);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + DMA_CTRL), 0);
+
+    // lands when the completion event fires
+    nbr->run(DMA_SETUP_CLKS + sizeof(data) / DMA_BYTES_PER_CLK - 1);
+    EXPECT_EQ(mem->readl(0x3000), 0);
+    nbr->run(2);
+    EXPECT_EQ(mem->readl(0x3000), 0x03020100);
+    EXPECT_EQ(mem->readb(0x303F), 0x3F);
+    EXPECT_EQ(mem->readb(0x3040), 0x00);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + DMA_STATUS), DMA_STATUS_DONE);
+
+    nbr->writeb(DEVICE_BASE + DMA_STATUS, DMA_STATUS_DONE);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + DMA_STATUS), 0);
+
+    // ram on the same page as the registers is still ram
+    nbr->writel(DEVICE_BASE + 0x100, 0x12345678);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + 0x100), 0x12345678);
+}
+
+TEST_F(DeviceTest, DmaFillIrq) {
+    DmaController *dma = new DmaController;
+    nbr->attachDevice(dma, DEVICE_BASE);
+    cpu->state.write_flag(FLAG_I, true);
+
+    nbr->writeb(DEVICE_BASE + DMA_SRC, 0xAA);
+    nbr->writel(DEVICE_BASE + DMA_DST, 0x3000);
+    nbr->writel(DEVICE_BASE + DMA_LEN, 0x100);
+    nbr->writeb(DEVICE_BASE + DMA_IVEC, 3);
+    nbr->writeb(DEVICE_BASE + DMA_CTRL, DMA_CTRL_START | DMA_CTRL_IRQ | DMA_MODE_FILL);
+
+    uint64_t done = DMA_SETUP_CLKS + 0x100 / DMA_BYTES_PER_CLK;
+    nbr->run(done - 1);
+    EXPECT_EQ(cpu->state.pc, 0x1000 + done - 1);
+    EXPECT_EQ(mem->readb(0x3000), 0x00);
+
+    // the irq is taken between clks
+    nbr->run(2);
+    EXPECT_EQ(mem->readl(0x30FC), 0xAAAAAAAA);
+    EXPECT_EQ(mem->readb(0x3100), 0x00);
+    EXPECT_EQ(cpu->state.pc, ISR + 1);
+    EXPECT_EQ(cpu->state.sp, 0x8000 - 4);
+    EXPECT_EQ(mem->readl(cpu->state.sp), 0x1000 + done);
+    EXPECT_FALSE(cpu->state.read_flag(FLAG_I));
+}
+
+TEST_F(DeviceTest, IrqMasked) {
+    DmaController *dma = new DmaController;
+    nbr->attachDevice(dma, DEVICE_BASE);
+
+    nbr->writel(DEVICE_BASE + DMA_LEN, 0);
+    nbr->writeb(DEVICE_BASE + DMA_IVEC, 3);
+    nbr->writeb(DEVICE_BASE + DMA_CTRL, DMA_CTRL_START | DMA_CTRL_IRQ);
+    nbr->run(10);
+    EXPECT_EQ(cpu->state.pc, 0x100A);
+
+    // held until interrupts are enabled
+    mem->writeb(0x100A, ORSB_K);
+    mem->writeb(0x100B, FLAGBIT_I);
+    nbr->run(1);
+    EXPECT_EQ(cpu->state.pc, ISR);
+    EXPECT_EQ(mem->readl(cpu->state.sp), 0x100C);
+
+    // RFI returns and unmasks
+    mem->writeb(ISR, RFI);
+    nbr->run(1);
+    EXPECT_EQ(cpu->state.pc, 0x100C);
+    EXPECT_TRUE(cpu->state.read_flag(FLAG_I));
+}
+
+TEST_F(DeviceTest, TimerCount) {
+    Timer *timer = new Timer;
+    nbr->attachDevice(timer, DEVICE_BASE);
+
+    nbr->writeb(DEVICE_BASE + TIMER_PRESCALE, 3);
+    nbr->writel(DEVICE_BASE + TIMER_COMPARE, 10);
+    nbr->writeb(DEVICE_BASE + TIMER_CTRL, TIMER_CTRL_ENABLE);
+
+    nbr->run(20);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + TIMER_COUNT), 5);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + TIMER_STATUS), 0);
+    nbr->run(20);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + TIMER_COUNT), 10);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + TIMER_STATUS), TIMER_STATUS_MATCH);
+
+    // one shot keeps counting
+    nbr->run(8);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + TIMER_COUNT), 12);
+
+    nbr->writel(DEVICE_BASE + TIMER_COUNT, 100);
+    nbr->writeb(DEVICE_BASE + TIMER_CTRL, 0);
+    nbr->run(8);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + TIMER_COUNT), 100);
+}
+
+TEST_F(DeviceTest, TimerWfi) {
+    // 0x1000: WFI; RJMP $1000
+    // ISR: INCL A; RFI
+    uint8_t idle[] = { WFI, RJMP, 0xFC, 0xFF };
+    uint8_t isr[] = { INCX, 0x20, RFI };
+    mem->fill(0x1000, sizeof(idle), idle);
+    mem->fill(ISR, sizeof(isr), isr);
+    cpu->state.write_flag(FLAG_I, true);
+
+    Timer *timer = new Timer;
+    nbr->attachDevice(timer, DEVICE_BASE);
+    nbr->writel(DEVICE_BASE + TIMER_COMPARE, 0x40000000);
+    nbr->writeb(DEVICE_BASE + TIMER_IVEC, 3);
+    nbr->writeb(DEVICE_BASE + TIMER_CTRL, TIMER_CTRL_ENABLE | TIMER_CTRL_PERIODIC | TIMER_CTRL_IRQ);
+
+    // 2^36 clks; only finishes because idle time is skipped
+    EXPECT_EQ(nbr->run((1ULL << 36) + 4), (1ULL << 36) + 4);
+    EXPECT_EQ(cpu->state.registers[REG_A], 64);
+    EXPECT_TRUE(cpu->isWaiting());
+    EXPECT_EQ(cpu->state.pc, 0x1001);
+}
+
+TEST_F(DeviceTest, TimerCompareBehind) {
+    uint8_t idle[] = { WFI, RJMP, 0xFC, 0xFF };
+    uint8_t isr[] = { INCX, 0x20, RFI };
+    mem->fill(0x1000, sizeof(idle), idle);
+    mem->fill(ISR, sizeof(isr), isr);
+    cpu->state.write_flag(FLAG_I, true);
+
+    Timer *timer = new Timer;
+    nbr->attachDevice(timer, DEVICE_BASE);
+    nbr->writeb(DEVICE_BASE + TIMER_IVEC, 3);
+    nbr->writeb(DEVICE_BASE + TIMER_CTRL, TIMER_CTRL_ENABLE | TIMER_CTRL_IRQ);
+    nbr->run(100);
+    nbr->writel(DEVICE_BASE + TIMER_COMPARE, 50);
+
+    // already passed, so it only matches once the count wraps round
+    nbr->run(1);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + TIMER_STATUS), 0);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + TIMER_COUNT), 101);
+    nbr->run((1ULL << 32) - 60);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + TIMER_STATUS), 0);
+    EXPECT_EQ(cpu->state.registers[REG_A], 0);
+    nbr->run(20);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + TIMER_STATUS), TIMER_STATUS_MATCH);
+    EXPECT_EQ(cpu->state.registers[REG_A], 1);
+}
+
+TEST_F(DeviceTest, VideoDirtyLines) {
+    VideoController *video = new VideoController;
+    nbr->attachDevice(video, DEVICE_BASE);
+
+    // 1024 byte lines, so 4 to a page
+    nbr->writew(DEVICE_BASE + VIDEO_WIDTH, 1024);
+    nbr->writew(DEVICE_BASE + VIDEO_HEIGHT, 8);
+    nbr->writel(DEVICE_BASE + VIDEO_BASE, 0x8000);
+    nbr->writel(DEVICE_BASE + VIDEO_PALETTE, 0xFF000000);
+    nbr->writel(DEVICE_BASE + VIDEO_PALETTE + 4, 0xFF0000FF);
+
+    Image *img = video->render();
+    ASSERT_NE(img, (Image*) NULL);
+    EXPECT_EQ(img->getWidth(), 1024);
+    EXPECT_EQ(img->getPixel(3, 5), Pixel(0, 0, 0, 0xFF));
+
+    // the first write disarms the page until the next render
+    mem->writeb(0x8000 + 5 * 1024 + 3, 1);
+    EXPECT_FALSE(mem->getTrap(0x9000) & PAGE_WATCH);
+    video->render();
+    EXPECT_EQ(img->getPixel(3, 5), Pixel(0xFF, 0, 0, 0xFF));
+    EXPECT_TRUE(mem->getTrap(0x9000) & PAGE_WATCH);
+
+    // lines on pages that were not reported are not converted again
+    mem->clearTrap(0x8000, 1, PAGE_WATCH);
+    mem->writeb(0x8000, 1);
+    mem->set(0x9000 + 3 * 1024, 1, 4);
+    video->render();
+    EXPECT_EQ(img->getPixel(0, 0), Pixel(0, 0, 0, 0xFF));
+    EXPECT_EQ(img->getPixel(2, 7), Pixel(0xFF, 0, 0, 0xFF));
+
+    // palette changes redraw everything
+    nbr->writeb(DEVICE_BASE + VIDEO_PALETTE + 5, 0xFF);
+    video->render();
+    EXPECT_EQ(img->getPixel(0, 0), Pixel(0xFF, 0xFF, 0, 0xFF));
+}
+
+TEST_F(DeviceTest, VideoRgb565) {
+    VideoController *video = new VideoController(1000);
+    nbr->attachDevice(video, DEVICE_BASE);
+
+    // wide enough for both the vector loop and the tail
+    uint16_t line[11] = { 0xF800, 0x07E0, 0x001F, 0xFFFF, 0x0000, 0x8410, 0xF800, 0x07E0, 0x001F, 0xFFFF, 0x0841 };
+    mem->fill(0x8000, sizeof(line), line);
+    nbr->writeb(DEVICE_BASE + VIDEO_FORMAT, VIDEO_FORMAT_RGB565);
+    nbr->writew(DEVICE_BASE + VIDEO_WIDTH, 11);
+    nbr->writew(DEVICE_BASE + VIDEO_HEIGHT, 1);
+    nbr->writel(DEVICE_BASE + VIDEO_BASE, 0x8000);
+
+    Image *img = video->render();
+    ASSERT_NE(img, (Image*) NULL);
+    EXPECT_EQ(img->getPixel(0, 0), Pixel(0xFF, 0, 0, 0xFF));
+    EXPECT_EQ(img->getPixel(1, 0), Pixel(0, 0xFF, 0, 0xFF));
+    EXPECT_EQ(img->getPixel(2, 0), Pixel(0, 0, 0xFF, 0xFF));
+    EXPECT_EQ(img->getPixel(3, 0), Pixel(0xFF, 0xFF, 0xFF, 0xFF));
+    EXPECT_EQ(img->getPixel(4, 0), Pixel(0, 0, 0, 0xFF));
+    EXPECT_EQ(img->getPixel(5, 0), Pixel(0x84, 0x82, 0x84, 0xFF));
+    EXPECT_EQ(img->getPixel(8, 0), Pixel(0, 0, 0xFF, 0xFF));
+    EXPECT_EQ(img->getPixel(9, 0), Pixel(0xFF, 0xFF, 0xFF, 0xFF));
+    EXPECT_EQ(img->getPixel(10, 0), Pixel(0x08, 0x08, 0x08, 0xFF));
+
+    // frames are counted while enabled
+    nbr->writeb(DEVICE_BASE + VIDEO_CTRL, VIDEO_CTRL_ENABLE);
+    nbr->run(3500);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + VIDEO_FRAME), 3);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + VIDEO_STATUS), VIDEO_STATUS_VBLANK);
+}
+
+TEST_F(DeviceTest, BlockReadWrite) {
+    char path[] = "/tmp/bostek_block_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    uint8_t disk[4 * BLOCK_SECTOR_SIZE];
+    for(int i = 0; i < sizeof(disk); i++) disk[i] = i / BLOCK_SECTOR_SIZE + 1;
+    ASSERT_EQ(write(fd, disk, sizeof(disk)), sizeof(disk));
+
+    BlockDevice *blk = new BlockDevice(path);
+    nbr->attachDevice(blk, DEVICE_BASE);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + BLOCK_CAPACITY), 4);
+
+    // sectors 1-2 to ram
+    nbr->writel(DEVICE_BASE + BLOCK_SECTOR, 1);
+    nbr->writel(DEVICE_BASE + BLOCK_ADDR, 0x8000);
+    nbr->writew(DEVICE_BASE + BLOCK_COUNT, 2);
+    nbr->writeb(DEVICE_BASE + BLOCK_CMD, BLOCK_CMD_READ);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + BLOCK_STATUS), BLOCK_STATUS_BUSY);
+    nbr->run(BLOCK_SETUP_CLKS);
+    EXPECT_EQ(mem->readb(0x8000), 0); // not before it completes
+    while(nbr->readb(DEVICE_BASE + BLOCK_STATUS) & BLOCK_STATUS_BUSY) nbr->run(BLOCK_POLL_CLKS);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + BLOCK_STATUS), BLOCK_STATUS_DONE);
+    EXPECT_EQ(mem->readb(0x8000), 2);
+    EXPECT_EQ(mem->readb(0x8000 + 2 * BLOCK_SECTOR_SIZE - 1), 3);
+    EXPECT_EQ(mem->readb(0x8000 + 2 * BLOCK_SECTOR_SIZE), 0);
+
+    // ram to sector 3
+    mem->set(0x9000, 0xAB, BLOCK_SECTOR_SIZE);
+    nbr->writeb(DEVICE_BASE + BLOCK_STATUS, BLOCK_STATUS_DONE);
+    nbr->writel(DEVICE_BASE + BLOCK_SECTOR, 3);
+    nbr->writel(DEVICE_BASE + BLOCK_ADDR, 0x9000);
+    nbr->writew(DEVICE_BASE + BLOCK_COUNT, 1);
+    nbr->writeb(DEVICE_BASE + BLOCK_CMD, BLOCK_CMD_WRITE);
+    while(nbr->readb(DEVICE_BASE + BLOCK_STATUS) & BLOCK_STATUS_BUSY) nbr->run(BLOCK_POLL_CLKS);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + BLOCK_STATUS), BLOCK_STATUS_DONE);
+    uint8_t sector[BLOCK_SECTOR_SIZE];
+    ASSERT_EQ(pread(fd, sector, sizeof(sector), 3 * BLOCK_SECTOR_SIZE), sizeof(sector));
+    EXPECT_EQ(sector[0], 0xAB);
+    EXPECT_EQ(sector[BLOCK_SECTOR_SIZE - 1], 0xAB);
+
+    // past the end fails without touching the disk
+    nbr->writel(DEVICE_BASE + BLOCK_SECTOR, 4);
+    nbr->writeb(DEVICE_BASE + BLOCK_CMD, BLOCK_CMD_READ);
+    nbr->run(BLOCK_SETUP_CLKS);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + BLOCK_STATUS), BLOCK_STATUS_DONE | BLOCK_STATUS_ERROR);
+
+    close(fd);
+    unlink(path);
+}
+
+TEST_F(DeviceTest, UartTx) {
+    int out[2];
+    ASSERT_EQ(pipe(out), 0);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    Uart *uart = new Uart(out[1]);
+    nbr->attachDevice(uart, DEVICE_BASE);
+
+    const char *msg = "hello";
+    for(int i = 0; i < 5; i++) nbr->writeb(DEVICE_BASE + UART_DATA, msg[i]);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_TX_COUNT), 5);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_STATUS), 0);
+    nbr->run(5 * UART_BYTE_CLKS);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_STATUS), UART_STATUS_TX_EMPTY);
+
+    // held on the host side until a batch is due
+    char buf[16];
+    EXPECT_EQ(read(out[0], buf, sizeof(buf)), -1);
+    nbr->run(UART_FLUSH_CLKS);
+    ASSERT_EQ(read(out[0], buf, sizeof(buf)), 5);
+    EXPECT_EQ(memcmp(buf, msg, 5), 0);
+
+    // a full fifo drops and flags the byte
+    for(int i = 0; i < UART_FIFO_SIZE + 1; i++) nbr->writeb(DEVICE_BASE + UART_DATA, 'x');
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_STATUS), UART_STATUS_TX_FULL | UART_STATUS_OVERRUN);
+    uart->flush();
+    EXPECT_EQ(read(out[0], buf, sizeof(buf)), UART_FIFO_SIZE);
+
+    close(out[0]);
+    close(out[1]);
+}
+
+TEST_F(DeviceTest, UartRxIrq) {
+    int in[2];
+    ASSERT_EQ(pipe(in), 0);
+    Uart *uart = new Uart(-1, in[0]);
+    nbr->attachDevice(uart, DEVICE_BASE);
+    // 0x1000: RJMP $1000
+    // ISR: INCL A; RFI
+    uint8_t loop[] = { RJMP, 0xFD, 0xFF };
+    uint8_t isr[] = { INCX, 0x20, RFI };
+    mem->fill(0x1000, sizeof(loop), loop);
+    mem->fill(ISR, sizeof(isr), isr);
+    cpu->state.write_flag(FLAG_I, true);
+
+    nbr->writeb(DEVICE_BASE + UART_IVEC, 3);
+    nbr->writeb(DEVICE_BASE + UART_CTRL, UART_CTRL_RX_IRQ);
+    nbr->run(UART_RX_POLL_CLKS);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_STATUS) & UART_STATUS_RX_READY, 0);
+
+    ASSERT_EQ(write(in[1], "ab", 2), 2);
+    nbr->run(UART_RX_POLL_CLKS + 2 * UART_BYTE_CLKS);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_RX_COUNT), 2);
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_DATA), 'a');
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_DATA), 'b');
+    EXPECT_EQ(nbr->readb(DEVICE_BASE + UART_STATUS), UART_STATUS_TX_EMPTY);
+    EXPECT_EQ(cpu->state.registers[REG_A], 2); // an irq per byte
+
+    close(in[0]);
+    close(in[1]);
+}
+
+TEST_F(DeviceTest, PerfCounters) {
+    // 0x1000: INCL A; ASTOL $2000 A; JZS $1000; RJMP $1000
+    uint8_t program[] = {
+        INCX, 0x20,
+        ASTOL_RRK, 0xF0, 0x00, 0x20,
+        JZS, 0xF7, 0xFF,
+        RJMP, 0xF4, 0xFF,
+    };
+    mem->fill(0x1000, sizeof(program), program);
+    PerfCounters *perf = new PerfCounters;
+    nbr->attachDevice(perf, DEVICE_BASE);
+
+    nbr->run(40);
+    EXPECT_EQ(perf->read(PERF_INSTRUCTIONS), 40);
+    EXPECT_EQ(perf->read(PERF_CYCLES), 40);
+    EXPECT_EQ(perf->read(PERF_STORES), 10);
+    EXPECT_EQ(perf->read(PERF_LOADS), 0);
+    EXPECT_EQ(perf->read(PERF_BRANCHES_TAKEN), 10);
+    EXPECT_EQ(perf->read(PERF_BRANCHES_NOT_TAKEN), 10);
+    EXPECT_EQ(cpu->getOpCount(INCX), 10);
+
+    // the guest sees the snapshot, counted from its last reset
+    nbr->writeb(DEVICE_BASE + PERF_CTRL, PERF_CTRL_RESET);
+    nbr->run(8);
+    nbr->writeb(DEVICE_BASE + PERF_CTRL, PERF_CTRL_SNAPSHOT);
+    nbr->run(8);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + PERF_COUNTERS + 8 * PERF_INSTRUCTIONS), 8);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + PERF_COUNTERS + 8 * PERF_INSTRUCTIONS + 4), 0);
+    EXPECT_EQ(nbr->readl(DEVICE_BASE + PERF_COUNTERS + 8 * PERF_STORES), 2);
+    EXPECT_EQ(perf->read(PERF_INSTRUCTIONS), 16);
+}
+
+} // namespace Cpu
+} // namespace Bostek